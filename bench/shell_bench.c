@@ -0,0 +1,258 @@
+// shell_bench.c
+// microbenchmarks for bropesh's own hot paths, built and run by "make bench"
+// the harness links the shell's object files (main.c is rebuilt with its main
+// renamed to bropesh_main) and times tokenize_input, prompt rendering, history
+// load/append and the spawn path of execute_external_command. every benchmark
+// runs a fixed number of operations per repetition; the median of
+// BENCH_REPETITIONS repetitions is reported together with the fastest one and
+// the spread between them, so runs on different commits can be compared line by
+// line. the history benchmarks use a scratch home directory under /tmp and never
+// touch the real ~/.bropesh_history.
+//   make bench                 run everything
+//   make bench BENCH=spawn     only benchmarks whose name contains "spawn"
+
+#include "shell.h"
+#include <sys/stat.h> // for mkdir
+#include <time.h>     // for clock_gettime
+
+#define BENCH_REPETITIONS 7
+// records in the synthetic history file for history/load
+#define BENCH_HISTORY_RECORDS 200000
+
+struct benchmark {
+    const char *name;
+    long iterations;               // operations per repetition
+    void (*run)(long iterations);
+    size_t bytes_per_op;           // input bytes per operation, 0 if throughput makes no sense
+};
+
+static char *long_pipeline_line;
+static char *long_args_line;
+static char scratch_home[] = "/tmp/bropesh-bench.XXXXXX";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// a 24-stage pipeline with quotes and redirections, about 1.5 KB
+static char *make_pipeline_line() {
+    char *line = malloc(4096);
+    if (line == NULL) return NULL;
+    char *p = line;
+    p += sprintf(p, "< input_file.txt");
+    for (int i = 0; i < 24; i++) {
+        p += sprintf(p, " | filter_%02d --mode=fast \"quoted argument %d\" plain_%d", i, i, i);
+    }
+    sprintf(p, " > output_file.txt");
+    return line;
+}
+
+// one command with 2000 arguments, about 16 KB
+static char *make_args_line() {
+    char *line = malloc(32768);
+    if (line == NULL) return NULL;
+    char *p = line;
+    p += sprintf(p, "command");
+    for (int i = 0; i < 2000; i++) {
+        p += sprintf(p, (i % 4 == 0) ? " \"arg %04d\"" : " arg_%04d", i);
+    }
+    return line;
+}
+
+static void tokenize_line(const char *line, long iterations) {
+    struct parsed_command cmd;
+    for (long i = 0; i < iterations; i++) {
+        arena_reset(&command_arena);
+        if (tokenize_input(line, &command_arena, &cmd) == -1) exit(EXIT_FAILURE);
+    }
+}
+
+static void bench_tokenize_short(long iterations) {
+    tokenize_line("ls -la /tmp", iterations);
+}
+
+static void bench_tokenize_pipeline(long iterations) {
+    tokenize_line(long_pipeline_line, iterations);
+}
+
+static void bench_tokenize_args(long iterations) {
+    tokenize_line(long_args_line, iterations);
+}
+
+// prompts go to /dev/null, only the cost of building and writing them is measured
+static void with_stdout_discarded(void (*body)(long), long iterations) {
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    body(iterations);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null_fd);
+}
+
+static void render_cached(long iterations) {
+    for (long i = 0; i < iterations; i++) display_prompt();
+}
+
+static void render_rebuilt(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        invalidate_prompt();
+        display_prompt();
+    }
+}
+
+static void bench_prompt_cached(long iterations) {
+    with_stdout_discarded(render_cached, iterations);
+}
+
+static void bench_prompt_rebuild(long iterations) {
+    with_stdout_discarded(render_rebuilt, iterations);
+}
+
+// writes BENCH_HISTORY_RECORDS records in the log format history.c writes
+static int write_history_file() {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", home_dir, HISTORY_FILE_NAME);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror("shell_bench: cannot create history file");
+        return -1;
+    }
+    for (int i = 1; i <= BENCH_HISTORY_RECORDS; i++) {
+        fprintf(file, ": %d;git commit -m \"change number %d\" --author=someone%d\n", i, i, i % 97);
+    }
+    return fclose(file);
+}
+
+static void bench_history_load(long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        load_history();
+        free_history();
+    }
+}
+
+static void bench_history_add(long iterations) {
+    static long counter = 0;
+    char command[64];
+    load_history();
+    for (long i = 0; i < iterations; i++) {
+        snprintf(command, sizeof(command), "make -j8 target_%ld", counter++);
+        add_to_history(command);
+    }
+    free_history();
+}
+
+static void spawn_true(const char *backend, long iterations) {
+    char *args[] = {"true", NULL};
+    struct pipeline_stage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.args = args;
+    stage.argc = 1;
+    set_spawn_backend(backend);
+    for (long i = 0; i < iterations; i++) {
+        if (execute_external_command(&stage, 0) != 0) exit(EXIT_FAILURE);
+    }
+    set_spawn_backend("posix_spawn");
+}
+
+static void bench_spawn_posix_spawn(long iterations) {
+    spawn_true("posix_spawn", iterations);
+}
+
+static void bench_spawn_vfork(long iterations) {
+    spawn_true("vfork", iterations);
+}
+
+static void bench_spawn_clone(long iterations) {
+    spawn_true("clone", iterations);
+}
+
+static void bench_spawn_fork(long iterations) {
+    spawn_true("fork", iterations);
+}
+
+static struct benchmark benchmarks[] = {
+    {"tokenize/short", 200000, bench_tokenize_short, 11},
+    {"tokenize/pipeline", 5000, bench_tokenize_pipeline, 0},
+    {"tokenize/args", 500, bench_tokenize_args, 0},
+    {"prompt/cached", 100000, bench_prompt_cached, 0},
+    {"prompt/rebuild", 20000, bench_prompt_rebuild, 0},
+    {"history/load", 20, bench_history_load, 0},
+    {"history/add", 2000, bench_history_add, 0},
+    {"spawn/posix_spawn", 300, bench_spawn_posix_spawn, 0},
+    {"spawn/vfork", 300, bench_spawn_vfork, 0},
+    {"spawn/clone", 300, bench_spawn_clone, 0},
+    {"spawn/fork", 300, bench_spawn_fork, 0},
+};
+
+// runs one benchmark and prints its line
+static void run_benchmark(struct benchmark *bench) {
+    double samples[BENCH_REPETITIONS];
+    bench->run(bench->iterations / 10 + 1); // warmup: caches, page faults, PATH lookup
+    for (int r = 0; r < BENCH_REPETITIONS; r++) {
+        double start = now();
+        bench->run(bench->iterations);
+        samples[r] = (now() - start) * 1e9 / bench->iterations;
+    }
+    qsort(samples, BENCH_REPETITIONS, sizeof(double), compare_doubles);
+
+    double median = samples[BENCH_REPETITIONS / 2];
+    printf("%-20s %14.1f %14.1f %9.1f%%", bench->name, median, samples[0],
+           100.0 * (samples[BENCH_REPETITIONS - 1] - samples[0]) / median);
+    if (bench->bytes_per_op > 0) printf(" %10.1f", bench->bytes_per_op / median * 1e3);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void remove_scratch_home() {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", scratch_home, HISTORY_FILE_NAME);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s%s.idx", scratch_home, HISTORY_FILE_NAME);
+    unlink(path);
+    rmdir(scratch_home);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = (argc > 1 && argv[1][0] != '\0') ? argv[1] : NULL;
+
+    long_pipeline_line = make_pipeline_line();
+    long_args_line = make_args_line();
+    if (long_pipeline_line == NULL || long_args_line == NULL || mkdtemp(scratch_home) == NULL) {
+        perror("shell_bench: setup failed");
+        return EXIT_FAILURE;
+    }
+    benchmarks[1].bytes_per_op = strlen(long_pipeline_line);
+    benchmarks[2].bytes_per_op = strlen(long_args_line);
+    home_dir = scratch_home;
+    setenv("BROPESH_HISTORY_SYNC", "lazy", 1);
+    enable_history(); // like an interactive session, otherwise load_history does nothing
+    setup_signal_handlers();
+    init_jobs();
+    if (write_history_file() == -1) {
+        remove_scratch_home();
+        return EXIT_FAILURE;
+    }
+
+    printf("%-20s %14s %14s %10s %10s\n", "benchmark", "median ns/op", "min ns/op", "spread", "MB/s");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (filter == NULL || strstr(benchmarks[i].name, filter) != NULL) {
+            run_benchmark(&benchmarks[i]);
+        }
+    }
+
+    remove_scratch_home();
+    arena_free(&command_arena);
+    free(long_pipeline_line);
+    free(long_args_line);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+// arena.c
+// bump allocator for per-command data (tokens, argv arrays, pipeline stages)
+// everything allocated while running one input line is released at once by
+// arena_reset, so parsing a command does no per-token malloc/free at all.
+// nested users (a builtin that runs other command lines) take a mark first
+// and release back to it, leaving the outer command's data untouched.
+
+#include "shell.h"
+
+// every allocation is aligned for any basic type
+#define ARENA_ALIGNMENT 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+static struct arena_block *new_block(struct arena *arena, size_t min_size) {
+    size_t block_size = (arena->block_size > 0) ? arena->block_size : ARENA_BLOCK_SIZE;
+    size_t capacity = (min_size > block_size) ? min_size : block_size;
+    struct arena_block *block = malloc(sizeof(struct arena_block) + capacity);
+    if (block == NULL) {
+        perror("bropesh: malloc failed for arena block");
+        return NULL;
+    }
+    block->next = NULL;
+    block->used = 0;
+    block->capacity = capacity;
+    return block;
+}
+
+// frees every block after block
+static void free_blocks_after(struct arena_block *block) {
+    struct arena_block *next = block->next;
+    block->next = NULL;
+    while (next != NULL) {
+        struct arena_block *following = next->next;
+        free(next);
+        next = following;
+    }
+}
+
+// returns size bytes from the arena, or NULL after printing an error
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (arena->first == NULL) {
+        arena->first = new_block(arena, size);
+        arena->current = arena->first;
+        if (arena->first == NULL) return NULL;
+    }
+
+    struct arena_block *block = arena->current;
+    if (block->capacity - block->used < size) {
+        block->next = new_block(arena, size);
+        if (block->next == NULL) return NULL;
+        block = block->next;
+        arena->current = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// copies len bytes of str into the arena and NUL-terminates them
+char *arena_strndup(struct arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+// remembers the current end of the arena
+struct arena_mark arena_mark(struct arena *arena) {
+    struct arena_mark mark;
+    mark.block = arena->current;
+    mark.used = (arena->current != NULL) ? arena->current->used : 0;
+    return mark;
+}
+
+// frees everything allocated after mark was taken
+void arena_release(struct arena *arena, struct arena_mark mark) {
+    if (mark.block == NULL) {
+        arena_reset(arena);
+        return;
+    }
+    free_blocks_after(mark.block);
+    mark.block->used = mark.used;
+    arena->current = mark.block;
+}
+
+// frees everything, the first block is kept for the next command
+void arena_reset(struct arena *arena) {
+    if (arena->first == NULL) return;
+    free_blocks_after(arena->first);
+    arena->first->used = 0;
+    arena->current = arena->first;
+}
+
+// releases all memory of the arena
+void arena_free(struct arena *arena) {
+    if (arena->first == NULL) return;
+    free_blocks_after(arena->first);
+    free(arena->first);
+    arena->first = NULL;
+    arena->current = NULL;
+}
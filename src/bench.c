@@ -0,0 +1,235 @@
+// bench.c
+// the bench builtin: repeated runs of one or more commands with summary statistics
+//   bench [-n runs] [-w warmup] [-s] "cmd" ["other cmd" ...]
+// every run goes through the same spawn and job table path as a command typed
+// at the prompt, with stdout sent to /dev/null (unless -s) so the speed of the
+// terminal does not end up in the numbers. wall time comes from
+// CLOCK_MONOTONIC, cpu time (user + sys) from the rusage wait4() collects.
+// runs are summarised by min/median/p95/p99/mean/stddev, runs outside the
+// 1.5 IQR fences are counted as outliers, and with several commands the
+// fastest one is compared against the others by their mean wall time.
+
+#include "shell.h"
+#include <math.h> // for sqrt
+#include <time.h> // for clock_gettime
+
+#define BENCH_DEFAULT_RUNS 10
+
+// samples of one command
+struct bench_result {
+    const char *command;
+    double *wall; // seconds per run, sorted once all runs are done
+    double *cpu;
+    int runs;
+    double mean; // mean wall time, for the comparison
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// p-th percentile (0..100) of sorted samples, interpolated between neighbours
+static double percentile(const double *sorted, int n, double p) {
+    double rank = p / 100.0 * (n - 1);
+    int low = (int)rank;
+    if (low >= n - 1) return sorted[n - 1];
+    return sorted[low] + (rank - low) * (sorted[low + 1] - sorted[low]);
+}
+
+static double mean_of(const double *samples, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += samples[i];
+    return sum / n;
+}
+
+// sample standard deviation, 0 for a single run
+static double stddev_of(const double *samples, int n) {
+    if (n < 2) return 0;
+    double mean = mean_of(samples, n), sum = 0;
+    for (int i = 0; i < n; i++) sum += (samples[i] - mean) * (samples[i] - mean);
+    return sqrt(sum / (n - 1));
+}
+
+// formats a duration with a unit that keeps three or four significant digits
+static const char *format_time(double seconds, char *buffer, size_t size) {
+    if (seconds >= 1) snprintf(buffer, size, "%.3f s", seconds);
+    else if (seconds >= 1e-3) snprintf(buffer, size, "%.2f ms", seconds * 1e3);
+    else snprintf(buffer, size, "%.1f us", seconds * 1e6);
+    return buffer;
+}
+
+static void print_row(const char *label, double *sorted, int n) {
+    char text[6][32];
+    printf("  %-5s %12s %12s %12s %12s %12s %12s\n", label,
+           format_time(sorted[0], text[0], sizeof(text[0])),
+           format_time(percentile(sorted, n, 50), text[1], sizeof(text[1])),
+           format_time(percentile(sorted, n, 95), text[2], sizeof(text[2])),
+           format_time(percentile(sorted, n, 99), text[3], sizeof(text[3])),
+           format_time(mean_of(sorted, n), text[4], sizeof(text[4])),
+           format_time(stddev_of(sorted, n), text[5], sizeof(text[5])));
+}
+
+// runs a parsed command once with stdout on /dev/null (unless show_output)
+// stores the wall and cpu seconds, returns the command's exit status
+static int run_once(struct parsed_command *cmd, int show_output, double *wall, double *cpu) {
+    struct pipeline_stage *last = &cmd->stages[cmd->num_stages - 1];
+    char *output_file = last->output_file;
+    if (!show_output && output_file == NULL) last->output_file = "/dev/null";
+
+    struct timespec start, end;
+    struct rusage usage;
+    reset_job_usage();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status;
+    if (cmd->num_stages > 1 || cmd->stages[0].argc == 0) {
+        status = execute_pipeline(cmd->stages, cmd->num_stages, 0);
+    } else {
+        status = execute_external_command(&cmd->stages[0], 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    get_job_usage(&usage);
+
+    last->output_file = output_file;
+    *wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    *cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    return status;
+}
+
+// runs warmup + runs iterations of text, returns 0 or the status of a failed run
+static int bench_command(struct bench_result *result, int runs, int warmup, int show_output) {
+    struct parsed_command cmd;
+    if (tokenize_input(result->command, &command_arena, &cmd) == -1) return 2;
+    for (int i = 0; i < cmd.num_stages; i++) {
+        if (cmd.stages[i].argc > 0 && is_builtin_command(cmd.stages[i].args[0])) {
+            fprintf(stderr, "bropesh: bench: %s: builtins cannot be benchmarked\n", cmd.stages[i].args[0]);
+            return 2;
+        }
+    }
+    if (cmd.is_background) {
+        fprintf(stderr, "bropesh: bench: %s: background commands cannot be benchmarked\n", result->command);
+        return 2;
+    }
+
+    sigint_received = 0;
+    for (int i = -warmup; i < runs; i++) {
+        double wall, cpu;
+        int status = run_once(&cmd, show_output, &wall, &cpu);
+        if (status != 0 || sigint_received) {
+            fprintf(stderr, "bropesh: bench: \"%s\" failed with status %d, stopping\n", result->command, status);
+            return (status != 0) ? status : 128 + SIGINT;
+        }
+        if (i >= 0) {
+            result->wall[i] = wall;
+            result->cpu[i] = cpu;
+            result->runs++;
+        }
+    }
+    return 0;
+}
+
+static void report(struct bench_result *result) {
+    int n = result->runs;
+    qsort(result->wall, n, sizeof(double), compare_doubles);
+    qsort(result->cpu, n, sizeof(double), compare_doubles);
+
+    printf("bench: %s (%d run%s)\n", result->command, n, (n == 1) ? "" : "s");
+    printf("  %-5s %12s %12s %12s %12s %12s %12s\n", "", "min", "median", "p95", "p99", "mean", "stddev");
+    print_row("wall", result->wall, n);
+    print_row("cpu", result->cpu, n);
+
+    // tukey fences on wall time
+    double q1 = percentile(result->wall, n, 25), q3 = percentile(result->wall, n, 75);
+    double low = q1 - 1.5 * (q3 - q1), high = q3 + 1.5 * (q3 - q1);
+    int outliers = 0;
+    for (int i = 0; i < n; i++) {
+        if (result->wall[i] < low || result->wall[i] > high) outliers++;
+    }
+    if (outliers > 0) {
+        printf("  %d outlier%s outside 1.5 IQR%s\n", outliers, (outliers == 1) ? "" : "s",
+               (outliers * 10 > n) ? ", results may be skewed by other load (try -w or more runs)" : "");
+    }
+}
+
+// bench [-n runs] [-w warmup] [-s] "cmd" ...: benchmarks each command and compares them
+int builtin_bench(char **args) {
+    int runs = BENCH_DEFAULT_RUNS, warmup = 0, show_output = 0;
+    int first = 1;
+
+    while (args[first] != NULL && args[first][0] == '-') {
+        if ((strcmp(args[first], "-n") == 0 || strcmp(args[first], "-w") == 0) && args[first + 1] != NULL) {
+            char *end;
+            long value = strtol(args[first + 1], &end, 10);
+            int is_runs = (args[first][1] == 'n');
+            if (*end != '\0' || value < (is_runs ? 1 : 0) || value > 1000000) {
+                fprintf(stderr, "bropesh: bench: %s: invalid number of %s\n", args[first + 1], is_runs ? "runs" : "warmup runs");
+                return 2;
+            }
+            if (is_runs) runs = (int)value;
+            else warmup = (int)value;
+            first += 2;
+        } else if (strcmp(args[first], "-s") == 0) {
+            show_output = 1;
+            first++;
+        } else if (strcmp(args[first], "--") == 0) {
+            first++;
+            break;
+        } else {
+            fprintf(stderr, "bropesh: bench: %s: invalid option\n", args[first]);
+            fprintf(stderr, "bropesh: bench: usage: bench [-n runs] [-w warmup] [-s] \"command\" ...\n");
+            return 2;
+        }
+    }
+    int num_commands = 0;
+    while (args[first + num_commands] != NULL) num_commands++;
+    if (num_commands == 0) {
+        fprintf(stderr, "bropesh: bench: usage: bench [-n runs] [-w warmup] [-s] \"command\" ...\n");
+        return 2;
+    }
+
+    struct bench_result *results = calloc(num_commands, sizeof(struct bench_result));
+    double *samples = malloc(2 * (size_t)num_commands * runs * sizeof(double));
+    if (results == NULL || samples == NULL) {
+        perror("bropesh: bench: malloc failed");
+        free(results);
+        free(samples);
+        return 1;
+    }
+
+    // the commands are parsed into the arena after the bench line itself
+    struct arena_mark mark = arena_mark(&command_arena);
+    int exit_status = 0;
+    for (int i = 0; i < num_commands && exit_status == 0; i++) {
+        results[i].command = args[first + i];
+        results[i].wall = samples + (size_t)2 * i * runs;
+        results[i].cpu = results[i].wall + runs;
+        exit_status = bench_command(&results[i], runs, warmup, show_output);
+        if (exit_status == 0) {
+            report(&results[i]);
+            fflush(stdout);
+        }
+    }
+    arena_release(&command_arena, mark);
+
+    if (exit_status == 0 && num_commands > 1) {
+        // compare by mean wall time, the spread is propagated from both stddevs
+        int fastest = 0;
+        for (int i = 0; i < num_commands; i++) {
+            results[i].mean = mean_of(results[i].wall, results[i].runs);
+            if (results[i].mean < results[fastest].mean) fastest = i;
+        }
+        double fast_rel = stddev_of(results[fastest].wall, runs) / results[fastest].mean;
+        printf("summary: \"%s\" ran\n", results[fastest].command);
+        for (int i = 0; i < num_commands; i++) {
+            if (i == fastest) continue;
+            double ratio = results[i].mean / results[fastest].mean;
+            double rel = stddev_of(results[i].wall, runs) / results[i].mean;
+            printf("  %6.2f ± %.2f times faster than \"%s\"\n", ratio, ratio * sqrt(rel * rel + fast_rel * fast_rel),
+                   results[i].command);
+        }
+    }
+
+    free(samples);
+    free(results);
+    return exit_status;
+}
@@ -5,39 +5,122 @@
 #include <limits.h> // for path_max
 #include <stdio.h>
 
-int execute_builtin_command(char **args) {
-    if (strcmp(args[0], "exit") == 0) {
-        save_history();
-        if (home_dir != NULL) free(home_dir);
-        if (prev_dir != NULL) free(prev_dir);
-        for (int i = 0; i < MAX_HISTORY_SIZE; i++) {
-            if (history_commands[i] != NULL) free(history_commands[i]);
-        }
-        if (history_file_ptr != NULL) fclose(history_file_ptr);
-        exit(0);
-    } else if (strcmp(args[0], "echo") == 0) {
-        builtin_echo(args + 1);
-        return 1;
-    } else if (strcmp(args[0], "pwd") == 0) {
-        if (args[1] != NULL) {
-            fprintf(stderr, "bropesh: pwd: too many arguments\n");
+// exit [n]: without n the shell exits with the status of the last command, like sh
+static int run_exit(char **args) {
+    int status = last_exit_status;
+    if (args[1] != NULL) {
+        char *end;
+        errno = 0;
+        long n = strtol(args[1], &end, 10);
+        if (end == args[1] || *end != '\0' || errno == ERANGE) {
+            fprintf(stderr, "bropesh: exit: %s: numeric argument required\n", args[1]);
+            status = 2;
+        } else if (args[2] != NULL) {
+            fprintf(stderr, "bropesh: exit: too many arguments\n");
+            return 1;
         } else {
-            builtin_pwd();
+            status = n & 0xff;
         }
+    }
+    free_history();
+    if (home_dir != NULL) free(home_dir);
+    if (prev_dir != NULL) free(prev_dir);
+    fflush(stdout);
+    exit(status);
+}
+
+static int run_echo(char **args) {
+    builtin_echo(args + 1);
+    return 0;
+}
+
+static int run_pwd(char **args) {
+    if (args[1] != NULL) {
+        fprintf(stderr, "bropesh: pwd: too many arguments\n");
         return 1;
-    } else if (strcmp(args[0], "cd") == 0) {
-        return builtin_cd(args);
-     } else if (strcmp(args[0], "help") == 0) {
-        return builtin_help();
-    } else if (strcmp(args[0], "history") == 0) {
-        if (args[1] != NULL) {
-            fprintf(stderr, "bropesh: history: too many arguments\n");
-        } else {
-            builtin_history();
+    }
+    builtin_pwd();
+    return 0;
+}
+
+static int run_help(char **args) {
+    (void)args;
+    return builtin_help();
+}
+
+static int run_history(char **args) {
+    if (args[1] == NULL) {
+        builtin_history();
+    } else if (strcmp(args[1], "-r") == 0 && args[2] == NULL) {
+        // pull in what other sessions appended
+        merge_history();
+    } else if (strcmp(args[1], "-s") == 0 && args[2] != NULL && args[3] == NULL) {
+        // search the whole history file through its index
+        history_search_print(args[2]);
+    } else {
+        fprintf(stderr, "bropesh: history: usage: history [-r | -s pattern]\n");
+        return 2;
+    }
+    return 0;
+}
+
+// every builtin, loaded into the command table (commands.c) at startup
+const struct builtin builtins[] = {
+    {"exit", run_exit},
+    {"echo", run_echo},
+    {"pwd", run_pwd},
+    {"cd", builtin_cd},
+    {"help", run_help},
+    {"history", run_history},
+    {"hash", builtin_hash},
+    {"jobs", builtin_jobs},
+    {"fg", builtin_fg},
+    {"bg", builtin_bg},
+    {"wait", builtin_wait},
+    {"kill", builtin_kill},
+    {"time", NULL}, // a keyword, execute_parsed_command handles it
+    {"parallel", builtin_parallel},
+    {"bench", builtin_bench},
+    {"memo", builtin_memo},
+    {"export", builtin_export},
+    {"unset", builtin_unset},
+    {"alias", builtin_alias},
+    {"unalias", builtin_unalias},
+    {NULL, NULL}};
+
+// applies the stage's redirections to the shell's own stdin, stdout and stderr
+// for a builtin, the originals are kept in saved[] (-1 where nothing changed)
+// returns 0, or -1 after printing an error with everything left as it was
+int redirect_builtin(struct pipeline_stage *stage, int saved[3]) {
+    int fds[3];
+    saved[0] = saved[1] = saved[2] = -1;
+    if (open_stage_redirections(stage, fds) == -1) return -1;
+
+    fflush(stdout); // output buffered so far belongs to the old stdout
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == -1) continue;
+        // the copy lives above the low fds and is not inherited by children
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        if (saved[i] == -1 || dup2(fds[i], i) == -1) {
+            perror("bropesh: failed to redirect builtin");
+            close_stage_redirections(fds);
+            restore_builtin_redirections(saved);
+            return -1;
         }
-        return 1;
     }
-    return 0; // not a built-in command
+    close_stage_redirections(fds);
+    return 0;
+}
+
+void restore_builtin_redirections(int saved[3]) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] == -1) continue;
+        dup2(saved[i], i);
+        close(saved[i]);
+        saved[i] = -1;
+    }
 }
 
 void builtin_echo(char **args) {
@@ -65,14 +148,39 @@ int builtin_help() {
     printf("  cd [dir]    : Change directory (supports ~, .., -)\n");
     printf("  pwd         : Print current working directory\n");
     printf("  echo [arg]  : Display text\n");
-    printf("  history     : Display last 20 commands\n");
+    printf("  history     : Display last 10 commands\n");
+    printf("  history -s <pattern> : Search the whole history file\n");
+    printf("  history -r  : Read commands other sessions added to the history file\n");
+    printf("  hash [-r]   : Show or reset the cache of command locations\n");
+    printf("  jobs [-l]   : List background and stopped jobs\n");
+    printf("  fg [%%job]   : Continue a job in the foreground\n");
+    printf("  bg [%%job]   : Continue a stopped job in the background\n");
+    printf("  wait [%%job|pid] : Wait for background jobs to finish\n");
+    printf("  kill [-sig] %%job|pid : Send a signal to a job or process\n");
+    printf("  time [-p|-v|-j] [-o file] cmd : Report time and resource usage of a command\n");
+    printf("  parallel [-j N] cmd {} ::: args : Run cmd once per argument (or stdin line), N at a time\n");
+    printf("  bench [-n runs] [-w warmup] [-s] \"cmd\" ... : Benchmark and compare commands\n");
+    printf("  memo [-d file] [-e var] cmd : Run cmd once, replay its output while its inputs are unchanged\n");
+    printf("  memo -c     : Empty the memo cache\n");
+    printf("  export [name[=value]] : Set and export variables, or list the exported ones\n");
+    printf("  unset [-f] name : Remove variables (functions with -f)\n");
+    printf("  alias [name[=value]] : Define or list aliases\n");
+    printf("  unalias [-a] name : Remove aliases\n");
     printf("  help        : Display this information\n");
-    printf("  exit        : Exit the shell\n");
+    printf("  exit [n]    : Exit the shell with status n (default: the last command's)\n");
     printf("\n");
     printf("Supported Features:\n");
     printf("  - External commands (e.g., ls, grep)\n");
-    printf("  - I/O Redirection (< input_file, > output_file)\n");
+    printf("  - I/O Redirection (< input_file, > output_file, >> append_file, 2> error_file)\n");
+    printf("  - Here-strings and here-documents (cmd <<< text, cmd <<EOF ... EOF)\n");
+    printf("  - Command substitution ($(cmd), \"$(cmd)\" stays one word)\n");
+    printf("  - Variables (name=value, $name, ${name}, $? for the last status, $$)\n");
+    printf("  - Functions (name() { cmd1; cmd2; }, arguments in $1...$9, $#, $@)\n");
+    printf("  - Pipelines (cmd1 | cmd2 | ...)\n");
+    printf("  - Command lists (cmd1; cmd2, cmd1 && cmd2, cmd1 || cmd2)\n");
+    printf("  - Wildcards (*.c, file?.txt, [a-z]*, \"*\" stays literal)\n");
     printf("  - Background execution (end command with &)\n");
+    printf("  - Startup file (~/.bropeshrc; bropesh -q, --norc, --startup-profile)\n");
     printf("--------------------------\n\n");
     return 0 ; 
 }
@@ -122,6 +230,8 @@ int builtin_cd(char **args) {
         }
     }
 
+    invalidate_prompt(); // the prompt shows the working directory
+
     if (prev_dir != NULL) {
         free(prev_dir);
     }
@@ -129,25 +239,51 @@ int builtin_cd(char **args) {
     if (prev_dir == NULL) {
         perror("bropesh: strdup failed for prev_dir update");
     }
-    return 1;
+    return 0;
 }
 
 void builtin_history() {
-    if (history_count == 0) {
+    load_history();
+    // repeated commands leave empty slots behind, so walk back from the newest
+    // entry collecting up to 10 commands
+    int oldest = (history_count > MAX_HISTORY_SIZE) ? history_count - MAX_HISTORY_SIZE : 0;
+    int shown[10];
+    int num_to_display = 0;
+    for (int position = history_count - 1; position >= oldest && num_to_display < 10; position--) {
+        if (history_commands[position % MAX_HISTORY_SIZE] != NULL) {
+            shown[num_to_display++] = position % MAX_HISTORY_SIZE;
+        }
+    }
+    if (num_to_display == 0) {
         printf("no commands in history.\n");
         return;
     }
 
-    // calculate the actual number of commands currently stored (max MAX_HISTORY_SIZE)
-    int actual_stored_count = (history_count < MAX_HISTORY_SIZE) ? history_count : MAX_HISTORY_SIZE;
-
-    int num_to_display = (actual_stored_count < 10) ? actual_stored_count : 10;
-    int start_index_in_buffer = (history_count - num_to_display + MAX_HISTORY_SIZE) % MAX_HISTORY_SIZE;
-
     for (int i = 0; i < num_to_display; i++) {
-        int current_idx = (start_index_in_buffer + i) % MAX_HISTORY_SIZE;
-        if (history_commands[current_idx] != NULL) { // not doing a NULL check can cost lives :)
-            printf(" %d  %s\n", i + 1, history_commands[current_idx]);
+        printf(" %d  %s\n", i + 1, history_commands[shown[num_to_display - 1 - i]]);
+    }
+}
+
+// hash: no arguments lists the cache, -r empties it, names are looked up and remembered
+int builtin_hash(char **args) {
+    int status = 0;
+    if (args[1] == NULL) {
+        print_path_cache();
+        return 0;
+    }
+    if (strcmp(args[1], "-r") == 0) {
+        if (args[2] != NULL) {
+            fprintf(stderr, "bropesh: hash: too many arguments\n");
+            return 1;
+        }
+        reset_path_cache();
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        if (resolve_command_path(args[i]) == NULL) {
+            fprintf(stderr, "bropesh: hash: %s: not found\n", args[i]);
+            status = 1;
         }
     }
+    return status;
 }
@@ -0,0 +1,419 @@
+// commands.c
+// the table every command name is looked up in: builtins, aliases and functions
+// one open-addressing hash table (fnv-1a, linear probing) has an entry per name
+// holding whatever that name is bound to, so running a command costs a single
+// lookup whether it ends up in a builtin, a function or a program from PATH,
+// however many builtins, aliases and functions there are. builtins are
+// inserted once at startup from the list in builtins.c. aliases replace the
+// first word of each command in the line text before it is parsed (and a
+// line without any alias defined is not even scanned); functions keep their
+// body as text, which is parsed through the parse cache when they run.
+
+#include "shell.h"
+
+#define COMMANDS_INITIAL_SIZE 64
+// aliases expanding to aliases stop after this many steps
+#define MAX_ALIAS_DEPTH 16
+// nested function calls allowed before giving up, well before the stack runs out
+#define MAX_FUNCTION_DEPTH 256
+
+struct command_entry {
+    char *name;             // NULL for an unused slot
+    size_t name_len;
+    size_t hash;
+    int is_builtin;         // in the builtins list (run is NULL for keywords)
+    builtin_function run;
+    char *alias;            // replacement text, NULL if none
+    char *function;         // function body, NULL if none
+};
+
+static struct command_entry *table = NULL;
+static size_t table_size = 0;
+static size_t num_entries = 0;
+static size_t num_aliases = 0;
+static int function_depth = 0;
+
+// bumped whenever an alias changes, parsed lines from before are stale
+unsigned long alias_generation = 0;
+
+// fnv-1a hash of a command name
+static size_t hash_name(const char *name, size_t len) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// returns the slot holding name, or the empty slot where it belongs
+static struct command_entry *find_slot(const char *name, size_t len, size_t hash) {
+    size_t mask = table_size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct command_entry *entry = &table[i];
+        if (entry->name == NULL) return entry;
+        if (entry->hash == hash && entry->name_len == len && memcmp(entry->name, name, len) == 0) return entry;
+    }
+}
+
+static struct command_entry *lookup(const char *name, size_t len) {
+    if (table == NULL) return NULL;
+    struct command_entry *entry = find_slot(name, len, hash_name(name, len));
+    return (entry->name != NULL) ? entry : NULL;
+}
+
+// doubles the table, returns 0 or -1 after printing an error
+static int grow_table() {
+    size_t new_size = table_size ? table_size * 2 : COMMANDS_INITIAL_SIZE;
+    struct command_entry *new_table = calloc(new_size, sizeof(struct command_entry));
+    if (new_table == NULL) {
+        perror("bropesh: malloc failed for the command table");
+        return -1;
+    }
+    struct command_entry *old_table = table;
+    size_t old_size = table_size;
+    table = new_table;
+    table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        struct command_entry *old = &old_table[i];
+        if (old->name != NULL) *find_slot(old->name, old->name_len, old->hash) = *old;
+    }
+    free(old_table);
+    return 0;
+}
+
+// returns the entry for name, adding an empty one if there is none; NULL after printing an error
+static struct command_entry *add_entry(const char *name, size_t len) {
+    if (table == NULL || 10 * (num_entries + 1) > 7 * table_size) {
+        if (grow_table() == -1) return NULL;
+    }
+    size_t hash = hash_name(name, len);
+    struct command_entry *entry = find_slot(name, len, hash);
+    if (entry->name != NULL) return entry;
+
+    entry->name = strndup(name, len);
+    if (entry->name == NULL) {
+        perror("bropesh: malloc failed for the command table");
+        return NULL;
+    }
+    entry->name_len = len;
+    entry->hash = hash;
+    num_entries++;
+    return entry;
+}
+
+// removes the entry once nothing is bound to its name any more
+static void drop_if_unused(struct command_entry *entry) {
+    if (entry->is_builtin || entry->alias != NULL || entry->function != NULL) return;
+    free(entry->name);
+    entry->name = NULL;
+    num_entries--;
+
+    // backward shift deletion, like the variable table
+    size_t mask = table_size - 1;
+    size_t hole = entry - table;
+    for (size_t i = (hole + 1) & mask; table[i].name != NULL; i = (i + 1) & mask) {
+        size_t home = table[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table[hole] = table[i];
+            table[i].name = NULL;
+            hole = i;
+        }
+    }
+}
+
+void init_commands() {
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        struct command_entry *entry = add_entry(builtins[i].name, strlen(builtins[i].name));
+        if (entry == NULL) return;
+        entry->is_builtin = 1;
+        entry->run = builtins[i].run;
+    }
+}
+
+struct command_entry *find_command(const char *name) {
+    struct command_entry *entry = lookup(name, strlen(name));
+    return (entry != NULL && (entry->is_builtin || entry->function != NULL)) ? entry : NULL;
+}
+
+// runs a function body with args as its positional parameters
+static int run_function(const char *body, char **args) {
+    if (function_depth >= MAX_FUNCTION_DEPTH) {
+        fprintf(stderr, "bropesh: %s: maximum function nesting level exceeded (%d)\n", args[0], MAX_FUNCTION_DEPTH);
+        return EXIT_FAILURE;
+    }
+    // the parse is done before the body runs, so it may redefine its own function
+    struct ast_node *root = parse_command_line(body);
+    if (root == NULL) return EXIT_FAILURE;
+    char **saved = set_positional_args(args);
+    function_depth++;
+    int status = execute_ast(root);
+    function_depth--;
+    set_positional_args(saved);
+    release_command_line(root);
+    return status;
+}
+
+int run_command_entry(struct command_entry *entry, char **args) {
+    // a function shadows the builtin of the same name
+    if (entry->function != NULL) return run_function(entry->function, args);
+    return entry->run(args);
+}
+
+int is_builtin_command(const char *name) {
+    return find_command(name) != NULL;
+}
+
+int execute_builtin_command(char **args) {
+    struct command_entry *entry = find_command(args[0]);
+    // keywords like time are handled before a command is looked up
+    if (entry == NULL || (entry->function == NULL && entry->run == NULL)) return 0;
+    last_exit_status = run_command_entry(entry, args);
+    return 1;
+}
+
+const char *next_command_name(size_t *position) {
+    for (; *position < table_size; (*position)++) {
+        struct command_entry *entry = &table[*position];
+        if (entry->name != NULL) {
+            (*position)++;
+            return entry->name;
+        }
+    }
+    return NULL;
+}
+
+int define_function(const char *name, const char *body) {
+    struct command_entry *entry = add_entry(name, strlen(name));
+    if (entry == NULL) return EXIT_FAILURE;
+    char *copy = strdup(body);
+    if (copy == NULL) {
+        perror("bropesh: malloc failed for function");
+        drop_if_unused(entry);
+        return EXIT_FAILURE;
+    }
+    free(entry->function);
+    entry->function = copy;
+    return 0;
+}
+
+int undefine_function(const char *name) {
+    struct command_entry *entry = lookup(name, strlen(name));
+    if (entry == NULL || entry->function == NULL) return -1;
+    free(entry->function);
+    entry->function = NULL;
+    drop_if_unused(entry);
+    return 0;
+}
+
+// characters that end a word in the command line text
+static int ends_word(char c) {
+    return c == '\0' || c == '\n' || isspace((unsigned char)c) || strchr("|<>&;\"", c) != NULL;
+}
+
+static int is_valid_alias_name(const char *name, size_t len) {
+    if (len == 0) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (ends_word(name[i]) || strchr("$=/(){}", name[i]) != NULL) return 0;
+    }
+    return 1;
+}
+
+// the line with aliases replaced, grown with malloc as aliases are added
+struct alias_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static int append_text(struct alias_buffer *buffer, const char *text, size_t len) {
+    if (buffer->len + len + 1 > buffer->capacity) {
+        size_t capacity = 2 * (buffer->len + len + 1);
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            perror("bropesh: malloc failed for alias expansion");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->len, text, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+    return 0;
+}
+
+// appends the command word at start (len bytes), replaced if it is an alias;
+// the first word of the replacement is looked up again unless it is an alias
+// already being replaced (chain), which keeps alias ls="ls -F" from looping
+static int append_command_word(struct alias_buffer *buffer, const char *start, size_t len,
+                               struct command_entry **chain, int depth) {
+    struct command_entry *entry = lookup(start, len);
+    int in_chain = 0;
+    for (int i = 0; i < depth; i++) {
+        if (chain[i] == entry) in_chain = 1;
+    }
+    if (entry == NULL || entry->alias == NULL || in_chain || depth == MAX_ALIAS_DEPTH) {
+        return append_text(buffer, start, len);
+    }
+
+    chain[depth] = entry;
+    const char *value = entry->alias;
+    const char *word = value;
+    while (*word != '\0' && isspace((unsigned char)*word)) word++;
+    const char *word_end = word;
+    while (!ends_word(*word_end)) word_end++;
+    if (append_text(buffer, value, word - value) == -1 ||
+        append_command_word(buffer, word, word_end - word, chain, depth + 1) == -1) {
+        return -1;
+    }
+    return append_text(buffer, word_end, strlen(word_end));
+}
+
+const char *expand_aliases(const char *line, struct arena *arena) {
+    if (num_aliases == 0) return arena_strndup(arena, line, strlen(line));
+
+    struct alias_buffer buffer = {NULL, 0, 0};
+    struct command_entry *chain[MAX_ALIAS_DEPTH];
+    int command_start = 1; // the next word is in command position
+    int in_quote = 0;
+    const char *p = line;
+    // here-document bodies after the first newline are copied as they are
+    while (*p != '\0' && *p != '\n') {
+        const char *next = p + 1;
+        if (in_quote) {
+            if (*p == '"') in_quote = 0;
+        } else if (p[0] == '$' && p[1] == '(') {
+            // substituted commands get their aliases when they run
+            next = substitution_end(p);
+            if (next == NULL) next = p + strlen(p);
+        } else if (*p == '"') {
+            in_quote = 1;
+            command_start = 0;
+        } else if (strchr("|&;", *p) != NULL) {
+            command_start = 1;
+        } else if (command_start && !isspace((unsigned char)*p)) {
+            command_start = 0;
+            while (!ends_word(*next) && *next != '$') next++;
+            // a quoted or expanded first word is taken literally
+            if ((*next == '"' || *next == '$') && next > p) {
+                if (append_text(&buffer, p, next - p) == -1) break;
+                p = next;
+                continue;
+            }
+            if (append_command_word(&buffer, p, next - p, chain, 0) == -1) break;
+            p = next;
+            continue;
+        }
+        if (append_text(&buffer, p, next - p) == -1) break;
+        p = next;
+    }
+    if (*p != '\0' && (*p != '\n' || append_text(&buffer, p, strlen(p)) == -1)) {
+        // stopped early by a failed allocation
+        free(buffer.data);
+        return NULL;
+    }
+    const char *text = arena_strndup(arena, (buffer.data != NULL) ? buffer.data : "", buffer.len);
+    free(buffer.data);
+    return text;
+}
+
+int set_alias(const char *name, size_t len, const char *value) {
+    if (!is_valid_alias_name(name, len)) {
+        fprintf(stderr, "bropesh: alias: '%.*s': invalid alias name\n", (int)len, name);
+        return -1;
+    }
+    struct command_entry *entry = add_entry(name, len);
+    if (entry == NULL) return -1;
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        perror("bropesh: alias: malloc failed");
+        drop_if_unused(entry);
+        return -1;
+    }
+    if (entry->alias == NULL) num_aliases++;
+    free(entry->alias);
+    entry->alias = copy;
+    alias_generation++;
+    return 0;
+}
+
+static void print_alias(struct command_entry *entry) {
+    printf("alias %s=\"%s\"\n", entry->name, entry->alias);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp((*(struct command_entry *const *)a)->name, (*(struct command_entry *const *)b)->name);
+}
+
+int builtin_alias(char **args) {
+    int status = 0;
+    if (args[1] == NULL) {
+        // sorted, like bash, so the list is easy to scan
+        struct command_entry **sorted = malloc((num_aliases + 1) * sizeof(struct command_entry *));
+        if (sorted == NULL) {
+            perror("bropesh: alias: malloc failed");
+            return 1;
+        }
+        size_t count = 0;
+        for (size_t i = 0; i < table_size; i++) {
+            if (table[i].name != NULL && table[i].alias != NULL) sorted[count++] = &table[i];
+        }
+        qsort(sorted, count, sizeof(struct command_entry *), compare_names);
+        for (size_t i = 0; i < count; i++) print_alias(sorted[i]);
+        free(sorted);
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        size_t name_len = strcspn(args[i], "=");
+        if (args[i][name_len] != '=') {
+            // alias name: show it
+            struct command_entry *entry = lookup(args[i], name_len);
+            if (entry != NULL && entry->alias != NULL) {
+                print_alias(entry);
+            } else {
+                fprintf(stderr, "bropesh: alias: %s: not found\n", args[i]);
+                status = 1;
+            }
+            continue;
+        }
+        if (set_alias(args[i], name_len, args[i] + name_len + 1) == -1) status = 1;
+    }
+    return status;
+}
+
+int builtin_unalias(char **args) {
+    int status = 0;
+    if (args[1] == NULL) {
+        fprintf(stderr, "bropesh: unalias: usage: unalias [-a] name ...\n");
+        return 2;
+    }
+    if (strcmp(args[1], "-a") == 0) {
+        for (size_t i = 0; i < table_size;) {
+            if (table[i].name != NULL && table[i].alias != NULL) {
+                free(table[i].alias);
+                table[i].alias = NULL;
+                drop_if_unused(&table[i]);
+                continue; // an entry further on may have moved into this slot
+            }
+            i++;
+        }
+        num_aliases = 0;
+        alias_generation++;
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        struct command_entry *entry = lookup(args[i], strlen(args[i]));
+        if (entry == NULL || entry->alias == NULL) {
+            fprintf(stderr, "bropesh: unalias: %s: not found\n", args[i]);
+            status = 1;
+            continue;
+        }
+        free(entry->alias);
+        entry->alias = NULL;
+        num_aliases--;
+        alias_generation++;
+        drop_if_unused(entry);
+    }
+    return status;
+}
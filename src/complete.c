@@ -0,0 +1,345 @@
+// complete.c
+// candidates for tab completion: builtins and PATH executables for the first
+// word of a command, files and directories everywhere else
+// directory listings are cached, sorted, and found again by device and inode,
+// so "src", "./src" and a symlink to it share one listing and a prefix is a
+// binary search instead of a directory scan. every cached directory is watched
+// with inotify; the events are drained (without blocking) when completion is
+// asked for and only mark the listings they touch as stale, so nothing is
+// rescanned until it changed, however large or slow the directory is. if a
+// watch cannot be added (inotify limits, some network file systems) the
+// directory's mtime is compared instead.
+
+#include "shell.h"
+#include <dirent.h>      // for fdopendir and readdir
+#include <sys/inotify.h> // for inotify_init1 and inotify_add_watch
+#include <sys/stat.h>    // for stat and fstatat
+
+// directories whose listings are kept, the least recently used one is dropped
+#define COMPLETION_CACHE_SIZE 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// changes that make a cached listing stale
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct dir_entry {
+    size_t name; // offset of the name in the listing's names
+    unsigned char type; // d_type, only used while scanning
+    unsigned char is_dir;
+    unsigned char is_exec;
+};
+
+struct dir_listing {
+    dev_t dev;               // identity of the directory, 0/0 for an unused slot
+    ino_t ino;
+    int wd;                  // inotify watch, -1 if the directory is not watched
+    struct timespec mtime;   // compared instead when there is no watch
+    int stale;               // set by inotify events
+    int has_exec;            // is_exec was filled in (only done for PATH directories)
+    unsigned long last_used;
+    char *names;             // every name, NUL-separated
+    struct dir_entry *entries; // sorted by name
+    size_t count;
+};
+
+static struct dir_listing listings[COMPLETION_CACHE_SIZE];
+static unsigned long use_counter = 0;
+static int inotify_fd = -1;
+
+static void free_listing(struct dir_listing *listing) {
+    if (listing->wd != -1 && inotify_fd != -1) inotify_rm_watch(inotify_fd, listing->wd);
+    free(listing->names);
+    free(listing->entries);
+    memset(listing, 0, sizeof(*listing));
+    listing->wd = -1;
+}
+
+// marks the listings touched by pending inotify events as stale
+static void drain_events() {
+    if (inotify_fd == -1) return;
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + n;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            for (int i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+                if (listings[i].names == NULL) continue;
+                // after an overflow nobody knows what changed
+                if (listings[i].wd != event->wd && !(event->mask & IN_Q_OVERFLOW)) continue;
+                listings[i].stale = 1;
+                // the kernel dropped the watch (directory deleted), do not remove it again
+                if (event->mask & IN_IGNORED) listings[i].wd = -1;
+            }
+        }
+    }
+}
+
+// names of the listing being sorted, qsort has no context argument
+static const char *sort_names;
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(sort_names + ((const struct dir_entry *)a)->name, sort_names + ((const struct dir_entry *)b)->name);
+}
+
+static const char *entry_name(struct dir_listing *listing, size_t index) {
+    return listing->names + listing->entries[index].name;
+}
+
+// reads the directory at path into listing, watching it first so a change
+// made during the scan still makes the listing stale
+// returns 0, or -1 if the directory cannot be read
+static int scan_listing(struct dir_listing *listing, const char *path, int want_exec) {
+    if (inotify_fd == -1) inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (listing->wd == -1 && inotify_fd != -1) {
+        listing->wd = inotify_add_watch(inotify_fd, path, WATCH_EVENTS | IN_ONLYDIR);
+    }
+    listing->stale = 0;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd != -1) ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    size_t names_len = 0, names_capacity = 4096;
+    size_t count = 0, entries_capacity = 256;
+    char *names = malloc(names_capacity);
+    struct dir_entry *entries = malloc(entries_capacity * sizeof(struct dir_entry));
+    int failed = (names == NULL || entries == NULL);
+
+    struct dirent *entry;
+    while (!failed && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        size_t len = strlen(name) + 1;
+        if (names_len + len > names_capacity) {
+            while (names_len + len > names_capacity) names_capacity *= 2;
+            char *new_names = realloc(names, names_capacity);
+            if ((failed = (new_names == NULL))) break;
+            names = new_names;
+        }
+        if (count == entries_capacity) {
+            entries_capacity *= 2;
+            struct dir_entry *new_entries = realloc(entries, entries_capacity * sizeof(struct dir_entry));
+            if ((failed = (new_entries == NULL))) break;
+            entries = new_entries;
+        }
+        memcpy(names + names_len, name, len);
+        entries[count].name = names_len;
+        entries[count].type = entry->d_type;
+        names_len += len;
+        count++;
+    }
+
+    for (size_t i = 0; !failed && i < count; i++) {
+        struct dir_entry *e = &entries[i];
+        const char *name = names + e->name;
+        struct stat st;
+        if (e->type == DT_LNK || e->type == DT_UNKNOWN) {
+            // one stat only for entries whose type the directory does not tell
+            e->is_dir = (fstatat(dirfd(dir), name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+        } else {
+            e->is_dir = (e->type == DT_DIR);
+        }
+        e->is_exec = (want_exec && !e->is_dir && faccessat(dirfd(dir), name, X_OK, 0) == 0);
+    }
+    closedir(dir);
+
+    if (failed) {
+        perror("bropesh: malloc failed for completion cache");
+        free(names);
+        free(entries);
+        return -1;
+    }
+    sort_names = names;
+    qsort(entries, count, sizeof(struct dir_entry), compare_entries);
+    free(listing->names);
+    free(listing->entries);
+    listing->names = names;
+    listing->entries = entries;
+    listing->count = count;
+    listing->has_exec = want_exec;
+    return 0;
+}
+
+// returns the up to date listing of the directory at path, or NULL
+static struct dir_listing *get_listing(const char *path, int want_exec) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+    drain_events();
+
+    struct dir_listing *listing = NULL, *oldest = &listings[0];
+    for (int i = 0; i < COMPLETION_CACHE_SIZE && listing == NULL; i++) {
+        if (listings[i].names != NULL && listings[i].dev == st.st_dev && listings[i].ino == st.st_ino) {
+            listing = &listings[i];
+        } else if (listings[i].names == NULL || (oldest->names != NULL && listings[i].last_used < oldest->last_used)) {
+            oldest = &listings[i];
+        }
+    }
+
+    int rescan = 0;
+    if (listing == NULL) {
+        if (oldest->names != NULL) free_listing(oldest);
+        listing = oldest;
+        listing->wd = -1;
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        rescan = 1;
+    } else if (listing->stale || (want_exec && !listing->has_exec)) {
+        rescan = 1;
+    } else if (listing->wd == -1) {
+        rescan = (st.st_mtim.tv_sec != listing->mtime.tv_sec || st.st_mtim.tv_nsec != listing->mtime.tv_nsec);
+    }
+
+    if (rescan) {
+        listing->mtime = st.st_mtim;
+        if (scan_listing(listing, path, want_exec) == -1) {
+            free_listing(listing);
+            return NULL;
+        }
+    }
+    listing->last_used = ++use_counter;
+    return listing;
+}
+
+// index of the first entry not sorting before prefix
+static size_t lower_bound(struct dir_listing *listing, const char *prefix) {
+    size_t low = 0, high = listing->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(entry_name(listing, mid), prefix) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static int add_match(struct completion *result, size_t *capacity, const char *dir, const char *name, int is_dir) {
+    if ((size_t)result->count == *capacity) {
+        size_t new_capacity = (*capacity == 0) ? 64 : *capacity * 2;
+        char **new_matches = realloc(result->matches, new_capacity * sizeof(char *));
+        if (new_matches == NULL) {
+            perror("bropesh: realloc failed for completions");
+            return -1;
+        }
+        result->matches = new_matches;
+        *capacity = new_capacity;
+    }
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    char *match = malloc(dir_len + name_len + 2);
+    if (match == NULL) {
+        perror("bropesh: malloc failed for completion");
+        return -1;
+    }
+    memcpy(match, dir, dir_len);
+    memcpy(match + dir_len, name, name_len);
+    if (is_dir) match[dir_len + name_len++] = '/';
+    match[dir_len + name_len] = '\0';
+    result->matches[result->count++] = match;
+    return 0;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// builtins, aliases, functions and executables in PATH starting with prefix
+static int complete_command(const char *prefix, struct completion *result, size_t *capacity) {
+    size_t prefix_len = strlen(prefix);
+    const char *name;
+    for (size_t position = 0; (name = next_command_name(&position)) != NULL;) {
+        if (strncmp(name, prefix, prefix_len) == 0 && add_match(result, capacity, "", name, 0) == -1) return -1;
+    }
+
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) path_env = DEFAULT_PATH;
+    char dir[PATH_MAX];
+    for (const char *start = path_env;;) {
+        const char *end = strchr(start, ':');
+        size_t len = (end != NULL) ? (size_t)(end - start) : strlen(start);
+        // an empty PATH element means the current directory
+        if (len == 0) snprintf(dir, sizeof(dir), ".");
+        else snprintf(dir, sizeof(dir), "%.*s", (int)len, start);
+
+        struct dir_listing *listing = get_listing(dir, 1);
+        for (size_t j = (listing != NULL) ? lower_bound(listing, prefix) : 0; listing != NULL && j < listing->count; j++) {
+            const char *name = entry_name(listing, j);
+            if (strncmp(name, prefix, prefix_len) != 0) break;
+            if (listing->entries[j].is_exec && add_match(result, capacity, "", name, 0) == -1) return -1;
+        }
+        if (end == NULL) break;
+        start = end + 1;
+    }
+    return 0;
+}
+
+// files and directories starting with word, which may contain a directory part
+static int complete_path(const char *word, struct completion *result, size_t *capacity) {
+    const char *slash = strrchr(word, '/');
+    const char *prefix = (slash != NULL) ? slash + 1 : word;
+    size_t dir_len = (slash != NULL) ? (size_t)(slash - word) + 1 : 0;
+    char shown_dir[PATH_MAX], dir[PATH_MAX];
+    if (dir_len >= sizeof(shown_dir)) return 0;
+    memcpy(shown_dir, word, dir_len);
+    shown_dir[dir_len] = '\0';
+
+    if (dir_len == 0) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (word[0] == '~' && word[1] == '/' && home_dir != NULL) {
+        snprintf(dir, sizeof(dir), "%s%s", home_dir, shown_dir + 1);
+    } else {
+        snprintf(dir, sizeof(dir), "%s", shown_dir);
+    }
+
+    struct dir_listing *listing = get_listing(dir, 0);
+    if (listing == NULL) return 0;
+    size_t prefix_len = strlen(prefix);
+    for (size_t j = lower_bound(listing, prefix); j < listing->count; j++) {
+        const char *name = entry_name(listing, j);
+        if (strncmp(name, prefix, prefix_len) != 0) break;
+        // hidden files only when asked for
+        if (name[0] == '.' && prefix[0] != '.') continue;
+        if (add_match(result, capacity, shown_dir, name, listing->entries[j].is_dir) == -1) return -1;
+    }
+    return 0;
+}
+
+int complete_word(const char *word, int is_command, struct completion *result) {
+    size_t capacity = 0;
+    result->matches = NULL;
+    result->count = 0;
+
+    int status;
+    if (strcmp(word, "~") == 0) {
+        status = add_match(result, &capacity, "", "~", 1);
+    } else if (is_command && strchr(word, '/') == NULL) {
+        status = complete_command(word, result, &capacity);
+    } else {
+        status = complete_path(word, result, &capacity);
+    }
+    if (status == -1) {
+        free_completion(result);
+        return -1;
+    }
+
+    // a command found in several PATH directories is listed once
+    if (result->count > 1) qsort(result->matches, result->count, sizeof(char *), compare_matches);
+    int unique = 0;
+    for (int i = 0; i < result->count; i++) {
+        if (unique > 0 && strcmp(result->matches[unique - 1], result->matches[i]) == 0) {
+            free(result->matches[i]);
+        } else {
+            result->matches[unique++] = result->matches[i];
+        }
+    }
+    result->count = unique;
+    return unique;
+}
+
+void free_completion(struct completion *result) {
+    for (int i = 0; i < result->count; i++) free(result->matches[i]);
+    free(result->matches);
+    result->matches = NULL;
+    result->count = 0;
+}
@@ -0,0 +1,625 @@
+// coreutils.c
+// in-process versions of the small utilities scripts call the most:
+// cat, wc, head, tail, true, false and test/[
+// they are enabled with --builtin-utils and save a whole spawn+exec+wait per
+// call; redirections are applied to the shell's fds like for any builtin. cat
+// and tail move data with copy_fd_to_fd (utils.c): copy_file_range between
+// files, splice through pipes and sendfile otherwise, with read and write only
+// for outputs the kernel refuses. wc -l counts newlines eight bytes at a time,
+// and tail reads regular files backwards from the end instead of reading all
+// of them. anything the builtins do not implement (unknown options, head -n
+// -N, tail -f, input from a terminal that ctrl+c could not interrupt) runs
+// the real program from PATH instead, so behaviour never silently changes.
+
+#include "shell.h"
+#include <sys/stat.h> // for fstat and the file tests
+
+#define UTIL_BUFFER_SIZE (128 * 1024)
+// returned by a utility that leaves the command to the real program
+#define UTIL_NOT_HANDLED -1
+
+int builtin_utils_enabled = 0;
+
+static const char *util_names[] = {"cat", "wc", "head", "tail", "true", "false", "test", "[", NULL};
+
+static int write_all(int fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buffer, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static ssize_t read_some(int fd, char *buffer, size_t len) {
+    ssize_t n;
+    while ((n = read(fd, buffer, len)) == -1 && errno == EINTR) {
+    }
+    return n;
+}
+
+static void util_error(const char *util, const char *name) {
+    fprintf(stderr, "bropesh: %s: %s: %s\n", util, name, strerror(errno));
+}
+
+// parses a count for -n/-c, returns -1 if it is not a plain non-negative number
+static long parse_count(const char *text) {
+    char *end;
+    if (!isdigit((unsigned char)text[0])) return -1;
+    long value = strtol(text, &end, 10);
+    return (*end == '\0') ? value : -1;
+}
+
+// opens a file operand ("-" is the input fd), returns the fd or -1 after an error
+static int open_operand(const char *util, const char *name, int in_fd) {
+    if (strcmp(name, "-") == 0) return in_fd;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) util_error(util, name);
+    return fd;
+}
+
+static void close_operand(int fd, int in_fd) {
+    if (fd != in_fd) close(fd);
+}
+
+// counts '\n' bytes eight at a time: a byte of x is zero exactly where the
+// input had a newline, and the high bit of each zero byte is found without
+// carries crossing into the neighbouring bytes
+static size_t count_newlines(const char *data, size_t len) {
+    const unsigned long long ones = 0x0101010101010101ULL, low7 = 0x7f7f7f7f7f7f7f7fULL;
+    size_t count = 0, i = 0;
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        unsigned long long x = word ^ (ones * '\n');
+        unsigned long long t = ((x & low7) + low7) | x;
+        count += __builtin_popcountll(~t & ~low7);
+    }
+    for (; i < len; i++) count += (data[i] == '\n');
+    return count;
+}
+
+// cat [file...]
+static int util_cat(char **args, int in_fd, int out_fd) {
+    int status = 0;
+    if (args[1] == NULL) {
+        if (copy_fd_to_fd(in_fd, out_fd, -1) == -1) {
+            util_error("cat", "-");
+            return 1;
+        }
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        int fd = open_operand("cat", args[i], in_fd);
+        if (fd == -1) {
+            status = 1;
+            continue;
+        }
+        if (copy_fd_to_fd(fd, out_fd, -1) == -1) {
+            util_error("cat", args[i]);
+            status = 1;
+        }
+        close_operand(fd, in_fd);
+    }
+    return status;
+}
+
+struct wc_counts {
+    size_t lines, words, bytes;
+};
+
+// counts one input, only what was asked for: bytes of a regular file come from fstat
+static int wc_count(int fd, int want_lines, int want_words, struct wc_counts *counts) {
+    struct stat st;
+    memset(counts, 0, sizeof(*counts));
+    if (!want_lines && !want_words && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        counts->bytes = (offset >= 0 && offset < st.st_size) ? st.st_size - offset : 0;
+        return 0;
+    }
+
+    char buffer[UTIL_BUFFER_SIZE];
+    int in_word = 0;
+    ssize_t n;
+    while ((n = read_some(fd, buffer, sizeof(buffer))) > 0) {
+        counts->bytes += n;
+        if (want_words) {
+            for (ssize_t i = 0; i < n; i++) {
+                unsigned char c = buffer[i];
+                if (c == '\n') counts->lines++;
+                if (isspace(c)) {
+                    in_word = 0;
+                } else if (!in_word) {
+                    in_word = 1;
+                    counts->words++;
+                }
+            }
+        } else if (want_lines) {
+            counts->lines += count_newlines(buffer, n);
+        }
+    }
+    return (n == 0) ? 0 : -1;
+}
+
+static void wc_print(FILE *out, struct wc_counts *counts, int want_lines, int want_words, int want_bytes, int width,
+                     const char *name) {
+    const char *separator = "";
+    if (want_lines) {
+        fprintf(out, "%*zu", width, counts->lines);
+        separator = " ";
+    }
+    if (want_words) {
+        fprintf(out, "%s%*zu", separator, width, counts->words);
+        separator = " ";
+    }
+    if (want_bytes) fprintf(out, "%s%*zu", separator, width, counts->bytes);
+    if (name != NULL) fprintf(out, " %s", name);
+    fprintf(out, "\n");
+}
+
+// parses -l, -w and -c (also combined like -lw)
+// returns the index of the first operand, or UTIL_NOT_HANDLED
+static int parse_wc(char **args, int *want_lines, int *want_words, int *want_bytes) {
+    int first = 1;
+    *want_lines = *want_words = *want_bytes = 0;
+    for (; args[first] != NULL && args[first][0] == '-' && args[first][1] != '\0'; first++) {
+        if (strcmp(args[first], "--") == 0) return first + 1;
+        for (const char *flag = args[first] + 1; *flag != '\0'; flag++) {
+            if (*flag == 'l') *want_lines = 1;
+            else if (*flag == 'w') *want_words = 1;
+            else if (*flag == 'c') *want_bytes = 1;
+            else return UTIL_NOT_HANDLED;
+        }
+    }
+    if (!*want_lines && !*want_words && !*want_bytes) *want_lines = *want_words = *want_bytes = 1;
+    return first;
+}
+
+// wc [-lwc] [file...], same columns as GNU wc
+static int util_wc(char **args, int in_fd, int out_fd) {
+    int want_lines, want_words, want_bytes;
+    int first = parse_wc(args, &want_lines, &want_words, &want_bytes);
+    int num_files = 0;
+    while (args[first + num_files] != NULL) num_files++;
+
+    // GNU wc pads every column to the digits of the total input size, at least
+    // 7 when an input is not a regular file; a single count is not padded
+    int width = 1;
+    if (want_lines + want_words + want_bytes > 1 || num_files > 1) {
+        off_t total_size = 0;
+        int unknown_size = 0;
+        for (int i = 0; i < num_files || (num_files == 0 && i == 0); i++) {
+            struct stat st;
+            const char *name = (num_files > 0) ? args[first + i] : "-";
+            int ok = (strcmp(name, "-") == 0) ? fstat(in_fd, &st) == 0 : stat(name, &st) == 0;
+            if (ok && S_ISREG(st.st_mode)) total_size += st.st_size;
+            else unknown_size = 1;
+        }
+        for (; total_size >= 10; total_size /= 10) width++;
+        if (unknown_size && width < 7) width = 7;
+    }
+
+    FILE *out = fdopen(dup(out_fd), "w");
+    if (out == NULL) {
+        util_error("wc", "output");
+        return 1;
+    }
+    struct wc_counts total = {0, 0, 0};
+    int status = 0;
+    for (int i = 0; i < num_files || (num_files == 0 && i == 0); i++) {
+        const char *name = (num_files > 0) ? args[first + i] : "-";
+        int fd = open_operand("wc", name, in_fd);
+        struct wc_counts counts;
+        if (fd == -1 || wc_count(fd, want_lines, want_words, &counts) == -1) {
+            if (fd != -1) util_error("wc", name);
+            status = 1;
+            if (fd != -1) close_operand(fd, in_fd);
+            continue;
+        }
+        close_operand(fd, in_fd);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+        wc_print(out, &counts, want_lines, want_words, want_bytes, width, (num_files > 0) ? name : NULL);
+    }
+    if (num_files > 1) wc_print(out, &total, want_lines, want_words, want_bytes, width, "total");
+    fclose(out);
+    return status;
+}
+
+// parses the options shared by head and tail: -n N, -nN, -N, -c N
+// returns the index of the first operand, or UTIL_NOT_HANDLED
+static int parse_head_tail(char **args, long *count, int *by_bytes) {
+    int first = 1;
+    *count = 10;
+    *by_bytes = 0;
+    for (; args[first] != NULL && args[first][0] == '-' && args[first][1] != '\0'; first++) {
+        const char *option = args[first];
+        const char *value;
+        if (strcmp(option, "--") == 0) {
+            return first + 1;
+        } else if (isdigit((unsigned char)option[1])) {
+            value = option + 1;
+        } else if ((option[1] == 'n' || option[1] == 'c')) {
+            *by_bytes = (option[1] == 'c');
+            value = (option[2] != '\0') ? option + 2 : args[++first];
+            if (value == NULL) return UTIL_NOT_HANDLED;
+        } else {
+            return UTIL_NOT_HANDLED;
+        }
+        // "-n -5", "-n +5" and suffixes like 1K are left to the real programs
+        if ((*count = parse_count(value)) < 0) return UTIL_NOT_HANDLED;
+    }
+    return first;
+}
+
+// writes the first count lines (or bytes) of fd, a seekable fd is left right after them
+static int head_fd(int fd, int out_fd, long count, int by_bytes) {
+    char buffer[UTIL_BUFFER_SIZE];
+    ssize_t n = 0;
+    while (count > 0 && (n = read_some(fd, buffer, sizeof(buffer))) > 0) {
+        size_t used = n;
+        if (by_bytes) {
+            if ((long)used > count) used = count;
+            count -= used;
+        } else {
+            const char *p = buffer;
+            while (count > 0 && (p = memchr(p, '\n', buffer + n - p)) != NULL) {
+                p++;
+                count--;
+            }
+            if (count == 0) used = p - buffer;
+        }
+        if (write_all(out_fd, buffer, used) == -1) return -1;
+        if ((ssize_t)used < n) lseek(fd, (off_t)used - n, SEEK_CUR); // fails harmlessly on pipes
+    }
+    return (n >= 0) ? 0 : -1;
+}
+
+// offset where the last count lines (or bytes) of the regular file fd start,
+// found by reading blocks backwards from the end
+static off_t tail_start(int fd, off_t begin, off_t size, long count, int by_bytes) {
+    if (by_bytes) return (size - begin > count) ? size - count : begin;
+
+    if (count == 0) return size;
+
+    char buffer[UTIL_BUFFER_SIZE];
+    off_t end = size;
+    long newlines = 0;
+    while (end > begin) {
+        off_t start = (end - begin > (off_t)sizeof(buffer)) ? end - (off_t)sizeof(buffer) : begin;
+        ssize_t n = pread(fd, buffer, end - start, start);
+        if (n <= 0) return begin;
+        for (ssize_t i = n - 1; i >= 0; i--) {
+            // the file's final newline ends the last line, it does not start one
+            if (buffer[i] == '\n' && start + i != size - 1 && ++newlines == count) return start + i + 1;
+        }
+        end = start;
+    }
+    return begin;
+}
+
+// start of the last count lines (or bytes) of data
+static size_t buffer_tail_start(const char *data, size_t size, long count, int by_bytes) {
+    if (by_bytes) return (size > (size_t)count) ? size - count : 0;
+    if (count == 0) return size;
+    long newlines = 0;
+    for (size_t i = size; i > 0; i--) {
+        if (data[i - 1] == '\n' && i != size && ++newlines == count) return i;
+    }
+    return 0;
+}
+
+// writes the last count lines (or bytes) of a pipe or terminal, keeping only a
+// window of the input that still contains them
+static int tail_stream(int fd, int out_fd, long count, int by_bytes) {
+    size_t capacity = UTIL_BUFFER_SIZE * 2, size = 0;
+    char *data = malloc(capacity);
+    if (data == NULL) return -1;
+
+    ssize_t n;
+    for (;;) {
+        if (capacity - size < UTIL_BUFFER_SIZE) {
+            // drop what can no longer be part of the tail before growing
+            size_t keep_from = buffer_tail_start(data, size, count, by_bytes);
+            memmove(data, data + keep_from, size - keep_from);
+            size -= keep_from;
+            if (capacity - size < UTIL_BUFFER_SIZE) {
+                char *bigger = realloc(data, capacity * 2);
+                if (bigger == NULL) {
+                    free(data);
+                    return -1;
+                }
+                data = bigger;
+                capacity *= 2;
+            }
+        }
+        n = read_some(fd, data + size, capacity - size);
+        if (n <= 0) break;
+        size += n;
+    }
+
+    size_t start = buffer_tail_start(data, size, count, by_bytes);
+    int result = (n == 0) ? write_all(out_fd, data + start, size - start) : -1;
+    free(data);
+    return result;
+}
+
+static int tail_fd(int fd, int out_fd, long count, int by_bytes) {
+    struct stat st;
+    off_t begin = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && begin >= 0) {
+        off_t offset = tail_start(fd, begin, st.st_size, count, by_bytes);
+        if (copy_fd_to_fd(fd, out_fd, offset) == -1) return -1;
+        lseek(fd, 0, SEEK_END);
+        return 0;
+    }
+    return tail_stream(fd, out_fd, count, by_bytes);
+}
+
+// head/tail [-n N | -c N | -N] [file...], with "==> name <==" headers for several files
+static int util_head_tail(char **args, int in_fd, int out_fd) {
+    int is_tail = (strcmp(args[0], "tail") == 0);
+    long count;
+    int by_bytes;
+    int first = parse_head_tail(args, &count, &by_bytes);
+
+    int num_files = 0;
+    while (args[first + num_files] != NULL) num_files++;
+
+    int status = 0;
+    for (int i = 0; i < num_files || (num_files == 0 && i == 0); i++) {
+        const char *name = (num_files > 0) ? args[first + i] : "-";
+        int fd = open_operand(args[0], name, in_fd);
+        if (fd == -1) {
+            status = 1;
+            continue;
+        }
+        if (num_files > 1) {
+            char header[PATH_MAX + 16];
+            int len = snprintf(header, sizeof(header), "%s==> %s <==\n", (i > 0) ? "\n" : "",
+                               (strcmp(name, "-") == 0) ? "standard input" : name);
+            write_all(out_fd, header, len);
+        }
+        int result = is_tail ? tail_fd(fd, out_fd, count, by_bytes) : head_fd(fd, out_fd, count, by_bytes);
+        if (result == -1) {
+            util_error(args[0], name);
+            status = 1;
+        }
+        close_operand(fd, in_fd);
+    }
+    return status;
+}
+
+// test/[ expression parser, one function per precedence level
+struct test_parser {
+    char **args;
+    int pos;
+    int end;
+    int error;
+};
+
+static int is_unary_test(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghLnprsSwxz", op[1]) != NULL;
+}
+
+static int is_binary_test(const char *op) {
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (strcmp(op, ops[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int unary_test(struct test_parser *p, char op, const char *arg) {
+    struct stat st;
+    if (op == 'n') return arg[0] != '\0';
+    if (op == 'z') return arg[0] == '\0';
+    if (op == 'L' || op == 'h') return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    if (op == 'r') return access(arg, R_OK) == 0;
+    if (op == 'w') return access(arg, W_OK) == 0;
+    if (op == 'x') return access(arg, X_OK) == 0;
+    if (stat(arg, &st) == -1) return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+    p->error = 1;
+    return 0;
+}
+
+// parses an integer operand of -eq and friends
+static long long test_integer(struct test_parser *p, const char *text) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (end == text || *end != '\0' || errno != 0) {
+        fprintf(stderr, "bropesh: test: %s: integer expression expected\n", text);
+        p->error = 2; // already reported
+    }
+    return value;
+}
+
+static int binary_test(struct test_parser *p, const char *left, const char *op, const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(left, right) > 0;
+    if (op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+        struct stat a, b;
+        int has_a = (stat(left, &a) == 0), has_b = (stat(right, &b) == 0);
+        if (strcmp(op, "-ef") == 0) return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+        if (strcmp(op, "-nt") == 0) return has_a && (!has_b || a.st_mtime > b.st_mtime);
+        return has_b && (!has_a || a.st_mtime < b.st_mtime);
+    }
+    long long a = test_integer(p, left), b = test_integer(p, right);
+    if (strcmp(op, "-eq") == 0) return a == b;
+    if (strcmp(op, "-ne") == 0) return a != b;
+    if (strcmp(op, "-lt") == 0) return a < b;
+    if (strcmp(op, "-le") == 0) return a <= b;
+    if (strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+static int test_or(struct test_parser *p);
+
+static int test_primary(struct test_parser *p) {
+    if (p->pos >= p->end) {
+        p->error = 1;
+        return 0;
+    }
+    char **a = p->args;
+    int left = p->end - p->pos;
+    // "x op y" wins over everything else, so "-n = -n" compares strings
+    if (left >= 3 && is_binary_test(a[p->pos + 1])) {
+        int result = binary_test(p, a[p->pos], a[p->pos + 1], a[p->pos + 2]);
+        p->pos += 3;
+        return result;
+    }
+    if (strcmp(a[p->pos], "!") == 0 && left >= 2) {
+        p->pos++;
+        return !test_primary(p);
+    }
+    if (strcmp(a[p->pos], "(") == 0 && left >= 2) {
+        p->pos++;
+        int result = test_or(p);
+        if (p->pos >= p->end || strcmp(a[p->pos], ")") != 0) {
+            p->error = 1;
+            return 0;
+        }
+        p->pos++;
+        return result;
+    }
+    if (left >= 2 && is_unary_test(a[p->pos])) {
+        int result = unary_test(p, a[p->pos][1], a[p->pos + 1]);
+        p->pos += 2;
+        return result;
+    }
+    // a lone word is true when it is not empty
+    return a[p->pos++][0] != '\0';
+}
+
+static int test_and(struct test_parser *p) {
+    int result = test_primary(p);
+    while (p->pos < p->end && strcmp(p->args[p->pos], "-a") == 0) {
+        p->pos++;
+        result = test_primary(p) && result;
+    }
+    return result;
+}
+
+static int test_or(struct test_parser *p) {
+    int result = test_and(p);
+    while (p->pos < p->end && strcmp(p->args[p->pos], "-o") == 0) {
+        p->pos++;
+        result = test_and(p) || result;
+    }
+    return result;
+}
+
+// test expr / [ expr ]: 0 if true, 1 if false, 2 on a syntax error
+static int util_test(char **args) {
+    int end = 0;
+    while (args[end] != NULL) end++;
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[end - 1], "]") != 0) {
+            fprintf(stderr, "bropesh: [: missing ]\n");
+            return 2;
+        }
+        end--;
+    }
+    if (end == 1) return 1; // no expression is false
+
+    struct test_parser parser = {args, 1, end, 0};
+    int result = test_or(&parser);
+    if (parser.error || parser.pos != parser.end) {
+        if (parser.error == 2) {
+            // reported where it was found
+        } else if (!parser.error || parser.pos >= parser.end) {
+            fprintf(stderr, "bropesh: %s: syntax error\n", args[0]);
+        } else {
+            fprintf(stderr, "bropesh: %s: %s: unexpected argument\n", args[0], args[parser.pos]);
+        }
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+// index of the first file operand of cat, wc, head or tail, 0 for the
+// others, UTIL_NOT_HANDLED if an option is not implemented here
+static int first_operand(char **args) {
+    const char *name = args[0];
+    if (strcmp(name, "cat") == 0) {
+        for (int i = 1; args[i] != NULL; i++) {
+            if (args[i][0] == '-' && args[i][1] != '\0') return UTIL_NOT_HANDLED;
+        }
+        return 1;
+    }
+    if (strcmp(name, "wc") == 0) {
+        int lines, words, bytes;
+        return parse_wc(args, &lines, &words, &bytes);
+    }
+    if (strcmp(name, "head") == 0 || strcmp(name, "tail") == 0) {
+        long count;
+        int by_bytes;
+        return parse_head_tail(args, &count, &by_bytes);
+    }
+    return 0;
+}
+
+// returns 1 if args can run as an in-process utility (enabled, and only
+// options the builtin implements)
+int is_builtin_util(char **args) {
+    if (!builtin_utils_enabled) return 0;
+    for (int i = 0; util_names[i] != NULL; i++) {
+        if (strcmp(args[0], util_names[i]) == 0) return first_operand(args) != UTIL_NOT_HANDLED;
+    }
+    return 0;
+}
+
+// true when the utility reads its standard input: no file operands, or "-"
+static int reads_stdin(char **args) {
+    int first = first_operand(args);
+    if (first <= 0) return 0;
+    if (args[first] == NULL) return 1;
+    for (int i = first; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-") == 0) return 1;
+    }
+    return 0;
+}
+
+// runs an in-process utility (is_builtin_util) on stdin and stdout, which
+// redirect_builtin already pointed at the '<' and '>' targets
+// returns its exit status, or UTIL_NOT_HANDLED if the real program should run instead
+int run_builtin_util(char **args) {
+    const char *name = args[0];
+    if (strcmp(name, "true") == 0) return 0;
+    if (strcmp(name, "false") == 0) return 1;
+
+    int in_fd = STDIN_FILENO, out_fd = STDOUT_FILENO;
+    if (reads_stdin(args) && isatty(in_fd)) {
+        // the real program can be interrupted with ctrl+c, a read in the shell cannot
+        return UTIL_NOT_HANDLED;
+    }
+    fflush(stdout); // earlier builtin output comes first
+
+    int status;
+    if (strcmp(name, "test") == 0 || strcmp(name, "[") == 0) status = util_test(args);
+    else if (strcmp(name, "cat") == 0) status = util_cat(args, in_fd, out_fd);
+    else if (strcmp(name, "wc") == 0) status = util_wc(args, in_fd, out_fd);
+    else status = util_head_tail(args, in_fd, out_fd);
+    return status;
+}
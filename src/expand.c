@@ -0,0 +1,283 @@
+// expand.c
+// expansions done right before a pipeline runs: command substitution $(...)
+// and the parameters $name, ${name}, $?, $$ and function arguments $1..$9, $#, $@
+// tokenize_pipeline only checks a pipeline with expansions and marks it;
+// expand_pipeline tokenizes it again when it is about to start, so it sees
+// what the commands before it on the line did and a cached ast expands anew
+// every time. variables are one hash lookup each (variables.c). a substituted
+// command runs in a forked copy of the shell writing into a pipe, and its
+// output is read with large reads into a buffer that doubles whenever it
+// fills up, so nothing touches the disk and long outputs cost a few syscalls
+// rather than one per line. unquoted expansions are split into words at
+// whitespace (not globbed), inside "" they stay one word; trailing newlines
+// of substitutions are removed either way.
+
+#include "shell.h"
+
+// first size of the buffer substitution output is read into
+#define SUBSTITUTION_BUFFER_SIZE (16 * 1024)
+
+// the word being built, malloc'd because substitution output has no size bound
+struct word_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+// the words expand_word produced so far, in the arena
+struct field_list {
+    char **items;
+    int count;
+    int capacity;
+};
+
+const char *substitution_end(const char *p) {
+    int depth = 0, in_quote = 0;
+    for (; *p != '\0' && *p != '\n'; p++) {
+        if (*p == '"') {
+            in_quote = !in_quote;
+        } else if (!in_quote && *p == '(') {
+            depth++;
+        } else if (!in_quote && *p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+const char *expansion_end(const char *p) {
+    if (p[0] != '$') return p;
+    if (p[1] == '(') return substitution_end(p);
+    if (p[1] == '?' || p[1] == '$' || p[1] == '#' || p[1] == '@' || p[1] == '*' || isdigit((unsigned char)p[1])) {
+        return p + 2;
+    }
+    if (p[1] == '{') {
+        const char *close = strchr(p + 2, '}');
+        return (close != NULL && is_valid_name(p + 2, close - p - 2)) ? close + 1 : NULL;
+    }
+    if (!isalpha((unsigned char)p[1]) && p[1] != '_') return p; // a literal '$'
+    for (p += 2; is_name_char(*p); p++) {
+    }
+    return p;
+}
+
+static int append_text(struct word_buffer *word, const char *text, size_t len) {
+    if (word->len + len + 1 > word->capacity) {
+        size_t capacity = word->capacity ? word->capacity * 2 : 64;
+        if (capacity < word->len + len + 1) capacity = word->len + len + 1;
+        char *grown = realloc(word->data, capacity);
+        if (grown == NULL) {
+            perror("bropesh: malloc failed for expanded word");
+            return -1;
+        }
+        word->data = grown;
+        word->capacity = capacity;
+    }
+    memcpy(word->data + word->len, text, len);
+    word->len += len;
+    return 0;
+}
+
+// moves the word into the arena as the next field and empties it
+static int end_field(struct field_list *fields, struct word_buffer *word, struct arena *arena) {
+    if (fields->count == fields->capacity) {
+        int capacity = fields->capacity ? fields->capacity * 2 : 8;
+        char **grown = arena_alloc(arena, capacity * sizeof(char *));
+        if (grown == NULL) return -1;
+        if (fields->count > 0) memcpy(grown, fields->items, fields->count * sizeof(char *));
+        fields->items = grown;
+        fields->capacity = capacity;
+    }
+    char *field = arena_strndup(arena, (word->data != NULL) ? word->data : "", word->len);
+    if (field == NULL) return -1;
+    fields->items[fields->count++] = field;
+    word->len = 0;
+    return 0;
+}
+
+// runs command in a forked copy of the shell and returns its output (malloc'd,
+// trailing newlines removed, length in *len), or NULL with last_exit_status set
+static char *run_substitution(const char *command, size_t command_len, size_t *len) {
+    char *text = strndup(command, command_len);
+    int fds[2];
+    if (text == NULL) {
+        perror("bropesh: malloc failed for command substitution");
+        return NULL;
+    }
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("bropesh: pipe failed");
+        free(text);
+        return NULL;
+    }
+    // fewer, larger reads; failure is harmless, the default size is kept
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("bropesh: fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        free(text);
+        return NULL;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO) == -1) _exit(EXIT_FAILURE);
+        close(fds[1]);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        // a non-interactive copy: no job control, no history, ctrl+c stops it
+        shell_interactive = 0;
+        job_control = 0;
+        // exit in the substitution must not write the parent's pending history
+        disown_history();
+        run_command_line(text);
+        fflush(stdout);
+        _exit(last_exit_status);
+    }
+    free(text);
+    close(fds[1]);
+
+    size_t capacity = SUBSTITUTION_BUFFER_SIZE;
+    char *output = malloc(capacity);
+    *len = 0;
+    // ctrl+c reaches the child, the handler must not print a prompt meanwhile
+    pid_t saved_foreground = foreground_pgid;
+    foreground_pgid = 0;
+    while (output != NULL) {
+        if (*len == capacity) {
+            char *grown = realloc(output, capacity * 2);
+            if (grown == NULL) {
+                free(output);
+                output = NULL;
+                break;
+            }
+            output = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fds[0], output + *len, capacity - *len);
+        if (n > 0) {
+            *len += n;
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) == -1 && errno == EINTR) {
+    }
+    add_foreground_usage(&usage);
+    foreground_pgid = saved_foreground;
+
+    if (output == NULL) {
+        perror("bropesh: malloc failed for command substitution output");
+        return NULL;
+    }
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+        // like an interrupted command, the rest of the line does not run
+        free(output);
+        last_exit_status = 128 + SIGINT;
+        return NULL;
+    }
+    while (*len > 0 && output[*len - 1] == '\n') (*len)--;
+    return output;
+}
+
+// adds the expanded text to the word; when splitting, whitespace in it ends words
+static int add_expansion(struct field_list *list, struct word_buffer *word, const char *text, size_t len, int split,
+                         int *has_field, struct arena *arena) {
+    for (size_t i = 0; i < len;) {
+        if (split && isspace((unsigned char)text[i])) {
+            // a run of whitespace ends the word before it
+            if (*has_field && end_field(list, word, arena) == -1) return -1;
+            *has_field = 0;
+            while (i < len && isspace((unsigned char)text[i])) i++;
+            continue;
+        }
+        size_t run = i;
+        while (run < len && text[run] != '\0' && !(split && isspace((unsigned char)text[run]))) run++;
+        // NUL bytes cannot be part of an argument and are dropped, like in bash
+        if (append_text(word, text + i, run - i) == -1) return -1;
+        *has_field = 1;
+        i = (run < len && text[run] == '\0') ? run + 1 : run;
+    }
+    return 0;
+}
+
+int expand_word(const char *start, const char *end, int split, struct arena *arena, char ***fields) {
+    struct word_buffer word = {NULL, 0, 0};
+    struct field_list list = {NULL, 0, 0};
+    int in_quote = 0;
+    int has_field = 0; // the current word exists, even if empty (quotes)
+    int failed = 0;
+
+    for (const char *p = start; p < end && !failed;) {
+        // the tokenizer checked that every expansion is closed
+        const char *close = expansion_end(p);
+        if (*p == '"') {
+            in_quote = !in_quote;
+            has_field = 1;
+            p++;
+            continue;
+        }
+        if (close == p) {
+            const char *next = p + 1;
+            while (next < end && *next != '"' && expansion_end(next) == next) next++;
+            failed = (append_text(&word, p, next - p) == -1);
+            has_field = 1;
+            p = next;
+            continue;
+        }
+
+        char number[32];
+        const char *value = NULL;
+        char *output = NULL;
+        size_t len = 0;
+        if (p[1] == '(') {
+            if ((output = run_substitution(p + 2, close - p - 3, &len)) == NULL) {
+                failed = 1;
+                break;
+            }
+            value = output;
+        } else if (p[1] == '?' || p[1] == '$' || p[1] == '#') {
+            int n = (p[1] == '?') ? last_exit_status : (p[1] == '$') ? (int)getpid() : count_positional_args();
+            len = snprintf(number, sizeof(number), "%d", n);
+            value = number;
+        } else if (isdigit((unsigned char)p[1])) {
+            value = get_positional_arg(p[1] - '0');
+            len = (value != NULL) ? strlen(value) : 0;
+        } else if (p[1] == '@' || p[1] == '*') {
+            // every argument, separated by spaces ("$@" is one word, like "$*")
+            for (int i = 1; !failed && (value = get_positional_arg(i)) != NULL; i++) {
+                if (i > 1) failed = (add_expansion(&list, &word, " ", 1, split && !in_quote, &has_field, arena) == -1);
+                if (!failed) failed = (add_expansion(&list, &word, value, strlen(value), split && !in_quote, &has_field, arena) == -1);
+            }
+            if (in_quote) has_field = 1;
+            p = close;
+            continue;
+        } else {
+            // unset variables expand to nothing
+            int braced = (p[1] == '{');
+            value = get_variable(p + 1 + braced, close - p - 1 - 2 * braced);
+            len = (value != NULL) ? strlen(value) : 0;
+        }
+        failed = (add_expansion(&list, &word, value, len, split && !in_quote, &has_field, arena) == -1);
+        if (in_quote) has_field = 1;
+        free(output);
+        p = close;
+    }
+
+    if (!failed && (has_field || !split)) failed = (end_field(&list, &word, arena) == -1);
+    free(word.data);
+    *fields = list.items;
+    return failed ? -1 : list.count;
+}
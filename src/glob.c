@@ -0,0 +1,373 @@
+// glob.c
+// pathname expansion for unquoted *, ? and [...] in command arguments
+// a pattern is split at '/' and every component is compiled once into a small
+// token array (literal, any char, star, 256-bit class) before any directory is
+// read. directories are read with getdents64 into one large reused buffer, so a
+// directory with hundreds of thousands of entries costs a handful of syscalls,
+// and d_type decides whether an entry is a directory without a stat (only
+// symlinks and file systems that report DT_UNKNOWN are stat'ed). only matching
+// names are copied (into the command arena); the results of a pattern are
+// sorted bytewise. like sh, entries starting with '.' only match a component
+// that starts with a literal '.', "." and ".." never match, and a pattern
+// without matches is left as it is.
+
+#include "shell.h"
+#include <dirent.h>      // for the DT_* entry types
+#include <stdint.h>      // for uint64_t
+#include <sys/stat.h>    // for fstatat
+#include <sys/syscall.h> // for SYS_getdents64
+
+// bytes of directory entries fetched per getdents64 call
+#define GLOB_DIRENT_BUFFER_SIZE (256 * 1024)
+
+// the kernel's record layout for getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+enum glob_op { GLOB_LITERAL, GLOB_ANY, GLOB_STAR, GLOB_CLASS };
+
+struct glob_token {
+    enum glob_op op;
+    unsigned char c;          // GLOB_LITERAL
+    const unsigned char *set; // GLOB_CLASS: bit c set if c matches
+};
+
+// one '/'-separated part of a pattern
+struct glob_component {
+    const char *literal;       // unescaped text if the component has no wildcards, else NULL
+    struct glob_token *tokens;
+    int num_tokens;
+    int leading_dot;           // starts with a literal '.', so hidden entries may match
+    size_t min_len;            // characters every match needs (everything but stars)
+    const char *suffix;        // literal characters after the last star, checked first
+    size_t suffix_len;
+};
+
+// a growable list of paths, the strings themselves live in the arena
+struct path_list {
+    char **items;
+    size_t count;
+    size_t capacity;
+};
+
+// allocated on first use and kept for the next pattern
+static char *dirent_buffer = NULL;
+
+static int push_path(struct path_list *list, char *path) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        char **new_items = realloc(list->items, new_capacity * sizeof(char *));
+        if (new_items == NULL) {
+            perror("bropesh: realloc failed for glob matches");
+            return -1;
+        }
+        list->items = new_items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = path;
+    return 0;
+}
+
+// dir + "/" + name in the arena, without a "./" for the current directory
+static char *join_path(struct arena *arena, const char *dir, const char *name, size_t name_len) {
+    size_t dir_len = strlen(dir);
+    int slash = (dir_len > 0 && dir[dir_len - 1] != '/');
+    char *path = arena_alloc(arena, dir_len + slash + name_len + 1);
+    if (path == NULL) return NULL;
+    memcpy(path, dir, dir_len);
+    if (slash) path[dir_len] = '/';
+    memcpy(path + dir_len + slash, name, name_len);
+    path[dir_len + slash + name_len] = '\0';
+    return path;
+}
+
+// adds the characters of a [:name:] class to set, returns 0 or -1 for an unknown name
+static int add_named_class(unsigned char *set, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (classes[i].test(c)) set[c / 8] |= 1 << (c % 8);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// compiles the bracket expression at p ("[...]", end bounds the component)
+// returns the character after the closing ']', or NULL if it is not a valid
+// bracket expression and '[' is an ordinary character
+static const char *compile_class(const char *p, const char *end, unsigned char *set) {
+    const char *q = p + 1;
+    int negate = (q < end && (*q == '!' || *q == '^'));
+    if (negate) q++;
+
+    memset(set, 0, 32);
+    int first = 1;
+    while (q < end && (*q != ']' || first)) {
+        first = 0;
+        if (q[0] == '[' && q + 1 < end && q[1] == ':') {
+            const char *close = q + 2;
+            while (close + 1 < end && !(close[0] == ':' && close[1] == ']')) close++;
+            if (close + 1 < end && add_named_class(set, q + 2, close - (q + 2)) == 0) {
+                q = close + 2;
+                continue;
+            }
+        }
+        unsigned char low;
+        if (*q == '\\' && q + 1 < end) q++;
+        low = (unsigned char)*q++;
+        unsigned char high = low;
+        if (q + 1 < end && q[0] == '-' && q[1] != ']') {
+            q++;
+            if (*q == '\\' && q + 1 < end) q++;
+            high = (unsigned char)*q++;
+        }
+        for (int c = low; c <= high; c++) set[c / 8] |= 1 << (c % 8);
+    }
+    if (q >= end) return NULL; // no closing ']'
+
+    if (negate) {
+        for (int i = 0; i < 32; i++) set[i] = ~set[i];
+    }
+    return q + 1;
+}
+
+// compiles the pattern text between start and end into component
+// returns 0, or -1 after printing an error
+static int compile_component(const char *start, const char *end, struct arena *arena,
+                             struct glob_component *component) {
+    // every pattern character becomes at most one token
+    component->tokens = arena_alloc(arena, (end - start + 1) * sizeof(struct glob_token));
+    char *literal = arena_alloc(arena, end - start + 1);
+    if (component->tokens == NULL || literal == NULL) return -1;
+
+    int num_tokens = 0;
+    int wildcards = 0;
+    size_t literal_len = 0;
+    component->min_len = 0;
+    for (const char *p = start; p < end;) {
+        struct glob_token *token = &component->tokens[num_tokens];
+        if (*p == '*') {
+            p++;
+            wildcards = 1;
+            if (num_tokens > 0 && component->tokens[num_tokens - 1].op == GLOB_STAR) continue;
+            token->op = GLOB_STAR;
+            num_tokens++;
+            continue;
+        }
+        if (*p == '?') {
+            p++;
+            wildcards = 1;
+            token->op = GLOB_ANY;
+        } else if (*p == '[') {
+            unsigned char *set = arena_alloc(arena, 32);
+            if (set == NULL) return -1;
+            const char *after = compile_class(p, end, set);
+            if (after != NULL) {
+                p = after;
+                wildcards = 1;
+                token->op = GLOB_CLASS;
+                token->set = set;
+            } else {
+                token->op = GLOB_LITERAL;
+                token->c = *p++;
+            }
+        } else {
+            if (*p == '\\' && p + 1 < end) p++;
+            token->op = GLOB_LITERAL;
+            token->c = *p++;
+        }
+        if (token->op == GLOB_LITERAL) literal[literal_len++] = token->c;
+        component->min_len++;
+        num_tokens++;
+    }
+    literal[literal_len] = '\0';
+    component->num_tokens = num_tokens;
+    component->literal = wildcards ? NULL : literal;
+    component->leading_dot = (num_tokens > 0 && component->tokens[0].op == GLOB_LITERAL && component->tokens[0].c == '.');
+
+    // the literal tail after the last star rejects most names with one memcmp
+    int first_tail = num_tokens;
+    while (first_tail > 0 && component->tokens[first_tail - 1].op == GLOB_LITERAL) first_tail--;
+    component->suffix_len = 0;
+    if (first_tail > 0 && first_tail < num_tokens) {
+        char *suffix = arena_alloc(arena, num_tokens - first_tail);
+        if (suffix == NULL) return -1;
+        for (int i = first_tail; i < num_tokens; i++) suffix[i - first_tail] = component->tokens[i].c;
+        component->suffix = suffix;
+        component->suffix_len = num_tokens - first_tail;
+    }
+    return 0;
+}
+
+static int token_matches(const struct glob_token *token, unsigned char c) {
+    switch (token->op) {
+    case GLOB_LITERAL:
+        return token->c == c;
+    case GLOB_ANY:
+        return 1;
+    case GLOB_CLASS:
+        return (token->set[c / 8] >> (c % 8)) & 1;
+    default:
+        return 0;
+    }
+}
+
+// matches name against a compiled component, backtracking only to the last star
+static int match_component(const struct glob_component *component, const char *name, size_t len) {
+    if (len < component->min_len) return 0;
+    if (component->suffix_len > 0 &&
+        memcmp(name + len - component->suffix_len, component->suffix, component->suffix_len) != 0) {
+        return 0;
+    }
+
+    const struct glob_token *tokens = component->tokens;
+    int t = 0;
+    size_t n = 0;
+    int star = -1; // token after the last star seen
+    size_t star_n = 0;
+    while (n < len) {
+        if (t < component->num_tokens && tokens[t].op == GLOB_STAR) {
+            star = ++t;
+            star_n = n;
+        } else if (t < component->num_tokens && token_matches(&tokens[t], (unsigned char)name[n])) {
+            t++;
+            n++;
+        } else if (star != -1) {
+            // let the last star swallow one more character and retry from there
+            t = star;
+            n = ++star_n;
+        } else {
+            return 0;
+        }
+    }
+    while (t < component->num_tokens && tokens[t].op == GLOB_STAR) t++;
+    return t == component->num_tokens;
+}
+
+// whether the entry name in the directory open as dir_fd is a directory
+static int is_directory(int dir_fd, const char *name, unsigned char type) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+// adds the entries of dir matching component to out
+// returns 0 (unreadable directories match nothing, like sh) or -1 after printing an error
+static int scan_directory(const char *dir, const struct glob_component *component, int need_dir,
+                          struct path_list *out, struct arena *arena) {
+    int fd = open((dir[0] != '\0') ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return 0;
+
+    int status = 0;
+    long n;
+    while (status == 0 && (n = syscall(SYS_getdents64, fd, dirent_buffer, GLOB_DIRENT_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < n && status == 0;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(dirent_buffer + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.') {
+                if (!component->leading_dot) continue;
+                if (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')) continue;
+            }
+            size_t len = strlen(name);
+            if (!match_component(component, name, len)) continue;
+            if (need_dir && !is_directory(fd, name, entry->d_type)) continue;
+
+            char *path = join_path(arena, dir, name, len);
+            if (path == NULL || push_path(out, path) == -1) status = -1;
+        }
+    }
+    close(fd);
+    return status;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int glob_expand(const char *pattern, struct arena *arena, char ***matches) {
+    *matches = NULL;
+
+    // split into components, "a//b" has two and a trailing '/' only keeps directories
+    size_t pattern_len = strlen(pattern);
+    struct glob_component *components = arena_alloc(arena, (pattern_len / 2 + 1) * sizeof(struct glob_component));
+    if (components == NULL) return -1;
+    int num_components = 0;
+    int has_wildcards = 0;
+    for (const char *p = pattern; *p != '\0';) {
+        const char *end = strchr(p, '/');
+        if (end == NULL) end = p + strlen(p);
+        if (end > p) {
+            if (compile_component(p, end, arena, &components[num_components]) == -1) return -1;
+            if (components[num_components].literal == NULL) has_wildcards = 1;
+            num_components++;
+        }
+        p = (*end == '/') ? end + 1 : end;
+    }
+    // "[" alone, "a[b" and friends are ordinary words
+    if (!has_wildcards) return 0;
+    int dirs_only = (pattern[pattern_len - 1] == '/');
+
+    if (dirent_buffer == NULL && (dirent_buffer = malloc(GLOB_DIRENT_BUFFER_SIZE)) == NULL) {
+        perror("bropesh: malloc failed for directory buffer");
+        return -1;
+    }
+
+    // breadth first: every component turns the paths so far into the next ones
+    struct path_list current = {NULL, 0, 0};
+    int status = push_path(&current, (pattern[0] == '/') ? "/" : "");
+    for (int i = 0; i < num_components && status == 0 && current.count > 0; i++) {
+        struct glob_component *component = &components[i];
+        int last = (i == num_components - 1);
+        struct path_list next = {NULL, 0, 0};
+        for (size_t j = 0; j < current.count && status == 0; j++) {
+            if (component->literal == NULL) {
+                status = scan_directory(current.items[j], component, !last || dirs_only, &next, arena);
+                continue;
+            }
+            // literal parts are not searched for, a missing directory shows up
+            // when it is opened and only the last part has to be checked
+            char *path = join_path(arena, current.items[j], component->literal, strlen(component->literal));
+            struct stat st;
+            if (path == NULL) {
+                status = -1;
+            } else if (!last || (dirs_only ? stat(path, &st) == 0 && S_ISDIR(st.st_mode)
+                                            : fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == 0)) {
+                status = push_path(&next, path);
+            }
+        }
+        free(current.items);
+        current = next;
+    }
+
+    int count = -1;
+    if (status == 0) {
+        if (current.count > 1) qsort(current.items, current.count, sizeof(char *), compare_paths);
+        *matches = arena_alloc(arena, (current.count + 1) * sizeof(char *));
+        size_t i = 0;
+        for (; *matches != NULL && i < current.count; i++) {
+            char *path = current.items[i];
+            (*matches)[i] = dirs_only ? join_path(arena, path, "", 0) : path;
+            if ((*matches)[i] == NULL) break;
+        }
+        if (*matches != NULL && i == current.count) count = (int)current.count;
+    }
+    free(current.items);
+    return count;
+}
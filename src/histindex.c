@@ -0,0 +1,308 @@
+// histindex.c
+// trigram signature index over the history log, used by "history -s" and ctrl+r
+// the index file (.bropesh_history.idx) holds one fixed-size record per history
+// line: its offset and length in the log plus a 256-bit bloom signature of the
+// line's trigrams. a substring query ANDs the signature of its own trigrams
+// against every record and only lines that pass are checked with memmem, so a
+// search over millions of commands reads 48 bytes per entry instead of the
+// whole log. the index is appended to whenever history.c writes new records;
+// anything it missed (older shells, other sessions, compaction) is indexed
+// incrementally on the next search. all writes happen under flock(), so
+// concurrent sessions append to the index in log order.
+
+#include "shell.h"
+#include <stdint.h>   // for fixed-width record fields
+#include <sys/file.h> // for flock
+#include <sys/mman.h> // for mmap and munmap
+#include <sys/stat.h> // for fstat
+
+#define INDEX_FILE_SUFFIX ".idx"
+#define INDEX_MAGIC "BRPSHIX1"
+#define SIGNATURE_WORDS 4 // 256 bits
+
+struct index_header {
+    char magic[8];
+    uint64_t log_dev;   // identity of the log file the offsets refer to,
+    uint64_t log_inode; // compaction replaces it with a new inode
+    uint64_t reserved;
+};
+
+struct index_record {
+    uint64_t offset; // start of the line in the log
+    uint32_t length; // length of the line without its newline
+    uint32_t unused;
+    uint64_t signature[SIGNATURE_WORDS];
+};
+
+static int index_fd = -1;
+static char index_path[PATH_MAX + 8];
+static char log_path[PATH_MAX];
+// log offset up to which every line is indexed
+static uint64_t index_end = 0;
+
+// sets the two bloom bits of one trigram
+static void add_trigram(uint64_t *signature, const unsigned char *p) {
+    uint32_t trigram = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    uint32_t h1 = (trigram * 2654435761u) >> 24;
+    uint32_t h2 = (trigram * 2246822519u) >> 24;
+    signature[h1 >> 6] |= (uint64_t)1 << (h1 & 63);
+    signature[h2 >> 6] |= (uint64_t)1 << (h2 & 63);
+}
+
+static void compute_signature(uint64_t *signature, const char *text, size_t len) {
+    memset(signature, 0, SIGNATURE_WORDS * sizeof(uint64_t));
+    for (size_t i = 0; i + 3 <= len; i++) {
+        add_trigram(signature, (const unsigned char *)text + i);
+    }
+}
+
+static int write_all(int fd, const void *buffer, size_t len) {
+    const char *p = buffer;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// empties the index and ties it to the current log file
+static void reset_index(struct stat *log_st) {
+    struct index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.log_dev = log_st->st_dev;
+    header.log_inode = log_st->st_ino;
+
+    if (ftruncate(index_fd, 0) == 0 && pwrite(index_fd, &header, sizeof(header), 0) == sizeof(header)) {
+        lseek(index_fd, 0, SEEK_END);
+    }
+    index_end = 0;
+}
+
+// opens and locks the index, starting over if it belongs to another log file
+// or is damaged. writers from all sessions take the lock, so index_end is read
+// again here: another shell may have appended since
+// returns 0 with the lock held, -1 if there is no usable index
+static int lock_index() {
+    struct stat log_st, index_st;
+    struct index_header header;
+
+    if (home_dir == NULL) return -1;
+    snprintf(log_path, sizeof(log_path), "%s%s", home_dir, HISTORY_FILE_NAME);
+
+    if (index_fd == -1) {
+        snprintf(index_path, sizeof(index_path), "%s%s", log_path, INDEX_FILE_SUFFIX);
+        index_fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (index_fd == -1) {
+            perror("bropesh: failed to open history index");
+            return -1;
+        }
+    }
+    while (flock(index_fd, LOCK_EX) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    if (stat(log_path, &log_st) == -1) {
+        flock(index_fd, LOCK_UN);
+        return -1;
+    }
+
+    if (fstat(index_fd, &index_st) == -1 ||
+        index_st.st_size < (off_t)sizeof(header) ||
+        pread(index_fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.log_dev != (uint64_t)log_st.st_dev || header.log_inode != (uint64_t)log_st.st_ino) {
+        reset_index(&log_st);
+        return 0;
+    }
+
+    // drop a record torn by a crash, then continue after the last complete one
+    off_t records_size = index_st.st_size - sizeof(header);
+    off_t whole = records_size - records_size % sizeof(struct index_record);
+    if (whole != records_size && ftruncate(index_fd, sizeof(header) + whole) == -1) {
+        reset_index(&log_st);
+        return 0;
+    }
+    index_end = 0;
+    if (whole > 0) {
+        struct index_record last;
+        if (pread(index_fd, &last, sizeof(last), sizeof(header) + whole - sizeof(last)) != sizeof(last)) {
+            reset_index(&log_st);
+            return 0;
+        }
+        index_end = last.offset + last.length + 1;
+    }
+    return 0;
+}
+
+static void unlock_index() {
+    flock(index_fd, LOCK_UN);
+}
+
+// indexes the newline-terminated lines in data, which start at log offset base
+static void index_lines(uint64_t base, const char *data, size_t len) {
+    struct index_record batch[256];
+    int count = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        const char *newline = memchr(data + pos, '\n', len - pos);
+        if (newline == NULL) break; // incomplete record, indexed once it is finished
+        size_t command_len;
+        unsigned long long seq;
+        const char *command = history_record_command(data + pos, newline - (data + pos), &command_len, &seq);
+        if (command_len > 0) {
+            // the record points at the command, after its sequence number
+            struct index_record *record = &batch[count++];
+            record->offset = base + (command - data);
+            record->length = command_len;
+            record->unused = 0;
+            compute_signature(record->signature, command, command_len);
+            if (count == (int)(sizeof(batch) / sizeof(batch[0]))) {
+                if (write_all(index_fd, batch, sizeof(batch)) == -1) return;
+                count = 0;
+                index_end = base + (newline - data) + 1;
+            }
+        }
+        pos = newline - data + 1;
+    }
+    if (write_all(index_fd, batch, count * sizeof(struct index_record)) == -1) return;
+    index_end = base + pos;
+}
+
+// called by history.c after it appended records at log offset `offset`
+void history_index_append(off_t offset, const char *records, size_t len) {
+    if (lock_index() == -1) return;
+    // if the index lags behind the log, the next search catches up in order
+    if ((uint64_t)offset == index_end) {
+        index_lines(offset, records, len);
+    }
+    unlock_index();
+}
+
+// called by history.c after the log was replaced (compaction)
+void history_index_invalidate() {
+    if (index_fd != -1) {
+        close(index_fd);
+        index_fd = -1;
+    }
+    index_end = 0;
+}
+
+// indexes every log line that is not indexed yet and maps log and index
+// returns the number of records, or -1 if there is no history to search
+static long map_index(char **log_data, size_t *log_size, struct index_record **records, size_t *index_size) {
+    struct stat st;
+    if (lock_index() == -1) return -1;
+
+    int log_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+    if (log_fd == -1 || fstat(log_fd, &st) == -1 || st.st_size == 0) {
+        if (log_fd != -1) close(log_fd);
+        unlock_index();
+        return -1;
+    }
+    *log_size = st.st_size;
+    *log_data = mmap(NULL, *log_size, PROT_READ, MAP_PRIVATE, log_fd, 0);
+    close(log_fd);
+    if (*log_data == MAP_FAILED) {
+        perror("bropesh: mmap failed for history file");
+        unlock_index();
+        return -1;
+    }
+
+    if (index_end > *log_size) {
+        // the log was truncated in place, the offsets no longer mean anything
+        struct stat log_st;
+        if (stat(log_path, &log_st) == 0) reset_index(&log_st);
+    }
+    if (index_end < *log_size) {
+        index_lines(index_end, *log_data + index_end, *log_size - index_end);
+    }
+    unlock_index();
+
+    if (fstat(index_fd, &st) == -1 || st.st_size <= (off_t)sizeof(struct index_header)) {
+        munmap(*log_data, *log_size);
+        return -1;
+    }
+    *index_size = st.st_size;
+    char *index_data = mmap(NULL, *index_size, PROT_READ, MAP_SHARED, index_fd, 0);
+    if (index_data == MAP_FAILED) {
+        perror("bropesh: mmap failed for history index");
+        munmap(*log_data, *log_size);
+        return -1;
+    }
+    *records = (struct index_record *)(index_data + sizeof(struct index_header));
+    return (*index_size - sizeof(struct index_header)) / sizeof(struct index_record);
+}
+
+static void unmap_index(char *log_data, size_t log_size, struct index_record *records, size_t index_size) {
+    munmap(log_data, log_size);
+    munmap((char *)records - sizeof(struct index_header), index_size);
+}
+
+// checks whether record i passes the signature filter and really contains the pattern
+static int record_matches(struct index_record *record, const uint64_t *query, const char *pattern, size_t pattern_len,
+                          const char *log_data, size_t log_size) {
+    for (int w = 0; w < SIGNATURE_WORDS; w++) {
+        if ((record->signature[w] & query[w]) != query[w]) return 0;
+    }
+    if (record->offset + record->length > log_size) return 0;
+    return memmem(log_data + record->offset, record->length, pattern, pattern_len) != NULL;
+}
+
+// finds the newest command containing pattern among the records before `before`
+// (-1 searches from the newest). returns the record number and stores a malloc'd
+// copy of the command in *match, or returns -1 if nothing matches
+long history_search(const char *pattern, long before, char **match) {
+    char *log_data;
+    size_t log_size, index_size;
+    struct index_record *records;
+    uint64_t query[SIGNATURE_WORDS];
+    size_t pattern_len = strlen(pattern);
+
+    *match = NULL;
+    long num_records = map_index(&log_data, &log_size, &records, &index_size);
+    if (num_records <= 0) return -1;
+
+    compute_signature(query, pattern, pattern_len);
+    long found = -1;
+    long start = (before < 0 || before > num_records) ? num_records : before;
+    for (long i = start - 1; i >= 0; i--) {
+        if (record_matches(&records[i], query, pattern, pattern_len, log_data, log_size)) {
+            *match = strndup(log_data + records[i].offset, records[i].length);
+            found = i;
+            break;
+        }
+    }
+
+    unmap_index(log_data, log_size, records, index_size);
+    return found;
+}
+
+// prints every command containing pattern, oldest first (history -s)
+void history_search_print(const char *pattern) {
+    char *log_data;
+    size_t log_size, index_size;
+    struct index_record *records;
+    uint64_t query[SIGNATURE_WORDS];
+    size_t pattern_len = strlen(pattern);
+
+    long num_records = map_index(&log_data, &log_size, &records, &index_size);
+    if (num_records <= 0) {
+        printf("no commands in history.\n");
+        return;
+    }
+
+    compute_signature(query, pattern, pattern_len);
+    for (long i = 0; i < num_records; i++) {
+        if (record_matches(&records[i], query, pattern, pattern_len, log_data, log_size)) {
+            printf(" %ld  %.*s\n", i + 1, (int)records[i].length, log_data + records[i].offset);
+        }
+    }
+
+    unmap_index(log_data, log_size, records, index_size);
+}
@@ -1,94 +1,641 @@
 // history.c
 // functions for managing command history
+// the history file is an append-only log shared by every running shell: each
+// accepted command is appended as one record right away instead of rewriting
+// the file at exit, so neither a crash nor another session can lose it.
+// records look like ": <seq>;<command>", where seq grows by one per record
+// across all sessions. appends and compaction happen under flock(), and a
+// session that finds the file replaced (compacted by someone else) reopens it
+// and finds its place again by sequence number. lines without the prefix,
+// written by older versions, are read as plain commands.
+//
+// only the newest MAX_HISTORY_SIZE commands are kept in memory, each command
+// at most once: a hash set over the ring finds the older copy of a repeated
+// command so it can be dropped. load_history mmaps the file and materializes
+// just its tail; it runs on first use (the first command, history, the arrow
+// keys) rather than at startup, so the first prompt does not wait for it.
+// history -r (merge_history) pulls in what other sessions appended since. the
+// file is never truncated: each time an append takes it past HISTORY_COMPACT_SIZE
+// times a power of two, the older copies of repeated commands, empty lines and
+// a torn last record are dropped through a temporary file and rename(), and
+// everything else stays.
+//
+// the sync policy comes from BROPESH_HISTORY_SYNC:
+//   always  write and fdatasync every command
+//   batch   write every command, fdatasync once per HISTORY_GROUP_SIZE commands (default)
+//   lazy    group HISTORY_GROUP_SIZE commands into one write, fdatasync at exit
 
 #include "shell.h"
+#include <sys/file.h> // for flock
+#include <sys/mman.h> // for mmap and munmap
+#include <sys/stat.h> // for fstat
 
-void load_history() {
-    char history_file_path[PATH_MAX];
-    if (home_dir == NULL) {
-        fprintf(stderr, "bropesh: history: home directory not set, cannot load history.\n");
+enum history_sync { HISTORY_SYNC_ALWAYS, HISTORY_SYNC_BATCH, HISTORY_SYNC_LAZY };
+
+// slots of the duplicate-detection hash set, four per ring entry
+#define DEDUP_TABLE_SIZE (4 * MAX_HISTORY_SIZE)
+// room for the ": <seq>;" prefix of one record
+#define RECORD_PREFIX_SIZE 24
+
+// set by enable_history, non-interactive shells never load (or save) history
+static int history_enabled = 0;
+// set once load_history ran
+static int history_loaded = 0;
+static enum history_sync sync_policy = HISTORY_SYNC_BATCH;
+static char history_file_path[PATH_MAX];
+static int history_fd = -1;
+// end of the records this session has read, -1 when the file was replaced
+static off_t read_offset = 0;
+// sequence number of the newest record read, to find read_offset again
+static unsigned long long read_seq = 0;
+// sequence number of the newest record this session wrote
+static unsigned long long written_seq = 0;
+
+// commands accepted but not written yet (group commit), one per line
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_capacity = 0;
+static int pending_records = 0;
+// the pending commands formatted as records
+static char *records = NULL;
+static size_t records_capacity = 0;
+// records written since the last fdatasync
+static int unsynced_records = 0;
+
+// history position + 1 of every command in the ring, 0 is empty, -1 deleted
+static int dedup_table[DEDUP_TABLE_SIZE];
+static int dedup_filled = 0;
+
+// fnv-1a, same as the path cache
+static unsigned long hash_command(const char *command, size_t len) {
+    unsigned long hash = 2166136261UL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)command[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// returns the slot of the set holding command, or -1
+static int dedup_find(const char *command, size_t len, unsigned long hash) {
+    size_t slot = hash % DEDUP_TABLE_SIZE;
+    for (int probes = 0; probes < DEDUP_TABLE_SIZE; probes++) {
+        int entry = dedup_table[slot];
+        if (entry == 0) return -1;
+        if (entry > 0) {
+            const char *stored = history_commands[(entry - 1) % MAX_HISTORY_SIZE];
+            if (stored != NULL && strncmp(stored, command, len) == 0 && stored[len] == '\0') {
+                return slot;
+            }
+        }
+        slot = (slot + 1) % DEDUP_TABLE_SIZE;
+    }
+    return -1;
+}
+
+static void dedup_insert(unsigned long hash, int position) {
+    size_t slot = hash % DEDUP_TABLE_SIZE;
+    while (dedup_table[slot] > 0) {
+        slot = (slot + 1) % DEDUP_TABLE_SIZE;
+    }
+    if (dedup_table[slot] == 0) dedup_filled++;
+    dedup_table[slot] = position + 1;
+}
+
+// rebuilds the set from the ring, dropping deleted slots
+static void dedup_rebuild() {
+    memset(dedup_table, 0, sizeof(dedup_table));
+    dedup_filled = 0;
+    int oldest = (history_count > MAX_HISTORY_SIZE) ? history_count - MAX_HISTORY_SIZE : 0;
+    for (int position = oldest; position < history_count; position++) {
+        const char *command = history_commands[position % MAX_HISTORY_SIZE];
+        if (command != NULL) {
+            dedup_insert(hash_command(command, strlen(command)), position);
+        }
+    }
+}
+
+// stores a command in the in-memory circular buffer, dropping an older copy of it
+static void remember_command(const char *command, size_t len) {
+    unsigned long hash = hash_command(command, len);
+    int slot = dedup_find(command, len, hash);
+    if (slot != -1) {
+        int old_idx = (dedup_table[slot] - 1) % MAX_HISTORY_SIZE;
+        free(history_commands[old_idx]);
+        history_commands[old_idx] = NULL;
+        dedup_table[slot] = -1;
+    }
+
+    int current_idx = history_count % MAX_HISTORY_SIZE;
+    // free the oldest command if we are overwriting
+    if (history_commands[current_idx] != NULL) {
+        char *oldest = history_commands[current_idx];
+        size_t oldest_len = strlen(oldest);
+        int oldest_slot = dedup_find(oldest, oldest_len, hash_command(oldest, oldest_len));
+        if (oldest_slot != -1) dedup_table[oldest_slot] = -1;
+        free(oldest);
+        history_commands[current_idx] = NULL;
+    }
+
+    history_commands[current_idx] = strndup(command, len);
+    if (history_commands[current_idx] == NULL) {
+        perror("bropesh: strdup failed for history command");
         return;
     }
-    snprintf(history_file_path, sizeof(history_file_path), "%s%s", home_dir, HISTORY_FILE_NAME);
+    dedup_insert(hash, history_count);
+    history_count++;
+    if (dedup_filled > DEDUP_TABLE_SIZE / 2) {
+        dedup_rebuild();
+    }
+}
+
+// splits a log line into sequence number and command
+// lines written before sequence numbers existed are commands with seq 0
+const char *history_record_command(const char *line, size_t len, size_t *command_len, unsigned long long *seq) {
+    *seq = 0;
+    if (len > 2 && line[0] == ':' && line[1] == ' ') {
+        unsigned long long value = 0;
+        size_t i = 2;
+        while (i < len && line[i] >= '0' && line[i] <= '9') {
+            value = value * 10 + (line[i] - '0');
+            i++;
+        }
+        if (i > 2 && i < len && line[i] == ';') {
+            *seq = value;
+            *command_len = len - i - 1;
+            return line + i + 1;
+        }
+    }
+    *command_len = len;
+    return line;
+}
 
-    history_file_ptr = fopen(history_file_path, "r");
-    if (history_file_ptr == NULL) {
-        return;
-    }
-
-    char line[MAX_COMMAND_LENGTH];
-    while (fgets(line, MAX_COMMAND_LENGTH, history_file_ptr) != NULL) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) > 0) {
-            // add to history, using the circular buffer logic
-            int idx;
-            if (history_count < MAX_HISTORY_SIZE) {
-                idx = history_count;
-            } else {
-                idx = history_count % MAX_HISTORY_SIZE;
-                // free the oldest command if we are overwriting
-                if (history_commands[idx] != NULL) {
-                    free(history_commands[idx]);
-                }
+// writes all of buffer to fd, returns 0 on success or -1
+static int write_all(int fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buffer, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int open_history_file() {
+    history_fd = open(history_file_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        perror("bropesh: failed to open history file");
+        return -1;
+    }
+    return 0;
+}
+
+static off_t history_size() {
+    struct stat st;
+    return (fstat(history_fd, &st) == 0) ? st.st_size : 0;
+}
+
+// takes the history lock (LOCK_SH or LOCK_EX), reopening the file first if
+// another session replaced it by compaction
+// returns 0 with the lock held, -1 if there is no usable history file
+static int lock_history(int operation) {
+    for (;;) {
+        if (history_fd == -1 && open_history_file() == -1) {
+            return -1;
+        }
+        while (flock(history_fd, operation) == -1) {
+            if (errno != EINTR) {
+                perror("bropesh: failed to lock history file");
+                return -1;
             }
-            history_commands[idx] = strdup(line);
-            if (history_commands[idx] == NULL) {
-                perror("bropesh: strdup failed for history command during load");
-                break;
+        }
+        struct stat path_st, fd_st;
+        if (stat(history_file_path, &path_st) == 0 && fstat(history_fd, &fd_st) == 0 &&
+            path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino) {
+            return 0;
+        }
+        // our offsets belong to the old file, read_seq tells where to continue
+        close(history_fd);
+        history_fd = -1;
+        read_offset = -1;
+    }
+}
+
+static void unlock_history() {
+    if (history_fd != -1) {
+        flock(history_fd, LOCK_UN);
+    }
+}
+
+// offset of the first record newer than seq in data
+static off_t find_record_after(const char *data, size_t size, unsigned long long seq) {
+    size_t pos = 0;
+    while (pos < size) {
+        const char *newline = memchr(data + pos, '\n', size - pos);
+        size_t line_end = (newline != NULL) ? (size_t)(newline - data) : size;
+        size_t command_len;
+        unsigned long long record_seq;
+        history_record_command(data + pos, line_end - pos, &command_len, &record_seq);
+        if (record_seq > seq) break;
+        pos = line_end + 1;
+    }
+    return (pos < size) ? (off_t)pos : (off_t)size;
+}
+
+// sequence number of the last record in a file of size bytes, 0 if unknown
+// sets *torn if the last record has no newline (a writer crashed)
+static unsigned long long last_file_seq(off_t size, int *torn) {
+    char tail[4096];
+    *torn = 0;
+    if (size == 0) return 0;
+
+    off_t start = (size > (off_t)sizeof(tail)) ? size - (off_t)sizeof(tail) : 0;
+    ssize_t n = pread(history_fd, tail, size - start, start);
+    if (n <= 0) return 0;
+    if (tail[n - 1] != '\n') {
+        *torn = 1;
+        return 0;
+    }
+    char *prev_newline = (n > 1) ? memrchr(tail, '\n', n - 1) : NULL;
+    if (prev_newline == NULL && start > 0) return 0; // a record longer than the tail
+    size_t line_start = (prev_newline != NULL) ? (size_t)(prev_newline - tail) + 1 : 0;
+
+    size_t command_len;
+    unsigned long long seq;
+    history_record_command(tail + line_start, n - 1 - line_start, &command_len, &seq);
+    return seq;
+}
+
+// whether growing the file from before to after bytes passes a compaction
+// threshold: HISTORY_COMPACT_SIZE, twice that, four times that...
+static int passes_compact_threshold(off_t before, off_t after) {
+    for (off_t threshold = HISTORY_COMPACT_SIZE; threshold < after; threshold *= 2) {
+        if (threshold >= before) return 1;
+    }
+    return 0;
+}
+
+// rewrites the file keeping each command once (its newest record), without
+// empty lines or a torn last record, via a temporary file and rename() so a crash during compaction
+// leaves either the old or the new file intact. a file that would shrink by less
+// than an eighth is left alone. the caller holds the exclusive lock
+static void compact_history() {
+    struct stat st;
+    if (fstat(history_fd, &st) == -1 || st.st_size == 0) {
+        return;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("bropesh: mmap failed for history compaction");
+        return;
+    }
+
+    // find the lines to keep: newest first, skipping commands already seen; a
+    // last line without its newline was torn by a crashed writer
+    size_t num_lines = 0;
+    for (char *p = data; p < data + st.st_size && (p = memchr(p, '\n', data + st.st_size - p)) != NULL; p++) {
+        num_lines++;
+    }
+    size_t *line_starts = malloc((num_lines + 1) * sizeof(size_t));
+    char *dropped = calloc(num_lines + 1, 1);
+    size_t table_size = 16;
+    while (table_size < num_lines * 2) table_size *= 2;
+    size_t *seen = calloc(table_size, sizeof(size_t)); // line index + 1
+    char *output = malloc(st.st_size + 1);
+    if (line_starts == NULL || dropped == NULL || seen == NULL || output == NULL) {
+        perror("bropesh: malloc failed for history compaction");
+        free(line_starts);
+        free(dropped);
+        free(seen);
+        free(output);
+        munmap(data, st.st_size);
+        return;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < num_lines; i++) {
+        line_starts[i] = pos;
+        pos = (char *)memchr(data + pos, '\n', st.st_size - pos) - data + 1;
+    }
+    line_starts[num_lines] = pos;
+
+    for (size_t i = num_lines; i-- > 0;) {
+        size_t command_len, other_len;
+        unsigned long long seq;
+        const char *command = history_record_command(data + line_starts[i], line_starts[i + 1] - line_starts[i] - 1, &command_len, &seq);
+        size_t slot = hash_command(command, command_len) & (table_size - 1);
+        dropped[i] = (command_len == 0);
+        while (!dropped[i] && seen[slot] != 0) {
+            size_t other = seen[slot] - 1;
+            const char *other_command = history_record_command(data + line_starts[other], line_starts[other + 1] - line_starts[other] - 1, &other_len, &seq);
+            if (other_len == command_len && memcmp(other_command, command, command_len) == 0) {
+                dropped[i] = 1;
             }
-            history_count++;
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (!dropped[i]) {
+            seen[slot] = i + 1;
+        }
+    }
+
+    size_t output_len = 0;
+    for (size_t i = 0; i < num_lines; i++) {
+        if (dropped[i]) continue;
+        memcpy(output + output_len, data + line_starts[i], line_starts[i + 1] - line_starts[i]);
+        output_len += line_starts[i + 1] - line_starts[i];
+    }
+    free(line_starts);
+    free(dropped);
+    free(seen);
+    munmap(data, st.st_size);
+    if (output_len > (size_t)st.st_size - (size_t)st.st_size / 8) {
+        // not worth rewriting the file, the next threshold is twice as far
+        free(output);
+        return;
+    }
+
+    char temp_path[PATH_MAX + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%d", history_file_path, (int)getpid());
+    int temp_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (temp_fd == -1) {
+        perror("bropesh: failed to create temporary history file");
+        free(output);
+        return;
+    }
+
+    int ok = write_all(temp_fd, output, output_len) == 0 && fsync(temp_fd) == 0;
+    close(temp_fd);
+    free(output);
+    if (!ok || rename(temp_path, history_file_path) == -1) {
+        perror("bropesh: history compaction failed");
+        unlink(temp_path);
+        return;
+    }
+
+    // closing the old file releases its lock, waiting sessions then notice the new inode
+    close(history_fd);
+    open_history_file();
+    read_offset = (read_offset == st.st_size) ? (off_t)output_len : -1;
+    history_index_invalidate();
+}
+
+// writes the pending commands as numbered records with one write() and syncs
+// according to the policy
+static void flush_pending() {
+    if (pending_records == 0) {
+        return;
+    }
+    if (lock_history(LOCK_EX) == -1) {
+        pending_len = 0;
+        pending_records = 0;
+        return;
+    }
+
+    off_t size = history_size(), size_before = size;
+    int torn;
+    unsigned long long seq = last_file_seq(size, &torn);
+    if (seq < written_seq) seq = written_seq;
+
+    size_t needed = pending_len + pending_records * RECORD_PREFIX_SIZE + 1;
+    if (needed > records_capacity) {
+        char *new_records = realloc(records, needed);
+        if (new_records == NULL) {
+            perror("bropesh: realloc failed for history records");
+            unlock_history();
+            return;
         }
+        records = new_records;
+        records_capacity = needed;
     }
-    fclose(history_file_ptr);
-    history_file_ptr = NULL; // reset pointer, will be reopened for writing by save_history
+
+    // a record torn by a crash is terminated so ours start on their own line
+    size_t records_len = 0;
+    if (torn) records[records_len++] = '\n';
+    for (size_t pos = 0; pos < pending_len;) {
+        char *newline = memchr(pending + pos, '\n', pending_len - pos);
+        size_t len = newline - (pending + pos) + 1;
+        records_len += snprintf(records + records_len, RECORD_PREFIX_SIZE, ": %llu;", ++seq);
+        memcpy(records + records_len, pending + pos, len);
+        records_len += len;
+        pos += len;
+    }
+
+    if (write_all(history_fd, records, records_len) == -1) {
+        perror("bropesh: failed to append to history file");
+    } else {
+        history_index_append(size, records, records_len);
+        // nobody wrote since we last read, so we are still up to date
+        if (read_offset == size) {
+            read_offset = size + records_len;
+            read_seq = seq;
+        }
+        written_seq = seq;
+        size += records_len;
+        unsynced_records += pending_records;
+    }
+    pending_len = 0;
+    pending_records = 0;
+
+    if (unsynced_records > 0 &&
+        (sync_policy == HISTORY_SYNC_ALWAYS || (sync_policy == HISTORY_SYNC_BATCH && unsynced_records >= HISTORY_GROUP_SIZE))) {
+        fdatasync(history_fd);
+        unsynced_records = 0;
+    }
+    if (passes_compact_threshold(size_before, size)) {
+        compact_history();
+    }
+    unlock_history();
 }
 
-void save_history() {
-    char history_file_path[PATH_MAX];
+void enable_history() {
+    history_enabled = 1;
+}
+
+void disown_history() {
+    // the parent still holds the same records and writes them itself
+    history_enabled = 0;
+    history_loaded = 0;
+    pending_len = 0;
+    pending_records = 0;
+}
+
+void load_history() {
+    if (!history_enabled || history_loaded) {
+        return;
+    }
+    history_loaded = 1;
     if (home_dir == NULL) {
-        fprintf(stderr, "bropesh: history: home directory not set, cannot save history.\n");
+        fprintf(stderr, "bropesh: history: home directory not set, cannot load history.\n");
         return;
     }
     snprintf(history_file_path, sizeof(history_file_path), "%s%s", home_dir, HISTORY_FILE_NAME);
 
-    history_file_ptr = fopen(history_file_path, "w"); // overwrite file if it exists
-    if (history_file_ptr == NULL) {
-        perror("bropesh: failed to open history file for writing");
+    const char *policy = getenv("BROPESH_HISTORY_SYNC");
+    if (policy != NULL && strcmp(policy, "always") == 0) {
+        sync_policy = HISTORY_SYNC_ALWAYS;
+    } else if (policy != NULL && strcmp(policy, "lazy") == 0) {
+        sync_policy = HISTORY_SYNC_LAZY;
+    }
+
+    if (lock_history(LOCK_EX) == -1) {
         return;
     }
+    size_t map_size = history_size();
+    read_offset = map_size;
+    if (map_size == 0) {
+        unlock_history();
+        return;
+    }
+
+    char *data = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("bropesh: mmap failed for history file");
+        unlock_history();
+        return;
+    }
+    size_t end = map_size;
 
-    int actual_stored_count = (history_count < MAX_HISTORY_SIZE) ? history_count : MAX_HISTORY_SIZE;
-    int start_idx = (history_count > MAX_HISTORY_SIZE) ? (history_count % MAX_HISTORY_SIZE) : 0;
+    // a record torn by a crash has no newline: terminate it so the next
+    // record starts on its own line, and do not load it
+    if (data[end - 1] != '\n') {
+        if (write_all(history_fd, "\n", 1) == 0) read_offset++;
+        char *last_newline = memrchr(data, '\n', end);
+        end = (last_newline != NULL) ? (size_t)(last_newline - data) + 1 : 0;
+    }
 
-    for (int i = 0; i < actual_stored_count; i++) {
-        int current_idx = (start_idx + i) % MAX_HISTORY_SIZE;
-        if (history_commands[current_idx] != NULL) {
-            fprintf(history_file_ptr, "%s\n", history_commands[current_idx]);
+    // walk back from the end to find where the newest MAX_HISTORY_SIZE lines start
+    size_t start = end;
+    int lines = 0;
+    while (start > 0 && lines < MAX_HISTORY_SIZE) {
+        char *prev_newline = (start > 1) ? memrchr(data, '\n', start - 1) : NULL;
+        size_t line_start = (prev_newline != NULL) ? (size_t)(prev_newline - data) + 1 : 0;
+        if (start - 1 > line_start) { // skip empty lines
+            lines++;
         }
+        start = line_start;
+    }
+
+    // materialize only that tail, oldest first
+    while (start < end) {
+        char *newline = memchr(data + start, '\n', end - start);
+        size_t line_end = (newline != NULL) ? (size_t)(newline - data) : end;
+        size_t command_len;
+        unsigned long long seq;
+        const char *command = history_record_command(data + start, line_end - start, &command_len, &seq);
+        if (command_len > 0) {
+            remember_command(command, command_len);
+        }
+        if (seq > read_seq) read_seq = seq;
+        start = line_end + 1;
+    }
+    munmap(data, map_size);
+    unlock_history();
+}
+
+// history -r: adds the commands other sessions appended since the last read
+void merge_history() {
+    load_history();
+    if (!history_loaded) {
+        return;
+    }
+    flush_pending(); // our own queued commands go first, as in the file
+    if (lock_history(LOCK_SH) == -1) {
+        return;
+    }
+    size_t size = history_size();
+    char *data = (size > 0) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, history_fd, 0) : NULL;
+    if (data == MAP_FAILED) {
+        perror("bropesh: mmap failed for history file");
+        unlock_history();
+        return;
+    }
+
+    size_t pos = (read_offset >= 0 && (size_t)read_offset <= size) ? (size_t)read_offset : (size_t)find_record_after(data, size, read_seq);
+    while (pos < size) {
+        char *newline = memchr(data + pos, '\n', size - pos);
+        if (newline == NULL) break; // still being written
+        size_t command_len;
+        unsigned long long seq;
+        const char *command = history_record_command(data + pos, newline - (data + pos), &command_len, &seq);
+        if (command_len > 0) {
+            remember_command(command, command_len);
+        }
+        if (seq > read_seq) read_seq = seq;
+        pos = newline - data + 1;
+    }
+    read_offset = pos;
+
+    if (data != NULL) munmap(data, size);
+    unlock_history();
+}
+
+// writes the records that are still pending and syncs the file
+void save_history() {
+    if (!history_loaded) {
+        return;
+    }
+    flush_pending();
+    if (unsynced_records > 0 && history_fd != -1) {
+        fdatasync(history_fd);
+        unsynced_records = 0;
     }
-    fclose(history_file_ptr);
-    history_file_ptr = NULL;
 }
 
 void add_to_history(char *command) {
     if (command == NULL || strlen(command) == 0) {
         return;
     }
+    size_t len = strlen(command);
+    load_history(); // the older commands go first in the ring
+    remember_command(command, len);
+    if (!history_loaded) {
+        return;
+    }
 
-    int current_idx;
-    if (history_count < MAX_HISTORY_SIZE) {
-        current_idx = history_count;
-    } else {
-        current_idx = history_count % MAX_HISTORY_SIZE;
-        if (history_commands[current_idx] != NULL) {
-            free(history_commands[current_idx]);
+    // queue the record, lazy mode writes HISTORY_GROUP_SIZE records at once
+    if (pending_len + len + 1 > pending_capacity) {
+        size_t new_capacity = (pending_capacity == 0) ? 4096 : pending_capacity;
+        while (new_capacity < pending_len + len + 1) new_capacity *= 2;
+        char *new_pending = realloc(pending, new_capacity);
+        if (new_pending == NULL) {
+            perror("bropesh: realloc failed for history buffer");
+            return;
         }
+        pending = new_pending;
+        pending_capacity = new_capacity;
     }
+    memcpy(pending + pending_len, command, len);
+    pending[pending_len + len] = '\n';
+    pending_len += len + 1;
+    pending_records++;
 
-    history_commands[current_idx] = strdup(command);
-    if (history_commands[current_idx] == NULL) {
-        perror("bropesh: strdup failed for history command");
-        return;
+    if (sync_policy != HISTORY_SYNC_LAZY || pending_records >= HISTORY_GROUP_SIZE) {
+        flush_pending();
     }
-    history_count++;
+}
+
+// saves pending records and frees the in-memory history
+void free_history() {
+    save_history();
+    for (int i = 0; i < MAX_HISTORY_SIZE; i++) {
+        if (history_commands[i] != NULL) {
+            free(history_commands[i]);
+            history_commands[i] = NULL;
+        }
+    }
+    memset(dedup_table, 0, sizeof(dedup_table));
+    dedup_filled = 0;
+    if (history_fd != -1) {
+        close(history_fd);
+        history_fd = -1;
+    }
+    free(pending);
+    pending = NULL;
+    pending_capacity = 0;
+    free(records);
+    records = NULL;
+    records_capacity = 0;
+    history_loaded = 0; // the next load_history reads the file again
 }
@@ -0,0 +1,170 @@
+// input.c
+// line readers for non-interactive input (-c strings, script files, piped stdin)
+// regular files are mmap'd and scanned with memchr, pipes and terminals are
+// read through a large buffer, so reading a generated script with hundreds of
+// thousands of lines costs a handful of syscalls instead of one per line.
+
+#include "shell.h"
+#include <sys/mman.h> // for mmap and munmap
+#include <sys/stat.h> // for fstat
+
+// size of the read buffer used for pipes and other non-mappable input
+#define INPUT_BUFFER_SIZE (256 * 1024)
+
+// copies data[start, end) into the reader's line buffer and NUL-terminates it
+static char *copy_line(struct input_reader *reader, size_t start, size_t end) {
+    size_t len = end - start;
+    if (len + 1 > reader->line_capacity) {
+        size_t new_capacity = (reader->line_capacity == 0) ? 256 : reader->line_capacity;
+        while (new_capacity < len + 1) new_capacity *= 2;
+        char *new_line = realloc(reader->line, new_capacity);
+        if (new_line == NULL) {
+            perror("bropesh: realloc failed for input line");
+            return NULL;
+        }
+        reader->line = new_line;
+        reader->line_capacity = new_capacity;
+    }
+    memcpy(reader->line, reader->data + start, len);
+    reader->line[len] = '\0';
+    return reader->line;
+}
+
+// reads input from an in-memory string (the argument of -c)
+void input_open_string(struct input_reader *reader, const char *str) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+    reader->data = (char *)str;
+    reader->size = strlen(str);
+}
+
+// reads input from fd, mapping it when it is a regular file
+// returns 0 on success, -1 after printing an error
+int input_open_fd(struct input_reader *reader, int fd) {
+    struct stat st;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset < 0) offset = 0;
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            reader->data = map;
+            reader->size = st.st_size;
+            reader->pos = offset;
+            reader->is_mapped = 1;
+            return 0;
+        }
+    }
+
+    reader->capacity = INPUT_BUFFER_SIZE;
+    reader->data = malloc(reader->capacity);
+    if (reader->data == NULL) {
+        perror("bropesh: malloc failed for input buffer");
+        return -1;
+    }
+    return 0;
+}
+
+// refills the read buffer, keeping the partial line at pos
+// returns the number of bytes read, 0 at end of file, -1 on error
+static ssize_t fill_buffer(struct input_reader *reader) {
+    if (reader->pos > 0) {
+        memmove(reader->data, reader->data + reader->pos, reader->size - reader->pos);
+        reader->size -= reader->pos;
+        reader->pos = 0;
+    }
+    if (reader->size == reader->capacity) {
+        // a single line longer than the buffer, grow it
+        char *new_data = realloc(reader->data, reader->capacity * 2);
+        if (new_data == NULL) {
+            perror("bropesh: realloc failed for input buffer");
+            return -1;
+        }
+        reader->data = new_data;
+        reader->capacity *= 2;
+    }
+
+    ssize_t n;
+    while ((n = read(reader->fd, reader->data + reader->size, reader->capacity - reader->size)) == -1 && errno == EINTR) {
+    }
+    if (n == -1) {
+        perror("bropesh: read failed");
+        return -1;
+    }
+    reader->size += n;
+    return n;
+}
+
+// returns the next line without its newline, or NULL at end of input
+// the returned string is only valid until the next call
+char *input_read_line(struct input_reader *reader) {
+    if (reader->capacity == 0) {
+        // mapped file or -c string
+        if (reader->pos >= reader->size) return NULL;
+        char *newline = memchr(reader->data + reader->pos, '\n', reader->size - reader->pos);
+        size_t end = (newline != NULL) ? (size_t)(newline - reader->data) : reader->size;
+        char *line = copy_line(reader, reader->pos, end);
+        reader->pos = (newline != NULL) ? end + 1 : end;
+        return line;
+    }
+
+    size_t scanned = reader->pos;
+    for (;;) {
+        char *newline = memchr(reader->data + scanned, '\n', reader->size - scanned);
+        if (newline != NULL) {
+            char *line = reader->data + reader->pos;
+            *newline = '\0';
+            reader->pos = newline - reader->data + 1;
+            return line;
+        }
+        if (reader->at_eof) {
+            if (reader->pos >= reader->size) return NULL;
+            // last line without a trailing newline
+            if (reader->size == reader->capacity && fill_buffer(reader) == -1) return NULL;
+            reader->data[reader->size] = '\0';
+            char *line = reader->data + reader->pos;
+            reader->pos = reader->size;
+            return line;
+        }
+
+        scanned = reader->size - reader->pos;
+        ssize_t n = fill_buffer(reader);
+        if (n == -1) return NULL;
+        if (n == 0) reader->at_eof = 1;
+    }
+}
+
+// returns 1 when no input is left after the current line
+int input_at_end(struct input_reader *reader) {
+    if (reader->capacity == 0 || reader->at_eof) {
+        return reader->pos >= reader->size;
+    }
+    return 0;
+}
+
+// byte offset of the next unread line in a mapped file
+off_t input_offset(struct input_reader *reader) {
+    return reader->is_mapped ? (off_t)reader->pos : -1;
+}
+
+// moves the next line of a mapped file to offset (after a command consumed part of stdin)
+void input_seek(struct input_reader *reader, off_t offset) {
+    if (reader->is_mapped && offset >= 0 && (size_t)offset <= reader->size) {
+        reader->pos = offset;
+    }
+}
+
+void input_close(struct input_reader *reader) {
+    if (reader->is_mapped) {
+        munmap(reader->data, reader->size);
+    } else if (reader->capacity > 0) {
+        free(reader->data);
+    }
+    free(reader->line);
+    reader->data = NULL;
+    reader->line = NULL;
+}
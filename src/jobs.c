@@ -0,0 +1,594 @@
+// jobs.c
+// job table and child reaping for jobs, fg, bg, wait and kill
+// SIGCHLD stays blocked in the shell and is read from a signalfd instead of
+// being handled asynchronously: children are reaped with waitpid() from the
+// main loop (and from the line editor while it waits for a key), so reaping
+// never races with a foreground wait and no handler touches stdio. finished
+// background jobs are reported right before the next prompt.
+// an interactive shell puts every job in its own process group and hands it
+// the terminal while it runs in the foreground, so ctrl+c and ctrl+z reach the
+// job and not the shell.
+
+#include "shell.h"
+#include <poll.h>          // for poll
+#include <sys/signalfd.h>  // for signalfd
+#include <sys/time.h>      // for timeradd
+#include <termios.h>       // for tcsetpgrp and terminal modes
+
+enum job_state { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+struct job_process {
+    pid_t pid;
+    int status;            // from waitpid, valid once the process stopped or finished
+    enum job_state state;
+};
+
+struct job {
+    int id;                      // the N of %N
+    pid_t pgid;                  // process group, the first process
+    struct job_process *procs;
+    int num_procs;
+    enum job_state state;        // running while any process runs
+    int notify;                  // the state changed and was not reported yet
+    char *command;               // text shown by jobs
+    struct rusage usage;         // summed over the processes that finished
+    struct termios tmodes;       // terminal modes of a stopped job
+    int has_tmodes;
+};
+
+int job_control = 0;
+int sigchld_fd = -1;
+pid_t foreground_pgid = -1;
+volatile sig_atomic_t sigint_received = 0;
+
+static struct job **jobs = NULL;
+static int num_jobs = 0;
+static int jobs_capacity = 0;
+static struct termios shell_tmodes;
+static pid_t shell_pgid;
+// resource usage of the foreground jobs since reset_job_usage (time builtin)
+static struct rusage foreground_usage;
+
+// adds the usage of from to into, max rss is the largest of both
+static void add_usage(struct rusage *into, const struct rusage *from) {
+    timeradd(&into->ru_utime, &from->ru_utime, &into->ru_utime);
+    timeradd(&into->ru_stime, &from->ru_stime, &into->ru_stime);
+    if (from->ru_maxrss > into->ru_maxrss) into->ru_maxrss = from->ru_maxrss;
+    into->ru_minflt += from->ru_minflt;
+    into->ru_majflt += from->ru_majflt;
+    into->ru_inblock += from->ru_inblock;
+    into->ru_oublock += from->ru_oublock;
+    into->ru_nvcsw += from->ru_nvcsw;
+    into->ru_nivcsw += from->ru_nivcsw;
+}
+
+void reset_job_usage() {
+    memset(&foreground_usage, 0, sizeof(foreground_usage));
+}
+
+// counts usage of a child the shell waited for outside the job table (parallel)
+void add_foreground_usage(const struct rusage *usage) {
+    add_usage(&foreground_usage, usage);
+}
+
+// resource usage of the foreground jobs that finished or stopped since reset_job_usage
+void get_job_usage(struct rusage *usage) {
+    *usage = foreground_usage;
+}
+
+// sets up job control for an interactive shell and the SIGCHLD signalfd
+void init_jobs() {
+    sigset_t chld_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigchld_fd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd == -1) {
+        perror("bropesh: signalfd failed");
+    }
+
+    if (!shell_interactive) {
+        return;
+    }
+    // wait until we are in the foreground, then take our own process group
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    if (getpid() != shell_pgid && setpgid(0, 0) == 0) {
+        shell_pgid = getpid();
+    }
+    if (tcsetpgrp(STDIN_FILENO, shell_pgid) == -1 || tcgetattr(STDIN_FILENO, &shell_tmodes) == -1) {
+        perror("bropesh: no job control");
+        return;
+    }
+    job_control = 1;
+}
+
+static struct job *find_job_by_id(int id) {
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i]->id == id) return jobs[i];
+    }
+    return NULL;
+}
+
+static void free_job(struct job *job) {
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i] == job) {
+            memmove(&jobs[i], &jobs[i + 1], (num_jobs - i - 1) * sizeof(jobs[0]));
+            num_jobs--;
+            break;
+        }
+    }
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+// text shown for a job, rebuilt from its stages like "sort < in | uniq -c"
+static char *describe_job(struct pipeline_stage *stages, int num_stages, int is_background) {
+    size_t len = 3;
+    for (int i = 0; i < num_stages; i++) {
+        for (char **arg = stages[i].args; *arg != NULL; arg++) len += strlen(*arg) + 1;
+        if (stages[i].input_file != NULL) len += strlen(stages[i].input_file) + 3;
+        if (stages[i].output_file != NULL) len += strlen(stages[i].output_file) + 4;
+        if (stages[i].error_file != NULL) len += strlen(stages[i].error_file) + 4;
+        len += 3;
+    }
+    char *text = malloc(len);
+    if (text == NULL) return NULL;
+
+    char *p = text;
+    for (int i = 0; i < num_stages; i++) {
+        if (i > 0) p += sprintf(p, " | ");
+        for (char **arg = stages[i].args; *arg != NULL; arg++) {
+            p += sprintf(p, (arg == stages[i].args) ? "%s" : " %s", *arg);
+        }
+        if (stages[i].input_file != NULL) p += sprintf(p, (p > text && p[-1] != ' ') ? " < %s" : "< %s", stages[i].input_file);
+        if (stages[i].output_file != NULL) p += sprintf(p, stages[i].append_output ? " >> %s" : " > %s", stages[i].output_file);
+        if (stages[i].error_file != NULL) p += sprintf(p, " 2> %s", stages[i].error_file);
+    }
+    if (is_background) p += sprintf(p, " &");
+    *p = '\0';
+    return text;
+}
+
+// records a status and resource usage from wait4 for the process pid
+void mark_process_status(pid_t pid, int status, const struct rusage *usage) {
+    for (int i = 0; i < num_jobs; i++) {
+        struct job *job = jobs[i];
+        for (int j = 0; j < job->num_procs; j++) {
+            struct job_process *proc = &job->procs[j];
+            if (proc->pid != pid) continue;
+
+            if (WIFSTOPPED(status)) {
+                proc->state = JOB_STOPPED;
+                proc->status = status;
+            } else if (WIFCONTINUED(status)) {
+                proc->state = JOB_RUNNING;
+            } else {
+                proc->state = JOB_DONE;
+                proc->status = status;
+                add_usage(&job->usage, usage);
+            }
+
+            // the job runs while any process runs, and is done once all are
+            enum job_state state = JOB_DONE;
+            for (int k = 0; k < job->num_procs; k++) {
+                if (job->procs[k].state == JOB_RUNNING) {
+                    state = JOB_RUNNING;
+                    break;
+                }
+                if (job->procs[k].state == JOB_STOPPED) state = JOB_STOPPED;
+            }
+            if (state != job->state) {
+                job->state = state;
+                job->notify = 1;
+            }
+            return;
+        }
+    }
+}
+
+// reaps every child that changed state, without blocking
+// returns 1 if a job now has something to report
+int update_jobs() {
+    struct signalfd_siginfo info;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    // the signalfd only wakes up poll(), waitpid() tells what actually happened
+    if (sigchld_fd != -1) {
+        while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {
+        }
+    }
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        mark_process_status(pid, status, &usage);
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i]->notify) return 1;
+    }
+    return 0;
+}
+
+// blocks until job is no longer running (or ctrl+c when interruptible)
+// returns 0, or -1 if it was interrupted
+static int wait_for_state_change(struct job *job, int interruptible) {
+    while (job->state == JOB_RUNNING) {
+        if (interruptible) {
+            // poll is never restarted after a signal handler, so ctrl+c gets through
+            struct pollfd pfd = {sigchld_fd, POLLIN, 0};
+            update_jobs();
+            if (job->state != JOB_RUNNING) break;
+            if (poll(&pfd, 1, -1) == -1 && errno == EINTR && sigint_received) return -1;
+            continue;
+        }
+        // wait4 rather than waitpid: the time builtin wants the resource usage
+        struct rusage usage;
+        int status;
+        pid_t pid = wait4(-1, &status, WUNTRACED, &usage);
+        if (pid > 0) {
+            mark_process_status(pid, status, &usage);
+        } else if (errno == ECHILD) {
+            job->state = JOB_DONE; // someone else reaped our processes
+        } else if (errno != EINTR) {
+            perror("bropesh: waitpid failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// exit status of a finished or stopped job: the one of its last process
+static int job_exit_status(struct job *job) {
+    if (job->state == JOB_STOPPED) {
+        for (int i = 0; i < job->num_procs; i++) {
+            if (job->procs[i].state == JOB_STOPPED) return 128 + WSTOPSIG(job->procs[i].status);
+        }
+    }
+    struct job_process *last = &job->procs[job->num_procs - 1];
+    return (last->state == JOB_DONE) ? exit_status_from_wait(last->status) : 0;
+}
+
+static void print_job(struct job *job, const char *state_text) {
+    char marker = ' ';
+    if (num_jobs > 0 && jobs[num_jobs - 1] == job) marker = '+';
+    else if (num_jobs > 1 && jobs[num_jobs - 2] == job) marker = '-';
+    printf("[%d]%c  %-24s%s\n", job->id, marker, state_text, job->command != NULL ? job->command : "");
+}
+
+// runs job in the foreground: hands it the terminal and waits until it
+// finishes or stops, returns its exit status
+static int wait_foreground(struct job *job, int resume) {
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        if (resume && job->has_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+    }
+    if (resume) {
+        kill(-job->pgid, SIGCONT);
+        for (int i = 0; i < job->num_procs; i++) {
+            if (job->procs[i].state == JOB_STOPPED) job->procs[i].state = JOB_RUNNING;
+        }
+        job->state = JOB_RUNNING;
+    }
+
+    foreground_pgid = job->pgid;
+    wait_for_state_change(job, 0);
+    foreground_pgid = -1;
+
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        if (job->state == JOB_STOPPED) {
+            job->has_tmodes = (tcgetattr(STDIN_FILENO, &job->tmodes) == 0);
+        }
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+
+    add_usage(&foreground_usage, &job->usage);
+    memset(&job->usage, 0, sizeof(job->usage));
+    int exit_status = job_exit_status(job);
+    if (job->state == JOB_STOPPED) {
+        printf("\n");
+        print_job(job, "Stopped");
+        job->notify = 0;
+    } else {
+        // the terminal echoed ^C without a newline
+        if (job_control && exit_status == 128 + SIGINT) printf("\n");
+        free_job(job);
+    }
+    return exit_status;
+}
+
+// registers the started processes of a command line as a job; a foreground job
+// is waited for, a background one is announced with its job number
+// returns the exit status of the last process (0 for background jobs)
+int launch_job(pid_t *pids, int num_pids, struct pipeline_stage *stages, int num_stages, int is_background) {
+    struct job *job = calloc(1, sizeof(struct job));
+    if (job != NULL) job->procs = malloc(num_pids * sizeof(struct job_process));
+    if (num_jobs == jobs_capacity) {
+        int new_capacity = (jobs_capacity == 0) ? 16 : jobs_capacity * 2;
+        struct job **new_jobs = realloc(jobs, new_capacity * sizeof(jobs[0]));
+        if (new_jobs != NULL) {
+            jobs = new_jobs;
+            jobs_capacity = new_capacity;
+        }
+    }
+    if (job == NULL || job->procs == NULL || num_jobs == jobs_capacity) {
+        // wait for the processes without a job
+        perror("bropesh: malloc failed for job");
+        if (job != NULL) free(job->procs);
+        free(job);
+        int status = 0;
+        for (int i = 0; i < num_pids; i++) {
+            while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR) {
+            }
+        }
+        return exit_status_from_wait(status);
+    }
+
+    job->id = (num_jobs > 0) ? jobs[num_jobs - 1]->id + 1 : 1;
+    job->pgid = pids[0];
+    job->num_procs = num_pids;
+    job->state = JOB_RUNNING;
+    job->command = describe_job(stages, num_stages, is_background);
+    for (int i = 0; i < num_pids; i++) {
+        job->procs[i].pid = pids[i];
+        job->procs[i].status = 0;
+        job->procs[i].state = JOB_RUNNING;
+        // also set in the child, whichever runs first wins the race
+        if (job_control) setpgid(pids[i], job->pgid);
+    }
+    jobs[num_jobs++] = job;
+
+    if (is_background) {
+        if (shell_interactive) {
+            printf("[%d] %d\n", job->id, pids[num_pids - 1]);
+        }
+        return 0;
+    }
+    return wait_foreground(job, 0);
+}
+
+// process group a new process of a job should join: 0 starts a group for the
+// first process, -1 leaves it in the shell's group when there is no job control
+pid_t job_process_group(pid_t first_pid) {
+    if (!job_control) return -1;
+    return (first_pid > 0) ? first_pid : 0;
+}
+
+// reports jobs that finished or stopped since the last prompt and forgets finished ones
+void notify_jobs() {
+    for (int i = 0; i < num_jobs; i++) {
+        struct job *job = jobs[i];
+        if (!job->notify) continue;
+        job->notify = 0;
+        if (job->state == JOB_DONE) {
+            if (shell_interactive) {
+                int status = job_exit_status(job);
+                char text[32];
+                if (status == 0) snprintf(text, sizeof(text), "Done");
+                else if (status > 128) snprintf(text, sizeof(text), "%s", strsignal(status - 128));
+                else snprintf(text, sizeof(text), "Exit %d", status);
+                print_job(job, text);
+            }
+            free_job(job);
+            i--;
+        } else if (job->state == JOB_STOPPED && shell_interactive) {
+            print_job(job, "Stopped");
+        }
+    }
+    fflush(stdout);
+}
+
+// parses a job spec: %N, %+ or %% (current), %- (previous) or %prefix of the command
+// prints an error naming the builtin if there is no such job
+static struct job *parse_job_spec(const char *builtin, const char *spec) {
+    struct job *job = NULL;
+    if (spec == NULL || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%") == 0) {
+        job = (num_jobs > 0) ? jobs[num_jobs - 1] : NULL;
+    } else if (strcmp(spec, "%-") == 0) {
+        job = (num_jobs > 1) ? jobs[num_jobs - 2] : NULL;
+    } else if (spec[0] == '%' && isdigit((unsigned char)spec[1])) {
+        job = find_job_by_id(atoi(spec + 1));
+    } else if (spec[0] == '%') {
+        for (int i = num_jobs - 1; i >= 0 && job == NULL; i--) {
+            if (jobs[i]->command != NULL && strncmp(jobs[i]->command, spec + 1, strlen(spec + 1)) == 0) job = jobs[i];
+        }
+    }
+    if (job == NULL) {
+        fprintf(stderr, "bropesh: %s: %s: no such job\n", builtin, spec != NULL ? spec : "current");
+    }
+    return job;
+}
+
+// jobs [-l]: lists background and stopped jobs
+int builtin_jobs(char **args) {
+    int show_pids = (args[1] != NULL && strcmp(args[1], "-l") == 0);
+    update_jobs();
+    for (int i = 0; i < num_jobs; i++) {
+        struct job *job = jobs[i];
+        const char *state = (job->state == JOB_RUNNING) ? "Running" : (job->state == JOB_STOPPED) ? "Stopped" : "Done";
+        if (show_pids) {
+            printf("[%d]%c %d ", job->id, (i == num_jobs - 1) ? '+' : (i == num_jobs - 2) ? '-' : ' ', (int)job->pgid);
+            printf("%-24s%s\n", state, job->command != NULL ? job->command : "");
+        } else {
+            print_job(job, state);
+        }
+        job->notify = 0;
+    }
+    // finished jobs were just reported
+    for (int i = num_jobs - 1; i >= 0; i--) {
+        if (jobs[i]->state == JOB_DONE) free_job(jobs[i]);
+    }
+    return 0;
+}
+
+// fg [%job]: continues a job in the foreground
+int builtin_fg(char **args) {
+    if (!job_control) {
+        fprintf(stderr, "bropesh: fg: no job control\n");
+        return EXIT_FAILURE;
+    }
+    struct job *job = parse_job_spec("fg", args[1]);
+    if (job == NULL) return EXIT_FAILURE;
+    if (job->command != NULL) {
+        // it runs in the foreground now, drop the " &"
+        size_t len = strlen(job->command);
+        if (len >= 2 && strcmp(job->command + len - 2, " &") == 0) job->command[len - 2] = '\0';
+        printf("%s\n", job->command);
+        fflush(stdout);
+    }
+    return wait_foreground(job, 1);
+}
+
+// bg [%job]: continues a stopped job in the background
+int builtin_bg(char **args) {
+    if (!job_control) {
+        fprintf(stderr, "bropesh: bg: no job control\n");
+        return EXIT_FAILURE;
+    }
+    struct job *job = parse_job_spec("bg", args[1]);
+    if (job == NULL) return EXIT_FAILURE;
+    kill(-job->pgid, SIGCONT);
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].state == JOB_STOPPED) job->procs[i].state = JOB_RUNNING;
+    }
+    job->state = JOB_RUNNING;
+    job->notify = 0;
+    if (job->command != NULL) {
+        size_t len = strlen(job->command);
+        char *command = realloc(job->command, len + 3);
+        if (command != NULL && (len < 2 || strcmp(command + len - 2, " &") != 0)) strcpy(command + len, " &");
+        if (command != NULL) job->command = command;
+    }
+    printf("[%d]+ %s\n", job->id, job->command != NULL ? job->command : "");
+    return 0;
+}
+
+// wait [%job | pid ...]: waits for the given jobs, or all of them
+// returns the exit status of the last one waited for, 130 after ctrl+c
+int builtin_wait(char **args) {
+    int exit_status = 0;
+    sigint_received = 0;
+    foreground_pgid = 0; // the shell itself waits, ctrl+c must not print a prompt
+
+    if (args[1] == NULL) {
+        for (;;) {
+            struct job *running = NULL;
+            for (int i = 0; i < num_jobs && running == NULL; i++) {
+                if (jobs[i]->state == JOB_RUNNING) running = jobs[i];
+            }
+            if (running == NULL) break;
+            if (wait_for_state_change(running, 1) == -1) {
+                exit_status = 130;
+                break;
+            }
+        }
+        // jobs that were waited for are not reported again
+        for (int i = num_jobs - 1; i >= 0; i--) {
+            if (jobs[i]->state == JOB_DONE) free_job(jobs[i]);
+        }
+    }
+    for (int i = 1; args[i] != NULL && exit_status != 130; i++) {
+        struct job *job = NULL;
+        if (args[i][0] == '%') {
+            job = parse_job_spec("wait", args[i]);
+        } else {
+            pid_t pid = atoi(args[i]);
+            for (int j = 0; j < num_jobs && job == NULL; j++) {
+                for (int k = 0; k < jobs[j]->num_procs; k++) {
+                    if (jobs[j]->procs[k].pid == pid) job = jobs[j];
+                }
+            }
+            if (job == NULL) fprintf(stderr, "bropesh: wait: pid %s is not a child of this shell\n", args[i]);
+        }
+        if (job == NULL) {
+            exit_status = 127;
+            continue;
+        }
+        if (wait_for_state_change(job, 1) == -1) {
+            exit_status = 130;
+            break;
+        }
+        exit_status = job_exit_status(job);
+        if (job->state == JOB_DONE) free_job(job);
+    }
+
+    foreground_pgid = -1;
+    return exit_status;
+}
+
+// signal numbers accepted by name in kill -NAME and kill -s NAME
+static const struct {
+    const char *name;
+    int number;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD},
+    {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+};
+
+static int parse_signal(const char *name) {
+    if (isdigit((unsigned char)name[0])) return atoi(name);
+    if (strncmp(name, "SIG", 3) == 0) name += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++) {
+        if (strcmp(name, signal_names[i].name) == 0) return signal_names[i].number;
+    }
+    return -1;
+}
+
+// kill [-SIGNAL | -s SIGNAL] %job | pid ...: signals jobs (their whole process group) or processes
+int builtin_kill(char **args) {
+    int signum = SIGTERM;
+    int i = 1;
+    if (args[i] != NULL && strcmp(args[i], "-s") == 0 && args[i + 1] != NULL) {
+        signum = parse_signal(args[i + 1]);
+        i += 2;
+    } else if (args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0') {
+        signum = parse_signal(args[i] + 1);
+        i++;
+    }
+    if (signum < 0) {
+        fprintf(stderr, "bropesh: kill: %s: invalid signal specification\n", args[i - 1]);
+        return EXIT_FAILURE;
+    }
+    if (args[i] == NULL) {
+        fprintf(stderr, "bropesh: kill: usage: kill [-signal | -s signal] %%job | pid ...\n");
+        return EXIT_FAILURE;
+    }
+
+    int exit_status = 0;
+    for (; args[i] != NULL; i++) {
+        if (args[i][0] == '%') {
+            struct job *job = parse_job_spec("kill", args[i]);
+            if (job == NULL) {
+                exit_status = EXIT_FAILURE;
+                continue;
+            }
+            if (job_control) {
+                if (kill(-job->pgid, signum) == -1) exit_status = EXIT_FAILURE;
+            } else {
+                for (int k = 0; k < job->num_procs; k++) {
+                    if (job->procs[k].state != JOB_DONE) kill(job->procs[k].pid, signum);
+                }
+            }
+            // a stopped job has to be continued to act on the signal
+            if (job_control && job->state == JOB_STOPPED && (signum == SIGTERM || signum == SIGHUP)) {
+                kill(-job->pgid, SIGCONT);
+            }
+        } else {
+            char *end;
+            long pid = strtol(args[i], &end, 10);
+            if (*end != '\0' || end == args[i]) {
+                fprintf(stderr, "bropesh: kill: %s: arguments must be process or job IDs\n", args[i]);
+                exit_status = EXIT_FAILURE;
+            } else if (kill((pid_t)pid, signum) == -1) {
+                fprintf(stderr, "bropesh: kill: (%ld) - %s\n", pid, strerror(errno));
+                exit_status = EXIT_FAILURE;
+            }
+        }
+    }
+    return exit_status;
+}
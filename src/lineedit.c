@@ -0,0 +1,528 @@
+// lineedit.c
+// minimal line editor for interactive input
+// the terminal is put in raw mode only while a line is being typed, so
+// commands always run with the terminal settings they expect. supports cursor
+// movement, the usual emacs-style editing keys, up/down through the in-memory
+// history and ctrl+r reverse-i-search, which asks the on-disk history index
+// (histindex.c) for the next older match on every keystroke instead of
+// scanning the whole history file. tab completes commands and paths from the
+// cached listings of complete.c; a second tab lists the candidates.
+
+#include "shell.h"
+#include <poll.h>      // for poll
+#include <sys/ioctl.h> // for the terminal width
+#include <termios.h>   // for tcgetattr and tcsetattr
+
+#define CTRL_KEY(k) ((k) & 0x1f)
+// more candidates than this are only listed after asking
+#define COMPLETION_LIST_LIMIT 100
+
+// keys that arrive as escape sequences
+enum editor_key {
+    KEY_ESCAPE = 1000,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_JOBS_CHANGED,
+};
+
+// the line being edited, kept between calls so it is only reallocated when it grows
+static char *line = NULL;
+static size_t line_len = 0;
+static size_t line_capacity = 0;
+static size_t cursor = 0;
+
+// output for one redraw, sent with a single write()
+static char *screen = NULL;
+static size_t screen_len = 0;
+static size_t screen_capacity = 0;
+
+static void screen_append(const char *text, size_t len) {
+    if (screen_len + len > screen_capacity) {
+        size_t new_capacity = (screen_capacity == 0) ? 256 : screen_capacity;
+        while (new_capacity < screen_len + len) new_capacity *= 2;
+        char *new_screen = realloc(screen, new_capacity);
+        if (new_screen == NULL) return;
+        screen = new_screen;
+        screen_capacity = new_capacity;
+    }
+    memcpy(screen + screen_len, text, len);
+    screen_len += len;
+}
+
+static void screen_flush() {
+    const char *p = screen;
+    while (screen_len > 0) {
+        ssize_t n = write(STDOUT_FILENO, p, screen_len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        p += n;
+        screen_len -= n;
+    }
+    screen_len = 0;
+}
+
+// makes room for at least len bytes plus the NUL terminator
+static int reserve_line(size_t len) {
+    if (len + 1 <= line_capacity) return 0;
+    size_t new_capacity = (line_capacity == 0) ? 256 : line_capacity;
+    while (new_capacity < len + 1) new_capacity *= 2;
+    char *new_line = realloc(line, new_capacity);
+    if (new_line == NULL) {
+        perror("bropesh: realloc failed for input line");
+        return -1;
+    }
+    line = new_line;
+    line_capacity = new_capacity;
+    return 0;
+}
+
+static void set_line(const char *text) {
+    size_t len = strlen(text);
+    if (reserve_line(len) == -1) return;
+    memcpy(line, text, len + 1);
+    line_len = len;
+    cursor = len;
+}
+
+static void insert_char(char c) {
+    if (reserve_line(line_len + 1) == -1) return;
+    memmove(line + cursor + 1, line + cursor, line_len - cursor + 1);
+    line[cursor++] = c;
+    line_len++;
+}
+
+// deletes the count bytes before the cursor
+static void delete_before_cursor(size_t count) {
+    memmove(line + cursor - count, line + cursor, line_len - cursor + 1);
+    cursor -= count;
+    line_len -= count;
+}
+
+// replaces the text between start and the cursor
+static void replace_before_cursor(size_t start, const char *text) {
+    delete_before_cursor(cursor - start);
+    for (; *text != '\0'; text++) insert_char(*text);
+}
+
+// redraws prompt and line and puts the cursor back in place
+static void refresh_line() {
+    char move[32];
+    screen_append("\r", 1);
+    screen_flush();
+    write_prompt();
+    screen_append(line, line_len);
+    screen_append("\033[K", 3);
+    if (line_len > cursor) {
+        int n = snprintf(move, sizeof(move), "\033[%zuD", line_len - cursor);
+        screen_append(move, n);
+    }
+    screen_flush();
+}
+
+static void refresh_search(const char *query, const char *match, int failed) {
+    screen_append("\r", 1);
+    if (failed) screen_append("(failed ", 8);
+    else screen_append("(", 1);
+    screen_append("reverse-i-search)`", 18);
+    screen_append(query, strlen(query));
+    screen_append("': ", 3);
+    if (match != NULL) screen_append(match, strlen(match));
+    screen_append("\033[K", 3);
+    screen_flush();
+}
+
+// reads one key, decoding the escape sequences of arrows, home, end and delete
+// while waiting, finished background jobs are reaped; KEY_JOBS_CHANGED asks
+// the caller to report them and redraw
+// returns -1 at end of input
+static int read_key() {
+    unsigned char c;
+    ssize_t n;
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sigchld_fd, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, (sigchld_fd != -1) ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents != 0) break;
+        if ((fds[1].revents & POLLIN) && update_jobs()) return KEY_JOBS_CHANGED;
+    }
+    while ((n = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR) {
+    }
+    if (n <= 0) return -1;
+    if (c != '\033') return c;
+
+    // a lone escape is followed by nothing for a moment
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    unsigned char seq[3];
+    if (poll(&pfd, 1, 50) <= 0 || read(STDIN_FILENO, &seq[0], 1) != 1) return KEY_ESCAPE;
+    if (seq[0] != '[' && seq[0] != 'O') return KEY_ESCAPE;
+    if (read(STDIN_FILENO, &seq[1], 1) != 1) return KEY_ESCAPE;
+
+    if (seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, &seq[2], 1) != 1 || seq[2] != '~') return KEY_ESCAPE;
+        switch (seq[1]) {
+            case '1': case '7': return KEY_HOME;
+            case '4': case '8': return KEY_END;
+            case '3': return KEY_DELETE;
+        }
+        return KEY_ESCAPE;
+    }
+    switch (seq[1]) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+    }
+    return KEY_ESCAPE;
+}
+
+// characters a completed word has to be quoted for
+static int needs_quotes(const char *word) {
+    for (; *word != '\0'; word++) {
+        if (isspace((unsigned char)*word) || strchr("|<>&*?[", *word) != NULL) return 1;
+    }
+    return 0;
+}
+
+// prints the candidates in columns below the line, asking first when there are many
+static void list_completions(struct completion *result, size_t dir_len) {
+    write(STDOUT_FILENO, "\r\n", 2);
+    if (result->count > COMPLETION_LIST_LIMIT) {
+        char question[64];
+        int n = snprintf(question, sizeof(question), "display all %d possibilities? (y or n)", result->count);
+        write(STDOUT_FILENO, question, n);
+        int key = read_key();
+        write(STDOUT_FILENO, "\r\n", 2);
+        if (key != 'y' && key != 'Y') return;
+    }
+
+    // candidates are shown without the directory part they share
+    size_t width = 0;
+    for (int i = 0; i < result->count; i++) {
+        size_t len = strlen(result->matches[i] + dir_len);
+        if (len > width) width = len;
+    }
+    width += 2;
+    struct winsize ws;
+    size_t columns = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) columns = ws.ws_col;
+    size_t per_row = (columns / width > 0) ? columns / width : 1;
+    size_t rows = (result->count + per_row - 1) / per_row;
+
+    // filled column by column, like ls
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t column = 0; column < per_row; column++) {
+            size_t i = column * rows + row;
+            if (i >= (size_t)result->count) break;
+            const char *name = result->matches[i] + dir_len;
+            screen_append(name, strlen(name));
+            if ((column + 1) * rows + row < (size_t)result->count) {
+                for (size_t pad = strlen(name); pad < width; pad++) screen_append(" ", 1);
+            }
+        }
+        screen_append("\r\n", 2);
+    }
+    screen_flush();
+}
+
+// completes the word before the cursor, listing the candidates when
+// list_if_ambiguous is set and nothing could be added
+static void complete_at_cursor(int list_if_ambiguous) {
+    // the word starts after the last unquoted space or operator before the cursor
+    size_t start = 0;
+    int in_quote = 0;
+    for (size_t i = 0; i < cursor; i++) {
+        if (line[i] == '"') in_quote = !in_quote;
+        else if (!in_quote && (isspace((unsigned char)line[i]) || strchr("|<>&", line[i]) != NULL)) start = i + 1;
+    }
+    // commands are completed at the start of the line and after a pipe
+    size_t before = start;
+    while (before > 0 && isspace((unsigned char)line[before - 1])) before--;
+    int is_command = (before == 0 || line[before - 1] == '|');
+
+    // the word without its quotes
+    char *word = malloc(cursor - start + 1);
+    if (word == NULL) return;
+    size_t word_len = 0;
+    for (size_t i = start; i < cursor; i++) {
+        if (line[i] != '"') word[word_len++] = line[i];
+    }
+    word[word_len] = '\0';
+
+    struct completion result;
+    if (complete_word(word, is_command, &result) <= 0) {
+        write(STDOUT_FILENO, "\a", 1);
+        free(word);
+        return;
+    }
+
+    // longest prefix every candidate shares
+    size_t common = strlen(result.matches[0]);
+    for (int i = 1; i < result.count; i++) {
+        size_t j = 0;
+        while (j < common && result.matches[i][j] == result.matches[0][j]) j++;
+        common = j;
+    }
+
+    if (common > word_len || result.count == 1) {
+        char *completed = malloc(common + 4);
+        if (completed != NULL) {
+            int finished = (result.count == 1 && result.matches[0][common - 1] != '/');
+            result.matches[0][common] = '\0'; // only the shared part is inserted
+            int quoted = needs_quotes(result.matches[0]);
+            char *p = completed;
+            if (quoted) *p++ = '"';
+            memcpy(p, result.matches[0], common);
+            p += common;
+            if (quoted) *p++ = '"';
+            // a finished word is followed by a space, a directory waits for more
+            if (finished) *p++ = ' ';
+            *p = '\0';
+            replace_before_cursor(start, completed);
+            free(completed);
+        }
+        refresh_line();
+    } else if (list_if_ambiguous) {
+        const char *slash = strrchr(word, '/');
+        list_completions(&result, (slash != NULL) ? (size_t)(slash - word) + 1 : 0);
+        refresh_line();
+    } else {
+        write(STDOUT_FILENO, "\a", 1);
+    }
+    free_completion(&result);
+    free(word);
+}
+
+// prints job notifications on a line of their own, the caller redraws what was being edited
+static void report_jobs() {
+    write(STDOUT_FILENO, "\r\033[K", 4);
+    notify_jobs();
+}
+
+// ctrl+r: searches the history index as the query is typed
+// enter runs the match, ctrl+g or escape restores the line, any other key
+// leaves the match in the line for editing and is then handled normally
+// returns the key that ended the search
+static int reverse_search() {
+    char query[256];
+    size_t query_len = 0;
+    char *match = NULL;
+    long match_record = -1;
+    int failed = 0;
+    char *saved_line = strdup(line);
+
+    query[0] = '\0';
+    refresh_search(query, NULL, 0);
+    for (;;) {
+        int key = read_key();
+        long before;
+
+        if (key == KEY_JOBS_CHANGED) {
+            report_jobs();
+            refresh_search(query, match, failed);
+            continue;
+        } else if (key == CTRL_KEY('r')) {
+            // next older match
+            if (query_len == 0 || match_record <= 0) {
+                failed = (query_len > 0);
+                refresh_search(query, match, failed);
+                continue;
+            }
+            before = match_record;
+        } else if ((key == 127 || key == CTRL_KEY('h')) && query_len > 0) {
+            query[--query_len] = '\0';
+            before = -1;
+        } else if (key >= 32 && key < 127 && query_len + 1 < sizeof(query)) {
+            query[query_len++] = key;
+            query[query_len] = '\0';
+            // the current match is still a candidate for the longer query
+            before = (match_record >= 0) ? match_record + 1 : -1;
+        } else if (key == 127 || key == CTRL_KEY('h') || (key >= 32 && key < 127)) {
+            continue;
+        } else {
+            if (key == CTRL_KEY('g') || key == KEY_ESCAPE) {
+                set_line(saved_line != NULL ? saved_line : "");
+            } else if (match != NULL) {
+                set_line(match);
+            }
+            free(match);
+            free(saved_line);
+            return key;
+        }
+
+        char *found = NULL;
+        long record = (query_len > 0) ? history_search(query, before, &found) : -1;
+        if (record >= 0) {
+            free(match);
+            match = found;
+            match_record = record;
+            failed = 0;
+        } else {
+            failed = (query_len > 0);
+            if (query_len == 0) {
+                free(match);
+                match = NULL;
+                match_record = -1;
+            }
+        }
+        refresh_search(query, match, failed);
+    }
+}
+
+// reads a line from a terminal with getline when raw mode is not available
+static char *read_line_cooked() {
+    static char *buffer = NULL;
+    static size_t capacity = 0;
+    ssize_t n = getline(&buffer, &capacity, stdin);
+    if (n == -1) return NULL;
+    if (n > 0 && buffer[n - 1] == '\n') buffer[n - 1] = '\0';
+    return buffer;
+}
+
+// reads one line from the terminal with editing, the prompt must already be shown
+// returns the line without its newline, or NULL at ctrl+d on an empty line
+// the returned string is only valid until the next call
+char *read_line_interactive() {
+    struct termios original, raw;
+    if (tcgetattr(STDIN_FILENO, &original) == -1) {
+        return read_line_cooked();
+    }
+    raw = original;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG); // ctrl+c is a key while editing
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) {
+        return read_line_cooked();
+    }
+
+    if (reserve_line(0) == -1) {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &original);
+        return NULL;
+    }
+    line[0] = '\0';
+    line_len = 0;
+    cursor = 0;
+    // position while browsing history with up/down, history_count means the new line
+    int browse = history_count;
+    char *edited_line = NULL;
+    int accepted = 1; // 0 when the line is abandoned (ctrl+d, eof, failed search)
+    int previous_key = 0;
+
+    for (;;) {
+        int key = read_key();
+        int repeated_tab = (key == '\t' && previous_key == '\t');
+        if (key != KEY_JOBS_CHANGED) previous_key = key;
+        if (key == CTRL_KEY('r')) {
+            key = reverse_search();
+            if (key == -1) {
+                accepted = 0;
+                break;
+            }
+            refresh_line();
+            if (key == CTRL_KEY('g') || key == KEY_ESCAPE) continue;
+        }
+
+        if (key == KEY_JOBS_CHANGED) {
+            report_jobs();
+        } else if (key == -1) {
+            accepted = (line_len > 0);
+            break;
+        } else if (key == '\r' || key == '\n') {
+            break;
+        } else if (key == CTRL_KEY('d')) {
+            if (line_len == 0) {
+                accepted = 0;
+                break;
+            }
+            if (cursor < line_len) {
+                cursor++;
+                delete_before_cursor(1);
+            }
+        } else if (key == KEY_DELETE) {
+            if (cursor < line_len) {
+                cursor++;
+                delete_before_cursor(1);
+            }
+        } else if (key == CTRL_KEY('c')) {
+            // drop the line and start over, like ctrl+c at a bash prompt
+            write(STDOUT_FILENO, "^C\n", 3);
+            line[0] = '\0';
+            line_len = 0;
+            cursor = 0;
+            browse = history_count;
+        } else if (key == 127 || key == CTRL_KEY('h')) {
+            if (cursor > 0) delete_before_cursor(1);
+        } else if (key == KEY_LEFT || key == CTRL_KEY('b')) {
+            if (cursor > 0) cursor--;
+        } else if (key == KEY_RIGHT || key == CTRL_KEY('f')) {
+            if (cursor < line_len) cursor++;
+        } else if (key == KEY_HOME || key == CTRL_KEY('a')) {
+            cursor = 0;
+        } else if (key == KEY_END || key == CTRL_KEY('e')) {
+            cursor = line_len;
+        } else if (key == CTRL_KEY('u')) {
+            delete_before_cursor(cursor);
+        } else if (key == CTRL_KEY('k')) {
+            line[cursor] = '\0';
+            line_len = cursor;
+        } else if (key == CTRL_KEY('w')) {
+            size_t start = cursor;
+            while (start > 0 && line[start - 1] == ' ') start--;
+            while (start > 0 && line[start - 1] != ' ') start--;
+            delete_before_cursor(cursor - start);
+        } else if (key == CTRL_KEY('l')) {
+            write(STDOUT_FILENO, "\033[H\033[2J", 7);
+        } else if (key == KEY_UP || key == KEY_DOWN) {
+            // walk the in-memory ring, keeping the line that was being typed
+            // slots emptied by repeated commands are skipped
+            if (browse == history_count) {
+                load_history();
+                browse = history_count;
+            }
+            int oldest = (history_count > MAX_HISTORY_SIZE) ? history_count - MAX_HISTORY_SIZE : 0;
+            int step = (key == KEY_UP) ? -1 : 1;
+            int next = browse + step;
+            while (next >= oldest && next < history_count && history_commands[next % MAX_HISTORY_SIZE] == NULL) {
+                next += step;
+            }
+            if (next < oldest || next > history_count) continue;
+            if (browse == history_count) {
+                free(edited_line);
+                edited_line = strdup(line);
+            }
+            browse = next;
+            const char *text = (browse == history_count) ? edited_line : history_commands[browse % MAX_HISTORY_SIZE];
+            set_line(text != NULL ? text : "");
+        } else if (key == '\t') {
+            // redraws by itself, only when something changed
+            complete_at_cursor(repeated_tab);
+            continue;
+        } else if (key >= 32 && key < 256 && key != 127) {
+            insert_char(key);
+            if (cursor == line_len) {
+                // typing at the end of the line only needs the new character echoed
+                char c = key;
+                write(STDOUT_FILENO, &c, 1);
+                continue;
+            }
+        }
+        refresh_line();
+    }
+
+    free(edited_line);
+    write(STDOUT_FILENO, "\n", 1);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &original);
+    // line may have been reallocated while typing, so it is only read here
+    return accepted ? line : NULL;
+}
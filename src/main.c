@@ -3,25 +3,80 @@
 
 #include "shell.h"
 #include <stdio.h>
+#include <time.h> // for clock_gettime
 
 // global variables
 char *home_dir = NULL;
 char *prev_dir = NULL;
-pid_t foreground_child_pid = -1;
 char *history_commands[MAX_HISTORY_SIZE];
 int history_count = 0;
-FILE *history_file_ptr = NULL;
+int shell_interactive = 0;
+int last_exit_status = 0;
+struct arena command_arena = {NULL, NULL, 0};
 
-int main() {
-    char input[MAX_COMMAND_LENGTH];
-    char *trimmed_input;
-    char **args;
-    int num_args;
-    int is_background;
-    char *input_file = NULL;
-    char *output_file = NULL;
+#define MAX_STARTUP_STAGES 16
+
+// --startup-profile: when each stage of startup ended, reported before the first command
+static int startup_profile = 0;
+static struct timespec startup_begin;
+static struct {
+    const char *stage;
+    struct timespec end;
+} startup_stages[MAX_STARTUP_STAGES];
+static int num_startup_stages = 0;
+
+static const char banner[] =
+    "  █████               2023112006 OSA Project              █████        \n"
+    "  ▒▒███                                                   ▒▒███         \n"
+    "   ▒███████  ████████   ██████  ████████   ██████   █████  ▒███████     \n"
+    "   ▒███▒▒███▒▒███▒▒███ ███▒▒███▒▒███▒▒███ ███▒▒███ ███▒▒   ▒███▒▒███    \n"
+    "   ▒███ ▒███ ▒███ ▒▒▒ ▒███ ▒███ ▒███ ▒███▒███████ ▒▒█████  ▒███ ▒███    \n"
+    "   ▒███ ▒███ ▒███     ▒███ ▒███ ▒███ ▒███▒███▒▒▒   ▒▒▒▒███ ▒███ ▒███    \n"
+    "   ████████  █████    ▒▒██████  ▒███████ ▒▒██████  ██████  ████ █████   \n"
+    "  ▒▒▒▒▒▒▒▒  ▒▒▒▒▒      ▒▒▒▒▒▒   ▒███▒▒▒   ▒▒▒▒▒▒  ▒▒▒▒▒▒  ▒▒▒▒ ▒▒▒▒▒    \n"
+    "         \\    /\\                ▒███  -_-_-_-_-_-_-_-_-_-_-_-_-_-_-\n"
+    "          )  ( ')               ████                                   \n"
+    "         (  /  )                ▒▒▒▒  Crafted with ♡ by Gopal Kataria \n"
+    "          \\(__)|      \n\n";
+
+// records the end of a startup stage
+static void startup_mark(const char *stage) {
+    if (!startup_profile || num_startup_stages == MAX_STARTUP_STAGES) return;
+    startup_stages[num_startup_stages].stage = stage;
+    clock_gettime(CLOCK_MONOTONIC, &startup_stages[num_startup_stages].end);
+    num_startup_stages++;
+}
+
+static double microseconds_between(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
 
-    // initialize home directory
+// prints the time spent in each startup stage to stderr, once
+static void print_startup_profile() {
+    if (!startup_profile) return;
+    startup_profile = 0;
+    struct timespec previous = startup_begin;
+    fprintf(stderr, "bropesh: startup profile (microseconds since main)\n");
+    for (int i = 0; i < num_startup_stages; i++) {
+        fprintf(stderr, "  %-20s %10.1f %10.1f\n", startup_stages[i].stage,
+                microseconds_between(previous, startup_stages[i].end),
+                microseconds_between(startup_begin, startup_stages[i].end));
+        previous = startup_stages[i].end;
+    }
+}
+
+// finds the home directory: $HOME when it is set, so most startups skip
+// getpwuid() and the passwd/nss lookup behind it
+static void init_home_dir() {
+    const char *home = get_variable("HOME", 4);
+    if (home != NULL && home[0] == '/') {
+        home_dir = strdup(home);
+        if (home_dir == NULL) {
+            perror("bropesh: failed to allocate memory for home_dir");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
     struct passwd *pw = getpwuid(getuid());
     if (pw != NULL) {
         home_dir = strdup(pw->pw_dir);
@@ -38,6 +93,307 @@ int main() {
             exit(EXIT_FAILURE);
         }
     }
+}
+
+// longest command line accepted: input lines and argument arrays grow as
+// needed, but a line the kernel's ARG_MAX could never exec is refused early
+static size_t max_command_length() {
+    static size_t limit = 0;
+    if (limit == 0) {
+        long arg_max = sysconf(_SC_ARG_MAX);
+        limit = (arg_max > 0) ? (size_t)arg_max : _POSIX_ARG_MAX;
+    }
+    return limit;
+}
+
+// runs one input line: pipeline, builtin or external command
+// returns the exit status, which is also stored in last_exit_status
+int run_command_line(char *line) {
+    char *trimmed_input;
+
+    trimmed_input = trim_whitespace(line);
+    if (strlen(trimmed_input) == 0 || trimmed_input[0] == '#') { // no command or comment (e.g. #!/path/to/bropesh)
+        return last_exit_status;
+    }
+    if (strlen(trimmed_input) >= max_command_length()) {
+        fprintf(stderr, "bropesh: command too long (max %zu characters).\n", max_command_length() - 1);
+        return last_exit_status = EXIT_FAILURE;
+    }
+
+    if (shell_interactive) {
+        // a repeated command replaces its older copy in the history; the history
+        // holds one line per command, so here-document bodies are left out
+        char *newline = strchr(trimmed_input, '\n');
+        if (newline != NULL) *newline = '\0';
+        add_to_history(trimmed_input);
+        if (newline != NULL) *newline = '\n';
+    }
+
+    struct ast_node *root = parse_command_line(trimmed_input);
+    if (root == NULL) {
+        return last_exit_status = EXIT_FAILURE;
+    }
+    int status = execute_ast(root);
+    release_command_line(root);
+    return status;
+}
+
+// runs a parsed line: '&&' and '||' look at the status of their left side, and
+// a pipeline interrupted by ctrl+c stops the rest of the line, like in bash
+int execute_ast(struct ast_node *node) {
+    if (node->type == AST_PIPELINE) {
+        if (node->command->needs_expansion) {
+            // $(...) runs now, after the pipelines before it
+            struct parsed_command expanded;
+            if (expand_pipeline(node->command, &command_arena, &expanded) == -1) return last_exit_status;
+            return execute_parsed_command(&expanded);
+        }
+        return execute_parsed_command(node->command);
+    }
+    if (node->type == AST_FUNCTION) {
+        return last_exit_status = define_function(node->name, node->body);
+    }
+    int status = execute_ast(node->left);
+    if (status == 128 + SIGINT) return status;
+    if ((node->type == AST_AND && status != 0) || (node->type == AST_OR && status == 0)) return status;
+    return execute_ast(node->right);
+}
+
+// runs a tokenized command line: pipeline, builtin or external command
+// returns the exit status, which is also stored in last_exit_status
+int execute_parsed_command(struct parsed_command *cmd) {
+    struct pipeline_stage *stage = &cmd->stages[0];
+    struct command_entry *entry;
+    if (stage->argc > 0 && strcmp(stage->args[0], "time") == 0) {
+        // time is a keyword: it measures the rest of the line, pipelines included
+        last_exit_status = builtin_time(cmd);
+    } else if (cmd->num_stages > 1) {
+        // pipelines (cmd1 | cmd2 | ...) run all their stages together
+        last_exit_status = execute_pipeline(cmd->stages, cmd->num_stages, cmd->is_background);
+    } else if (stage->argc == 0) {
+        // only redirections, nothing to run
+        last_exit_status = EXIT_FAILURE;
+    } else if (is_assignment_list(stage->args) && !cmd->is_background) {
+        // name=value words on their own set shell variables
+        last_exit_status = assign_variables(stage->args);
+    } else if ((entry = find_command(stage->args[0])) != NULL) {
+        // builtins and functions, the one table lookup for every command; they
+        // run in the shell with its own fds redirected while they run; exit
+        // still sees the status of the command before it
+        int saved[3], status = EXIT_FAILURE;
+        if (redirect_builtin(stage, saved) == 0) {
+            status = run_command_entry(entry, stage->args);
+            restore_builtin_redirections(saved);
+        }
+        last_exit_status = status;
+    } else if (is_builtin_util(stage->args) && !cmd->is_background) {
+        // cat, wc, head, tail, true and test without a spawn (--builtin-utils)
+        int saved[3];
+        last_exit_status = EXIT_FAILURE;
+        if (redirect_builtin(stage, saved) == 0) {
+            last_exit_status = run_builtin_util(stage->args);
+            restore_builtin_redirections(saved);
+        }
+        if (last_exit_status == -1) {
+            // reading the terminal: the real program can be interrupted with ctrl+c
+            last_exit_status = execute_external_command(stage, 0);
+        }
+    } else {
+        // external command
+        last_exit_status = execute_external_command(stage, cmd->is_background);
+    }
+    return last_exit_status;
+}
+
+// the last line of bropesh -c replaces the shell when it is a plain external
+// command, so no shell process lingers while it runs
+// returns 1 if the line was dealt with here (it ran, or its error was reported),
+// 0 if it still has to run
+static int exec_final_line(char *line) {
+    struct arena_mark mark = arena_mark(&command_arena);
+
+    char *trimmed_input = trim_whitespace(line);
+    if (strlen(trimmed_input) == 0 || trimmed_input[0] == '#' || strlen(trimmed_input) >= max_command_length()) {
+        return 0;
+    }
+    struct ast_node *root = parse_line(trimmed_input, &command_arena);
+    if (root == NULL) {
+        last_exit_status = EXIT_FAILURE;
+        return 1;
+    }
+
+    // only a lone pipeline, "a; b" or "a && b" still have to come back to the shell
+    struct parsed_command *cmd = root->command, expanded;
+    if (root->type == AST_PIPELINE && cmd->needs_expansion) {
+        if (expand_pipeline(cmd, &command_arena, &expanded) == -1) return 1;
+        cmd = &expanded;
+    }
+    if (root->type == AST_PIPELINE && cmd->num_stages == 1 && cmd->stages[0].argc > 0 && !cmd->is_background &&
+        !is_builtin_command(cmd->stages[0].args[0]) && !is_assignment_list(cmd->stages[0].args)) {
+        exec_external_command(&cmd->stages[0]);
+        // exec failed, report it like a command that could not be started
+        exit(127);
+    }
+    if (cmd == &expanded) {
+        // its $(...) already ran, running the line again would run them twice
+        execute_parsed_command(cmd);
+        return 1;
+    }
+    arena_release(&command_arena, mark);
+    return 0;
+}
+
+// reads the next line of a script or -c string for read_here_documents
+static char *next_batch_line(void *reader) {
+    return input_read_line(reader);
+}
+
+// reads the next line from the terminal for read_here_documents
+static char *next_terminal_line(void *unused) {
+    (void)unused;
+    display_continuation_prompt();
+    return read_line_interactive();
+}
+
+// when line has '<<' here-documents, reads the lines of their bodies with
+// next_line up to each delimiter (or the end of input) and returns line and
+// bodies joined by newlines, malloc'd; returns NULL when there are none
+char *read_here_documents(const char *line, char *(*next_line)(void *), void *source) {
+    if (strstr(line, "<<") == NULL) return NULL;
+    char **delimiters;
+    int count = find_here_delimiters(line, &command_arena, &delimiters);
+    if (count == 0) return NULL;
+
+    size_t len = strlen(line), capacity = len + 256;
+    char *text = malloc(capacity);
+    if (text == NULL) {
+        perror("bropesh: malloc failed for here-document");
+        return NULL;
+    }
+    memcpy(text, line, len + 1);
+    for (int i = 0; i < count; i++) {
+        char *body_line;
+        do {
+            if ((body_line = next_line(source)) == NULL) return text; // the tokenizer warns about it
+            size_t body_len = strlen(body_line);
+            if (len + body_len + 2 > capacity) {
+                capacity = 2 * (len + body_len + 2);
+                char *grown = realloc(text, capacity);
+                if (grown == NULL) {
+                    // the lines read so far are gone from the input, run what there is
+                    perror("bropesh: malloc failed for here-document");
+                    return text;
+                }
+                text = grown;
+            }
+            text[len++] = '\n';
+            memcpy(text + len, body_line, body_len + 1);
+            len += body_len;
+        } while (strcmp(body_line, delimiters[i]) != 0);
+    }
+    return text;
+}
+
+// runs a -c string, a script file or piped stdin without prompt, banner or history
+// returns the exit status of the last command
+static int run_batch(const char *command_string, const char *script_path) {
+    struct input_reader reader;
+    char *line;
+
+    if (command_string != NULL) {
+        input_open_string(&reader, command_string);
+    } else if (script_path != NULL) {
+        int fd = open(script_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "bropesh: %s: %s\n", script_path, strerror(errno));
+            return 127;
+        }
+        if (input_open_fd(&reader, fd) == -1) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    } else if (input_open_fd(&reader, STDIN_FILENO) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    while ((line = input_read_line(&reader)) != NULL) {
+        arena_reset(&command_arena); // one reset per input line
+        // reap finished background jobs so they do not pile up as zombies
+        if (update_jobs()) {
+            notify_jobs();
+        }
+        char *joined = read_here_documents(line, next_batch_line, &reader);
+        if (joined != NULL) line = joined;
+        if (command_string != NULL && input_at_end(&reader) && exec_final_line(line)) {
+            free(joined);
+            continue;
+        }
+        // a command reading a mapped stdin must start right after the current line,
+        // and the script continues after whatever that command consumed
+        off_t offset = input_offset(&reader);
+        if (script_path == NULL && command_string == NULL && offset != -1) {
+            lseek(STDIN_FILENO, offset, SEEK_SET);
+            run_command_line(line);
+            input_seek(&reader, lseek(STDIN_FILENO, 0, SEEK_CUR));
+        } else {
+            run_command_line(line);
+        }
+        free(joined);
+    }
+
+    input_close(&reader);
+    if (script_path != NULL) {
+        close(reader.fd);
+    }
+    return last_exit_status;
+}
+
+int main(int argc, char *argv[]) {
+    char *command_string = NULL;
+    char *script_path = NULL;
+    int quiet = 0, read_rc = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+
+    // command line options
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--spawn=", 8) == 0) {
+            // process-spawn backend: posix_spawn (default), vfork, clone or fork
+            if (set_spawn_backend(argv[i] + 8) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--builtin-utils") == 0) {
+            // cat, wc, head, tail, true, false and test run inside the shell
+            builtin_utils_enabled = 1;
+        } else if (strcmp(argv[i], "--startup-profile") == 0) {
+            startup_profile = 1;
+        } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+            // no banner
+            quiet = 1;
+        } else if (strcmp(argv[i], "--norc") == 0) {
+            read_rc = 0;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && command_string == NULL) {
+            command_string = argv[++i];
+        } else if (argv[i][0] != '-' && script_path == NULL && command_string == NULL) {
+            script_path = argv[i];
+        } else {
+            fprintf(stderr, "bropesh: unknown option \"%s\"\n", argv[i]);
+            fprintf(stderr, "usage: %s [--spawn=posix_spawn|vfork|clone|fork] [--builtin-utils] [-q] [--norc] [--startup-profile] "
+                            "[-c command | script]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // -c, a script file or piped input skip banner, prompt and history entirely
+    shell_interactive = (command_string == NULL && script_path == NULL && isatty(STDIN_FILENO));
+    startup_mark("options");
+
+    // environment variables become exported shell variables
+    init_variables();
+    startup_mark("variables");
+
+    init_home_dir();
+    startup_mark("home directory");
 
     // initialize prev_dir with current directory
     prev_dir = getcwd(NULL, 0);
@@ -48,93 +404,81 @@ int main() {
     for (int i = 0; i < MAX_HISTORY_SIZE; i++) {
         history_commands[i] = NULL;
     }
-    load_history();
+
+    init_commands();
+    init_memo();
+    startup_mark("command table");
 
     // setup signal handlers
     setup_signal_handlers();
-    printf("  █████               2023112006 OSA Project              █████        \n");
-    printf("  ▒▒███                                                   ▒▒███         \n");
-    printf("   ▒███████  ████████   ██████  ████████   ██████   █████  ▒███████     \n");
-    printf("   ▒███▒▒███▒▒███▒▒███ ███▒▒███▒▒███▒▒███ ███▒▒███ ███▒▒   ▒███▒▒███    \n");
-    printf("   ▒███ ▒███ ▒███ ▒▒▒ ▒███ ▒███ ▒███ ▒███▒███████ ▒▒█████  ▒███ ▒███    \n");
-    printf("   ▒███ ▒███ ▒███     ▒███ ▒███ ▒███ ▒███▒███▒▒▒   ▒▒▒▒███ ▒███ ▒███    \n");
-    printf("   ████████  █████    ▒▒██████  ▒███████ ▒▒██████  ██████  ████ █████   \n");
-    printf("  ▒▒▒▒▒▒▒▒  ▒▒▒▒▒      ▒▒▒▒▒▒   ▒███▒▒▒   ▒▒▒▒▒▒  ▒▒▒▒▒▒  ▒▒▒▒ ▒▒▒▒▒    \n");
-    printf("         \\    /\\                ▒███  -_-_-_-_-_-_-_-_-_-_-_-_-_-_-\n");
-    printf("          )  ( ')               ████                                   \n");
-    printf("         (  /  )                ▒▒▒▒  Crafted with ♡ by Gopal Kataria \n");
-    printf("          \\(__)|      \n\n") ;
+    init_jobs();
+    startup_mark("signals and jobs");
 
+    // ~/.bropeshrc for interactive shells, $BROPESH_ENV for the others
+    const char *rc_path = NULL;
+    char default_rc[PATH_MAX];
+    if (shell_interactive) {
+        rc_path = get_variable("BROPESH_RC", 10);
+        if (rc_path == NULL && snprintf(default_rc, sizeof(default_rc), "%s%s", home_dir, RC_FILE_NAME) < (int)sizeof(default_rc)) {
+            rc_path = default_rc;
+        }
+    } else {
+        rc_path = get_variable("BROPESH_ENV", 11);
+    }
+    if (read_rc && rc_path != NULL && rc_path[0] != '\0') {
+        // copied: the rc file may change the variable it came from
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", rc_path);
+        int loaded = load_rc_file(path);
+        startup_mark((loaded == 1) ? "rc file (snapshot)" : (loaded == 0) ? "rc file" : "rc file (none)");
+    }
 
+    if (!shell_interactive) {
+        print_startup_profile();
+        int status = run_batch(command_string, script_path);
+        free(home_dir);
+        free(prev_dir);
+        return status;
+    }
 
+    // loaded by the first command (or history, or the arrow keys) instead
+    enable_history();
+    if (!quiet) {
+        fputs(banner, stdout);
+        startup_mark("banner");
+    }
 
     while (1) {
+        // finished and stopped jobs are reported before the prompt, never in the middle of it
+        update_jobs();
+        notify_jobs();
         display_prompt();
+        if (startup_profile) {
+            startup_mark("first prompt");
+            print_startup_profile();
+        }
 
-        if (fgets(input, MAX_COMMAND_LENGTH, stdin) == NULL) {
+        char *input = read_line_interactive();
+        if (input == NULL) {
             // handle ctrl+d (end of file)
             handle_ctrl_d();
             break; // exit loop if ctrl+d detected
         }
 
-        // remove trailing newline character
-        input[strcspn(input, "\n")] = 0;
-
-        trimmed_input = trim_whitespace(input);
-        if (strlen(trimmed_input) == 0) { // no command case
-            continue;
-        }
-
-        // do not store duplicate consecutive commands in history
-        int last_command_idx = (history_count > 0) ? ((history_count - 1 + MAX_HISTORY_SIZE) % MAX_HISTORY_SIZE) : -1;
-
-        if (last_command_idx != -1 && history_commands[last_command_idx] != NULL && strcmp(history_commands[last_command_idx], trimmed_input) == 0) {
-            //  duplicate command, do not add to history
-        } else {
-            add_to_history(trimmed_input);
-        }
-
-        input_file = NULL;
-        output_file = NULL;
-        args = tokenize_input(trimmed_input, &num_args, &is_background, &input_file, &output_file);
-
-        if (num_args == 0) { // tokenization failed
-            // free redirection filenames
-            if (input_file) free(input_file);
-            if (output_file) free(output_file);
-            if (args) free(args); // free the outer array if no tokens
-            continue;
-        }
-
-        // built-in commands
-        if (execute_builtin_command(args)) {
-        } else {
-            // external command
-            execute_external_command(args, is_background, input_file, output_file);
-            // redirection file names are freed within execute_external_command,
-            // so set them to null and prevent double free.
-            input_file = NULL;
-            output_file = NULL;
-        }
-
-        free_tokens(args); // free memory of arguments
+        arena_reset(&command_arena); // one reset per input line
+        char *joined = read_here_documents(input, next_terminal_line, NULL);
+        run_command_line((joined != NULL) ? joined : input);
+        free(joined);
     }
 
-    save_history(); // save history to file
+    free_history(); // write pending history records and free memory
+    free_parse_cache();
     if (home_dir != NULL) {
         free(home_dir);
     }
     if (prev_dir != NULL) {
         free(prev_dir);
     }
-    for (int i = 0; i < MAX_HISTORY_SIZE; i++) {
-        if (history_commands[i] != NULL) {
-            free(history_commands[i]);
-        }
-    }
-    if (history_file_ptr != NULL) {
-        fclose(history_file_ptr);
-    }
 
     return 0;
 }
@@ -0,0 +1,475 @@
+// memo.c
+// the memo builtin: runs a command once and replays its results afterwards
+//   memo [-d file]... [-e name]... cmd [args...]
+//   memo -c                                      empties the cache
+// a run is keyed by a 128-bit hash of its argv, the working directory, the
+// executable PATH resolves to, LANG, LC_ALL and the -e variables, and the
+// fingerprint (device, inode, size, mtime, ctime) of the '<' input file, of the
+// executable and of every -d dependency (here-documents by their text). a
+// command without input redirected for it reads /dev/null, not the shell's own
+// stdin (the terminal, a script, a pipe into bropesh), so it is cached too. a hit replays the stored stdout,
+// stderr and exit status without spawning anything. the cache lives in
+// $XDG_CACHE_HOME/bropesh/memo (~/.cache/bropesh/memo) and is content
+// addressed: keys/<key> names the blobs/<hash> files holding the outputs, so
+// runs with the same output share one copy, and every file is written to a
+// temporary name and renamed into place so concurrent shells never see half
+// of one. hits refresh the mtime of their key; once the blobs grow past
+// BROPESH_MEMO_SIZE MiB (default 256) the least recently used keys and the
+// blobs no key names anymore are removed. runs reading a pipe cannot be
+// fingerprinted (a notice says so) and runs killed by a signal may be
+// incomplete, neither is stored.
+
+#include "shell.h"
+#include <dirent.h>       // for fdopendir
+#include <stdint.h>       // for uint64_t
+#include <sys/mman.h>     // for memfd_create and the memfd seals
+#include <sys/stat.h>     // for fstatat, mkdir, utimensat
+
+#define MEMO_DEFAULT_SIZE_MB 256
+// 32 hex digits and a NUL
+#define MEMO_NAME_SIZE 33
+
+struct memo_hash {
+    uint64_t a; // fnv-1a
+    uint64_t b; // multiply and xorshift, so a collision has to hit both
+};
+
+// the shell's own stdin, recorded by init_memo before any redirection
+static struct stat shell_stdin;
+static int shell_stdin_known = 0;
+
+// a key or blob found while evicting
+struct memo_file {
+    char name[MEMO_NAME_SIZE];
+    off_t size;
+    struct timespec used;             // mtime, the last hit of a key
+    char blobs[2][MEMO_NAME_SIZE];    // keys: the stdout and stderr blobs
+    int refs;                         // blobs: keys still naming them
+};
+
+static void hash_init(struct memo_hash *h) {
+    h->a = 0xcbf29ce484222325ULL;
+    h->b = 0x6a09e667f3bcc909ULL;
+}
+
+static void hash_bytes(struct memo_hash *h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h->a = (h->a ^ p[i]) * 0x100000001b3ULL;
+        h->b = (h->b ^ p[i]) * 0x9e3779b97f4a7c15ULL;
+        h->b ^= h->b >> 29;
+    }
+}
+
+// hashes a length-prefixed string, so "ab" "c" and "a" "bc" differ (NULL for unset)
+static void hash_field(struct memo_hash *h, const char *text) {
+    uint64_t len = (text != NULL) ? strlen(text) : UINT64_MAX;
+    hash_bytes(h, &len, sizeof(len));
+    if (text != NULL) hash_bytes(h, text, len);
+}
+
+// hashes what identifies a version of a file
+static void hash_stat(struct memo_hash *h, const struct stat *st) {
+    char text[160];
+    snprintf(text, sizeof(text), "%llu %llu %lld %lld.%09ld %lld.%09ld", (unsigned long long)st->st_dev,
+             (unsigned long long)st->st_ino, (long long)st->st_size, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+             (long long)st->st_ctim.tv_sec, st->st_ctim.tv_nsec);
+    hash_field(h, text);
+}
+
+// hashes everything in fd from offset 0, returns 0 or -1
+static int hash_contents(struct memo_hash *h, int fd) {
+    char buffer[65536];
+    ssize_t n;
+    off_t offset = 0;
+    while ((n = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        hash_bytes(h, buffer, n);
+        offset += n;
+    }
+    return (n == -1) ? -1 : 0;
+}
+
+static void hash_file_state(struct memo_hash *h, const char *path) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        hash_stat(h, &st);
+    } else {
+        hash_field(h, "missing");
+    }
+}
+
+static void hash_name(const struct memo_hash *h, char name[MEMO_NAME_SIZE]) {
+    snprintf(name, MEMO_NAME_SIZE, "%016llx%016llx", (unsigned long long)h->a, (unsigned long long)h->b);
+}
+
+static int is_hash_name(const char *name) {
+    size_t len = strspn(name, "0123456789abcdef");
+    return len == MEMO_NAME_SIZE - 1 && name[len] == '\0';
+}
+
+// the size bound of the blobs in bytes
+static off_t memo_size_limit() {
+    const char *text = getenv("BROPESH_MEMO_SIZE");
+    char *end;
+    long mb = (text != NULL) ? strtol(text, &end, 10) : 0;
+    if (text == NULL || *text == '\0' || *end != '\0' || mb <= 0) mb = MEMO_DEFAULT_SIZE_MB;
+    return (off_t)mb * 1024 * 1024;
+}
+
+// creates the cache directory with keys/ and blobs/ if needed, returns an fd for it or -1
+static int open_memo_dir() {
+    int dir_fd = open_cache_dir("memo", 1);
+    if (dir_fd == -1) return -1;
+    if ((mkdirat(dir_fd, "keys", 0700) == -1 && errno != EEXIST) ||
+        (mkdirat(dir_fd, "blobs", 0700) == -1 && errno != EEXIST)) {
+        close(dir_fd);
+        return -1;
+    }
+    return dir_fd;
+}
+
+// opens the blob name in the cache, -1 if it is gone
+static int open_blob(int dir_fd, const char *name) {
+    char path[16 + MEMO_NAME_SIZE];
+    snprintf(path, sizeof(path), "blobs/%s", name);
+    return openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+}
+
+// reads the key file at path: the exit status and the names of the two blobs
+// returns 0, or -1 if there is no such key or it is damaged
+static int read_key(int dir_fd, const char *path, int *status, char blobs[2][MEMO_NAME_SIZE]) {
+    char record[128];
+    int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, record, sizeof(record) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    record[n] = '\0';
+    if (sscanf(record, "%d %32s %32s", status, blobs[0], blobs[1]) != 3) return -1;
+    return (is_hash_name(blobs[0]) && is_hash_name(blobs[1])) ? 0 : -1;
+}
+
+// writes the stored outputs of key to stdout and stderr, returns the stored
+// exit status, or -1 if nothing (complete) is stored
+static int replay(int dir_fd, const char *key) {
+    char path[16 + MEMO_NAME_SIZE], blobs[2][MEMO_NAME_SIZE];
+    int status;
+    snprintf(path, sizeof(path), "keys/%s", key);
+    if (read_key(dir_fd, path, &status, blobs) == -1) return -1;
+
+    // both outputs are opened before writing anything, an evicted blob makes it a miss
+    int out_fd = open_blob(dir_fd, blobs[0]);
+    int err_fd = (out_fd != -1) ? open_blob(dir_fd, blobs[1]) : -1;
+    if (err_fd == -1) {
+        if (out_fd != -1) close(out_fd);
+        return -1;
+    }
+    fflush(stdout);
+    copy_fd_to_fd(out_fd, STDOUT_FILENO, 0);
+    copy_fd_to_fd(err_fd, STDERR_FILENO, 0);
+    close(out_fd);
+    close(err_fd);
+    // the mtime of a key is its last use, for eviction
+    utimensat(dir_fd, path, NULL, 0);
+    return status;
+}
+
+// stores the contents of fd as a blob named by their hash, returns 0 or -1
+static int store_blob(int dir_fd, int fd, char name[MEMO_NAME_SIZE]) {
+    struct memo_hash h;
+    char path[16 + MEMO_NAME_SIZE], tmp[64];
+    hash_init(&h);
+    if (hash_contents(&h, fd) == -1) return -1;
+    hash_name(&h, name);
+
+    snprintf(path, sizeof(path), "blobs/%s", name);
+    if (faccessat(dir_fd, path, F_OK, 0) == 0) return 0; // another run had the same output
+    int tmp_fd = create_temp_file(dir_fd, tmp, sizeof(tmp));
+    if (tmp_fd == -1) return -1;
+    return install_temp_file(dir_fd, tmp_fd, tmp, path, copy_fd_to_fd(fd, tmp_fd, 0) == 0);
+}
+
+// stores a finished run under key, returns 0 or -1
+static int store_run(int dir_fd, const char *key, int out_fd, int err_fd, int status) {
+    char blobs[2][MEMO_NAME_SIZE], path[16 + MEMO_NAME_SIZE], tmp[64];
+    if (store_blob(dir_fd, out_fd, blobs[0]) == -1 || store_blob(dir_fd, err_fd, blobs[1]) == -1) return -1;
+    int fd = create_temp_file(dir_fd, tmp, sizeof(tmp));
+    if (fd == -1) return -1;
+    snprintf(path, sizeof(path), "keys/%s", key);
+    return install_temp_file(dir_fd, fd, tmp, path, dprintf(fd, "%d %s %s\n", status, blobs[0], blobs[1]) > 0);
+}
+
+// lists the hash-named files of the subdirectory sub, returns their number or -1
+static int list_files(int dir_fd, const char *sub, struct memo_file **files) {
+    int fd = openat(dir_fd, sub, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd != -1) ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    struct stat st;
+    *files = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_hash_name(entry->d_name) || fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct memo_file *grown = realloc(*files, capacity * sizeof(struct memo_file));
+            if (grown == NULL) {
+                free(*files);
+                closedir(dir);
+                return -1;
+            }
+            *files = grown;
+        }
+        struct memo_file *file = &(*files)[count++];
+        memcpy(file->name, entry->d_name, MEMO_NAME_SIZE);
+        file->size = st.st_size;
+        file->used = st.st_mtim;
+        file->refs = 0;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const struct memo_file *)a)->name, ((const struct memo_file *)b)->name);
+}
+
+static int compare_used(const void *a, const void *b) {
+    const struct timespec *x = &((const struct memo_file *)a)->used, *y = &((const struct memo_file *)b)->used;
+    if (x->tv_sec != y->tv_sec) return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+static struct memo_file *find_blob(struct memo_file *blobs, int num_blobs, const char *name) {
+    struct memo_file probe;
+    memcpy(probe.name, name, MEMO_NAME_SIZE);
+    return bsearch(&probe, blobs, num_blobs, sizeof(struct memo_file), compare_names);
+}
+
+static void remove_file(int dir_fd, const char *sub, const char *name) {
+    char path[16 + MEMO_NAME_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", sub, name);
+    unlinkat(dir_fd, path, 0);
+}
+
+// removes blobs no key names and then the least recently used keys (and the
+// blobs only they named) until the blobs take at most 3/4 of limit, so the
+// next few stores do not have to evict again
+static void evict(int dir_fd, off_t limit) {
+    struct memo_file *blobs, *keys;
+    int num_blobs = list_files(dir_fd, "blobs", &blobs);
+    if (num_blobs <= 0) return;
+    off_t total = 0;
+    for (int i = 0; i < num_blobs; i++) total += blobs[i].size;
+    int num_keys = (total > limit) ? list_files(dir_fd, "keys", &keys) : -1;
+    if (num_keys == -1) {
+        free(blobs);
+        return;
+    }
+
+    qsort(blobs, num_blobs, sizeof(struct memo_file), compare_names);
+    for (int i = 0; i < num_keys; i++) {
+        char path[16 + MEMO_NAME_SIZE];
+        int status;
+        snprintf(path, sizeof(path), "keys/%s", keys[i].name);
+        if (read_key(dir_fd, path, &status, keys[i].blobs) == -1) {
+            keys[i].blobs[0][0] = keys[i].blobs[1][0] = '\0';
+            continue;
+        }
+        for (int j = 0; j < 2; j++) {
+            struct memo_file *blob = find_blob(blobs, num_blobs, keys[i].blobs[j]);
+            if (blob != NULL) blob->refs++;
+        }
+    }
+    for (int i = 0; i < num_blobs; i++) {
+        if (blobs[i].refs == 0) {
+            remove_file(dir_fd, "blobs", blobs[i].name);
+            total -= blobs[i].size;
+        }
+    }
+
+    if (num_keys > 1) qsort(keys, num_keys, sizeof(struct memo_file), compare_used);
+    for (int i = 0; i < num_keys && total > limit / 4 * 3; i++) {
+        remove_file(dir_fd, "keys", keys[i].name);
+        for (int j = 0; j < 2; j++) {
+            struct memo_file *blob = find_blob(blobs, num_blobs, keys[i].blobs[j]);
+            if (blob != NULL && blob->refs > 0 && --blob->refs == 0) {
+                remove_file(dir_fd, "blobs", blob->name);
+                total -= blob->size;
+            }
+        }
+    }
+    free(keys);
+    free(blobs);
+}
+
+// memo -c: removes every key and blob, returns the exit status
+static int clear_cache(int dir_fd) {
+    const char *subs[] = {"keys", "blobs"};
+    for (int i = 0; i < 2; i++) {
+        struct memo_file *files;
+        int count = list_files(dir_fd, subs[i], &files);
+        if (count == -1) {
+            perror("bropesh: memo: cannot read the cache");
+            return 1;
+        }
+        for (int j = 0; j < count; j++) remove_file(dir_fd, subs[i], files[j].name);
+        free(files);
+    }
+    return 0;
+}
+
+// runs the command with its stdout and stderr collected in out_fd and err_fd and
+// stdin from in_fd (-1: the shell's), returns its exit status (127 if it could not be started)
+static int run_collected(char **args, int argc, int in_fd, int out_fd, int err_fd) {
+    struct pipeline_stage stage;
+    struct spawn_request req;
+    memset(&stage, 0, sizeof(stage));
+    stage.args = args;
+    stage.argc = argc;
+    req.args = args;
+    req.stdin_fd = in_fd;
+    req.stdout_fd = out_fd;
+    req.stderr_fd = err_fd;
+    req.pgid = job_process_group(0);
+    pid_t pid = spawn_process(&req);
+    if (pid == -1) return 127;
+    // a job like any other: ctrl+c and ctrl+z reach it, jobs lists it when stopped
+    return launch_job(&pid, 1, &stage, 1, 0);
+}
+
+static int memo_usage() {
+    fprintf(stderr, "bropesh: memo: usage: memo [-d file]... [-e name]... cmd [args...] | memo -c\n");
+    return 2;
+}
+
+void init_memo() {
+    shell_stdin_known = (fstat(STDIN_FILENO, &shell_stdin) == 0);
+}
+
+int builtin_memo(char **args) {
+    struct memo_hash h;
+    int i = 1, clear = 0;
+
+    hash_init(&h);
+    hash_field(&h, "bropesh-memo 1");
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-c") == 0) {
+            clear = 1;
+        } else if ((strcmp(args[i], "-d") == 0 || strcmp(args[i], "-e") == 0) && args[i + 1] != NULL) {
+            // options are hashed in the order given
+            hash_field(&h, args[i]);
+            hash_field(&h, args[i + 1]);
+            if (args[i][1] == 'd') {
+                hash_file_state(&h, args[i + 1]);
+            } else {
+                hash_field(&h, getenv(args[i + 1]));
+            }
+            i++;
+        } else {
+            return memo_usage();
+        }
+    }
+
+    if (clear) {
+        int dir_fd = open_memo_dir();
+        if (dir_fd == -1) {
+            perror("bropesh: memo: cannot open the cache");
+            return 1;
+        }
+        int status = clear_cache(dir_fd);
+        close(dir_fd);
+        return status;
+    }
+    if (args[i] == NULL) return memo_usage();
+    if (is_builtin_command(args[i])) {
+        fprintf(stderr, "bropesh: memo: %s: builtins cannot be memoized\n", args[i]);
+        return 2;
+    }
+    const char *path = resolve_command_path(args[i]);
+    if (path == NULL) {
+        fprintf(stderr, "bropesh: %s: command not found\n", args[i]);
+        return 127;
+    }
+
+    int argc = 0;
+    hash_field(&h, "argv");
+    for (; args[i + argc] != NULL; argc++) hash_field(&h, args[i + argc]);
+    char cwd[PATH_MAX];
+    hash_field(&h, getcwd(cwd, sizeof(cwd)));
+    hash_field(&h, path);
+    hash_file_state(&h, path);
+    hash_field(&h, getenv("LANG"));
+    hash_field(&h, getenv("LC_ALL"));
+
+    // a '<' file is part of the key and a here-document's text too; a pipe
+    // cannot be fingerprinted without reading it; devices are not treated as input
+    struct stat st;
+    int cacheable = 1, in_fd = -1;
+    if (fstat(STDIN_FILENO, &st) == -1 ||
+        (shell_stdin_known && st.st_dev == shell_stdin.st_dev && st.st_ino == shell_stdin.st_ino)) {
+        // nothing was redirected for the command, the shell's input is not its input
+        in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    } else if (S_ISREG(st.st_mode) && fcntl(STDIN_FILENO, F_GET_SEALS) > 0) {
+        // a here-document or here-string, a new memfd every time
+        hash_field(&h, "stdin-data");
+        if (hash_contents(&h, STDIN_FILENO) == -1) cacheable = 0;
+    } else if (S_ISREG(st.st_mode)) {
+        hash_field(&h, "stdin");
+        hash_stat(&h, &st);
+    } else if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "bropesh: memo: running uncached: stdin is a pipe\n");
+        cacheable = 0;
+    }
+
+    char key[MEMO_NAME_SIZE];
+    hash_name(&h, key);
+    int dir_fd = cacheable ? open_memo_dir() : -1;
+    if (cacheable && dir_fd == -1) perror("bropesh: memo: cannot open the cache, running uncached");
+    if (dir_fd != -1) {
+        int status = replay(dir_fd, key);
+        if (status != -1) {
+            close(dir_fd);
+            if (in_fd != -1) close(in_fd);
+            return status;
+        }
+    }
+
+    int out_fd = memfd_create("memo-stdout", MFD_CLOEXEC);
+    int err_fd = memfd_create("memo-stderr", MFD_CLOEXEC);
+    if (out_fd == -1 || err_fd == -1) {
+        perror("bropesh: memo: memfd_create failed");
+        if (out_fd != -1) close(out_fd);
+        if (dir_fd != -1) close(dir_fd);
+        if (in_fd != -1) close(in_fd);
+        return 1;
+    }
+    int status = run_collected(args + i, argc, in_fd, out_fd, err_fd);
+    if (in_fd != -1) close(in_fd);
+    fflush(stdout);
+    copy_fd_to_fd(out_fd, STDOUT_FILENO, 0);
+    copy_fd_to_fd(err_fd, STDERR_FILENO, 0);
+
+    // 127 is a command that could not start, from 128 on it was killed or
+    // stopped by a signal; outputs too big for the cache are not stored either
+    off_t limit = memo_size_limit();
+    struct stat out_st, err_st;
+    if (dir_fd != -1 && status < 127 && fstat(out_fd, &out_st) == 0 && fstat(err_fd, &err_st) == 0 &&
+        out_st.st_size + err_st.st_size <= limit / 2) {
+        if (store_run(dir_fd, key, out_fd, err_fd, status) == -1) {
+            perror("bropesh: memo: cannot store the result");
+        } else {
+            evict(dir_fd, limit);
+        }
+    }
+    close(out_fd);
+    close(err_fd);
+    if (dir_fd != -1) close(dir_fd);
+    return status;
+}
@@ -0,0 +1,257 @@
+// parallel.c
+// the parallel builtin: runs one command per input across a fixed number of slots
+//   parallel [-j N] command [args with {}] ::: input...
+//   producer | parallel [-j N] command [args with {}]
+// every input becomes one job, {} in the arguments is replaced by it (or it is
+// appended when there is no {}). dispatch is dynamic: whichever slot frees up
+// first takes the next input, so a few slow jobs never leave the other slots
+// idle the way a static split of the inputs would. N defaults to the number of
+// cpus the shell may run on (sched_getaffinity), not the number installed.
+// each job writes its stdout and stderr into memfds that are copied out when
+// it finishes, so the output of concurrent jobs never interleaves. the exit
+// status is the number of failed jobs (101 for more than 100), like GNU parallel.
+
+#include "shell.h"
+#include <sched.h>        // for sched_getaffinity
+#include <sys/mman.h>     // for memfd_create
+
+// the job running in one slot
+struct parallel_slot {
+    pid_t pid;     // 0 while the slot is free
+    int out_fd;    // memfd collecting the job's stdout
+    int err_fd;    // memfd collecting the job's stderr
+};
+
+// number of cpus the shell is allowed to run on
+static int available_cpus() {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return (online > 0) ? (int)online : 1;
+}
+
+// copies everything fd collected to target and empties fd for the next job
+static void flush_output(int fd, int target) {
+    // a job whose output cannot be written (e.g. a closed pipe) loses only that output
+    copy_fd_to_fd(fd, target, 0);
+    // the job's writes moved the shared offset, the next job starts at 0 again
+    if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1) perror("bropesh: parallel: reset of job output failed");
+}
+
+// substitutes input for every {} in arg, returns a malloc'd copy
+static char *replace_braces(const char *arg, const char *input) {
+    size_t count = 0;
+    for (const char *p = strstr(arg, "{}"); p != NULL; p = strstr(p + 2, "{}")) count++;
+    size_t input_len = strlen(input);
+    char *result = malloc(strlen(arg) + count * input_len + 1);
+    if (result == NULL) return NULL;
+
+    char *out = result;
+    const char *p = arg;
+    for (const char *brace = strstr(p, "{}"); brace != NULL; brace = strstr(p, "{}")) {
+        memcpy(out, p, brace - p);
+        out += brace - p;
+        memcpy(out, input, input_len);
+        out += input_len;
+        p = brace + 2;
+    }
+    strcpy(out, p);
+    return result;
+}
+
+// builds the arguments of one job and starts it in slot
+// returns 0 if it runs, -1 if it could not be started
+static int start_job(struct parallel_slot *slot, char **command, int num_args, int has_braces, const char *input,
+                     int null_fd) {
+    char **args = calloc(num_args + 2, sizeof(char *));
+    int failed = (args == NULL);
+    for (int i = 0; i < num_args && !failed; i++) {
+        args[i] = replace_braces(command[i], input);
+        failed = (args[i] == NULL);
+    }
+    if (!failed && !has_braces) {
+        args[num_args] = strdup(input);
+        failed = (args[num_args] == NULL);
+    }
+
+    pid_t pid = -1;
+    if (failed) {
+        perror("bropesh: parallel: malloc failed for job arguments");
+    } else {
+        struct spawn_request req;
+        req.args = args;
+        req.stdin_fd = null_fd;
+        req.stdout_fd = slot->out_fd;
+        req.stderr_fd = slot->err_fd;
+        req.pgid = -1; // ctrl+c from the terminal reaches every job
+        pid = spawn_process(&req);
+    }
+
+    if (args != NULL) {
+        for (int i = 0; i <= num_args; i++) free(args[i]);
+        free(args);
+    }
+    slot->pid = (pid > 0) ? pid : 0;
+    return (pid > 0) ? 0 : -1;
+}
+
+// waits for one of the slots' jobs to finish, children of other jobs that
+// change state meanwhile are handed to the job table
+// returns the finished slot, or NULL if no job is running
+static struct parallel_slot *wait_for_slot(struct parallel_slot *slots, int num_slots, int *status) {
+    for (;;) {
+        struct rusage usage;
+        pid_t pid = wait4(-1, status, WUNTRACED, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        for (int i = 0; i < num_slots; i++) {
+            if (slots[i].pid != pid) continue;
+            if (WIFSTOPPED(*status)) {
+                // jobs share the shell's process group and cannot be suspended on their own
+                kill(pid, SIGCONT);
+                break;
+            }
+            add_foreground_usage(&usage);
+            slots[i].pid = 0;
+            return &slots[i];
+        }
+        mark_process_status(pid, *status, &usage);
+    }
+}
+
+// parallel [-j N] command [args] [::: inputs]: runs command once per input, N at a time
+int builtin_parallel(char **args) {
+    int num_slots = 0;
+    int first = 1;
+
+    while (args[first] != NULL && args[first][0] == '-') {
+        if (strncmp(args[first], "-j", 2) == 0 && (args[first][2] != '\0' || args[first + 1] != NULL)) {
+            // -j N or -jN
+            const char *value = (args[first][2] != '\0') ? args[first] + 2 : args[++first];
+            char *end;
+            long n = strtol(value, &end, 10);
+            if (*end != '\0' || n < 1 || n > 4096) {
+                fprintf(stderr, "bropesh: parallel: %s: invalid number of jobs\n", value);
+                return 2;
+            }
+            num_slots = (int)n;
+            first++;
+        } else if (strcmp(args[first], "--") == 0) {
+            first++;
+            break;
+        } else {
+            fprintf(stderr, "bropesh: parallel: %s: invalid option\n", args[first]);
+            fprintf(stderr, "bropesh: parallel: usage: parallel [-j N] command [args] [::: inputs]\n");
+            return 2;
+        }
+    }
+
+    char **command = &args[first];
+    int num_args = 0;
+    int has_braces = 0;
+    while (command[num_args] != NULL && strcmp(command[num_args], ":::") != 0) {
+        if (strstr(command[num_args], "{}") != NULL) has_braces = 1;
+        num_args++;
+    }
+    if (num_args == 0) {
+        fprintf(stderr, "bropesh: parallel: usage: parallel [-j N] command [args] [::: inputs]\n");
+        return 2;
+    }
+    if (resolve_command_path(command[0]) == NULL) {
+        fprintf(stderr, "bropesh: parallel: %s: command not found\n", command[0]);
+        return 127;
+    }
+    // inputs follow ":::", otherwise they are the lines of stdin
+    char **inputs = (command[num_args] != NULL) ? &command[num_args + 1] : NULL;
+    struct input_reader reader;
+    if (inputs == NULL && input_open_fd(&reader, STDIN_FILENO) == -1) return 1;
+
+    if (num_slots == 0) num_slots = available_cpus();
+    struct parallel_slot *slots = calloc(num_slots, sizeof(struct parallel_slot));
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (slots == NULL || null_fd == -1) {
+        perror("bropesh: parallel: setup failed");
+        free(slots);
+        if (null_fd != -1) close(null_fd);
+        if (inputs == NULL) input_close(&reader);
+        return 1;
+    }
+    for (int i = 0; i < num_slots; i++) {
+        slots[i].out_fd = -1;
+        slots[i].err_fd = -1;
+    }
+
+    // the shell waits itself: ctrl+c stops the dispatch without redrawing the prompt
+    fflush(stdout);
+    foreground_pgid = 0;
+    sigint_received = 0;
+
+    int failures = 0;
+    int running = 0;
+    int input_index = 0;
+    int exhausted = 0;
+    struct parallel_slot *free_slot = NULL;
+    for (;;) {
+        // fill every free slot before waiting
+        while (!exhausted && !sigint_received && running < num_slots) {
+            const char *input = (inputs != NULL) ? inputs[input_index++] : input_read_line(&reader);
+            if (input == NULL) {
+                exhausted = 1;
+                break;
+            }
+            if (free_slot == NULL) {
+                for (int i = 0; i < num_slots && free_slot == NULL; i++) {
+                    if (slots[i].pid == 0) free_slot = &slots[i];
+                }
+            }
+            if (free_slot->out_fd == -1) {
+                // memfds are created lazily and reused by every job of the slot
+                free_slot->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+                free_slot->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+                if (free_slot->out_fd == -1 || free_slot->err_fd == -1) {
+                    perror("bropesh: parallel: memfd_create failed");
+                    exhausted = 1;
+                    failures++;
+                    break;
+                }
+            }
+            if (start_job(free_slot, command, num_args, has_braces, input, null_fd) == -1) {
+                failures++;
+                continue;
+            }
+            running++;
+            free_slot = NULL;
+        }
+        if (running == 0) break;
+
+        int status;
+        free_slot = wait_for_slot(slots, num_slots, &status);
+        if (free_slot == NULL) break;
+        running--;
+        flush_output(free_slot->out_fd, STDOUT_FILENO);
+        flush_output(free_slot->err_fd, STDERR_FILENO);
+        if (exit_status_from_wait(status) != 0) failures++;
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) sigint_received = 1;
+    }
+
+    foreground_pgid = -1;
+    if (sigint_received && shell_interactive) printf("\n");
+    for (int i = 0; i < num_slots; i++) {
+        if (slots[i].out_fd != -1) close(slots[i].out_fd);
+        if (slots[i].err_fd != -1) close(slots[i].err_fd);
+    }
+    free(slots);
+    close(null_fd);
+    if (inputs == NULL) {
+        // leave stdin right after the lines that were used
+        if (input_offset(&reader) >= 0) lseek(STDIN_FILENO, input_offset(&reader), SEEK_SET);
+        input_close(&reader);
+    }
+
+    if (sigint_received) return 128 + SIGINT;
+    return (failures > 100) ? 101 : failures;
+}
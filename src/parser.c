@@ -0,0 +1,292 @@
+// parser.c
+// turns an input line into an ast of pipelines joined by ';', '&', '&&' and '||'
+// tokenize_pipeline (utils.c) reads the words, redirections and pipes of each
+// pipeline, this file only connects them and picks out function definitions.
+// parsed lines are kept in a small lru cache keyed by the exact line text (and
+// the alias generation, aliases are replaced before parsing), each in an arena
+// of its own, so a line that runs again (from history, a script loop, bench, a
+// function body) skips tokenizing entirely. lines with unquoted wildcards are
+// never cached: their arguments depend on the directory contents at the time
+// they run.
+
+#include "shell.h"
+
+#define PARSE_CACHE_SIZE 32
+// longer lines are parsed every time instead of pinning their memory
+#define PARSE_CACHE_MAX_LINE 4096
+// block size of the per-line arenas, most lines fit in one block
+#define PARSE_CACHE_BLOCK_SIZE 4096
+
+struct parse_cache_entry {
+    char *line;         // NULL for an unused slot
+    size_t hash;
+    unsigned long alias_generation; // the aliases the line was parsed with
+    struct arena arena; // holds root and everything below it
+    struct ast_node *root;
+    unsigned long last_used;
+    int running;        // runs of this ast in progress, such entries are never evicted
+};
+
+static struct parse_cache_entry cache[PARSE_CACHE_SIZE];
+static unsigned long use_counter = 0;
+
+// fnv-1a hash of a line
+static size_t hash_line(const char *line) {
+    size_t hash = 2166136261u;
+    for (; *line; line++) {
+        hash ^= (unsigned char)*line;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// the text of a separator, for syntax errors
+static const char *separator_text(int separator, int is_background) {
+    switch (separator) {
+    case SEPARATOR_AND:
+        return "&&";
+    case SEPARATOR_OR:
+        return "||";
+    case SEPARATOR_SEQUENCE:
+        return is_background ? "&" : ";";
+    default:
+        return "newline";
+    }
+}
+
+static struct ast_node *new_node(struct arena *arena, enum ast_type type, struct ast_node *left, struct ast_node *right) {
+    struct ast_node *node = arena_alloc(arena, sizeof(struct ast_node));
+    if (node != NULL) {
+        node->type = type;
+        node->command = NULL;
+        node->left = left;
+        node->right = right;
+        node->name = NULL;
+        node->body = NULL;
+    }
+    return node;
+}
+
+// appends the '&&'/'||' chain to the sequence before it
+static struct ast_node *end_and_or(struct arena *arena, struct ast_node *sequence, struct ast_node *and_or) {
+    if (sequence == NULL) return and_or;
+    return new_node(arena, AST_SEQUENCE, sequence, and_or);
+}
+
+static int is_function_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.';
+}
+
+// the '}' closing the function body starting at p: a word of its own, after
+// any nested { } words, outside quotes and $(...); NULL if there is none
+static const char *body_end(const char *p) {
+    int depth = 0, in_quote = 0;
+    for (const char *start = p; *p != '\0' && *p != '\n'; p++) {
+        int word_start = (p == start || isspace((unsigned char)p[-1]) || p[-1] == ';' || p[-1] == '&');
+        int word_end = (p[1] == '\0' || isspace((unsigned char)p[1]) || strchr(";&|", p[1]) != NULL);
+        if (*p == '"') {
+            in_quote = !in_quote;
+        } else if (in_quote) {
+            continue;
+        } else if (p[0] == '$' && p[1] == '(') {
+            if ((p = substitution_end(p)) == NULL) return NULL;
+            p--;
+        } else if (*p == '{' && word_start && word_end) {
+            depth++;
+        } else if (*p == '}' && word_start && word_end && depth-- == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// reads a function definition "name() { body }" at *input into *node and moves
+// *input past it and the ';' or newline after it; returns 1 and sets *separator,
+// 0 (with *node NULL) if *input is not a definition, or -1 after a syntax error
+static int parse_function(const char **input, struct arena *arena, struct ast_node **node, int *separator) {
+    const char *p = *input;
+    *node = NULL;
+    while (*p == ' ' || *p == '\t') p++;
+    const char *name = p;
+    while (is_function_name_char(*p)) p++;
+    size_t name_len = p - name;
+    while (*p == ' ' || *p == '\t') p++;
+    if (name_len == 0 || p[0] != '(') return 0;
+    for (p++; *p == ' ' || *p == '\t'; p++) {
+    }
+    if (*p != ')') return 0;
+    for (p++; *p == ' ' || *p == '\t'; p++) {
+    }
+    if (p[0] != '{' || !isspace((unsigned char)p[1])) {
+        fprintf(stderr, "bropesh: syntax error: '{' expected after '%.*s()'.\n", (int)name_len, name);
+        return -1;
+    }
+
+    const char *body = p + 1, *close = body_end(body);
+    if (close == NULL) {
+        fprintf(stderr, "bropesh: syntax error: '}' expected to end function '%.*s' on the same line.\n",
+                (int)name_len, name);
+        return -1;
+    }
+    if ((*node = new_node(arena, AST_FUNCTION, NULL, NULL)) == NULL) return -1;
+    (*node)->name = arena_strndup(arena, name, name_len);
+    (*node)->body = arena_strndup(arena, body, close - body);
+    if ((*node)->name == NULL || (*node)->body == NULL) return -1;
+
+    for (p = close + 1; *p == ' ' || *p == '\t'; p++) {
+    }
+    if (*p == ';') {
+        *separator = SEPARATOR_SEQUENCE;
+        p++;
+    } else if (*p == '\0' || *p == '\n') {
+        *separator = SEPARATOR_END;
+    } else {
+        fprintf(stderr, "bropesh: syntax error: ';' expected after the body of '%.*s'.\n", (int)name_len, name);
+        return -1;
+    }
+    *input = p;
+    return 1;
+}
+
+// parses text, which has its aliases replaced and lives in arena
+static struct ast_node *parse_text(const char *p, struct arena *arena) {
+    struct ast_node *sequence = NULL;  // everything before the last ';' or '&'
+    struct ast_node *and_or = NULL;    // the '&&'/'||' chain after it
+    enum ast_type join = AST_SEQUENCE; // how the next pipeline is attached
+    const char *heredocs = NULL;       // the next here-document body
+
+    for (;;) {
+        struct ast_node *node;
+        int separator;
+        int is_function = parse_function(&p, arena, &node, &separator);
+        if (is_function == -1) return NULL;
+        if (!is_function) {
+            struct parsed_command *cmd = arena_alloc(arena, sizeof(struct parsed_command));
+            if (cmd == NULL) return NULL;
+            separator = tokenize_pipeline(&p, &heredocs, arena, cmd);
+            if (separator == -1) return NULL;
+
+            struct pipeline_stage *first = &cmd->stages[0];
+            if (cmd->num_stages == 1 && first->argc == 0 && first->input_file == NULL && first->input_data == NULL &&
+                first->output_file == NULL && first->error_file == NULL) {
+                // nothing before the separator: fine only at the end after ';' or '&'
+                if (separator == SEPARATOR_END && join == AST_SEQUENCE) break;
+                if (separator == SEPARATOR_END) {
+                    fprintf(stderr, "bropesh: syntax error: command expected after '%s'.\n", (join == AST_AND) ? "&&" : "||");
+                } else {
+                    fprintf(stderr, "bropesh: syntax error near unexpected token '%s'.\n",
+                            separator_text(separator, cmd->is_background));
+                }
+                return NULL;
+            }
+            if (cmd->is_background && join != AST_SEQUENCE) {
+                // that would need a subshell running the whole chain in the background
+                fprintf(stderr, "bropesh: syntax error: '&' cannot end a list joined by '&&' or '||'.\n");
+                return NULL;
+            }
+
+            node = new_node(arena, AST_PIPELINE, NULL, NULL);
+            if (node == NULL) return NULL;
+            node->command = cmd;
+        }
+
+        if (join == AST_SEQUENCE) {
+            if (and_or != NULL && (sequence = end_and_or(arena, sequence, and_or)) == NULL) return NULL;
+            and_or = node;
+        } else if ((and_or = new_node(arena, join, and_or, node)) == NULL) {
+            return NULL;
+        }
+
+        if (separator == SEPARATOR_END) break;
+        if (separator == SEPARATOR_AND) join = AST_AND;
+        else if (separator == SEPARATOR_OR) join = AST_OR;
+        else join = AST_SEQUENCE;
+    }
+    return (and_or != NULL) ? end_and_or(arena, sequence, and_or) : sequence;
+}
+
+struct ast_node *parse_line(const char *line, struct arena *arena) {
+    // pipelines with $ expansions keep pointing into the text, it has to live as long as the ast
+    const char *text = expand_aliases(line, arena);
+    if (text == NULL) return NULL;
+    return parse_text(text, arena);
+}
+
+// whether line has a word tokenize_pipeline would expand: an unquoted * or ?,
+// or an unquoted [ with a ] after it in the same word
+static int has_wildcards(const char *line) {
+    int in_quote = 0;
+    for (const char *p = line; *p != '\0'; p++) {
+        if (*p == '"') {
+            in_quote = !in_quote;
+        } else if (!in_quote && (*p == '*' || *p == '?')) {
+            return 1;
+        } else if (!in_quote && *p == '[') {
+            for (const char *q = p + 1; *q != '\0' && !isspace((unsigned char)*q) && strchr("|<>&;", *q) == NULL; q++) {
+                if (*q == ']') return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+struct ast_node *parse_command_line(const char *line) {
+    if (strlen(line) > PARSE_CACHE_MAX_LINE || has_wildcards(line)) return parse_line(line, &command_arena);
+
+    size_t hash = hash_line(line);
+    struct parse_cache_entry *victim = NULL;
+    for (int i = 0; i < PARSE_CACHE_SIZE; i++) {
+        struct parse_cache_entry *entry = &cache[i];
+        if (entry->line != NULL && entry->hash == hash && entry->alias_generation == alias_generation &&
+            strcmp(entry->line, line) == 0) {
+            entry->last_used = ++use_counter;
+            entry->running++;
+            return entry->root;
+        }
+        // an unused slot first, then the least recently used one
+        if (entry->running > 0) continue;
+        if (victim == NULL || (victim->line != NULL && (entry->line == NULL || entry->last_used < victim->last_used))) {
+            victim = entry;
+        }
+    }
+    // every entry is running (nested command lines), nothing can be evicted
+    if (victim == NULL) return parse_line(line, &command_arena);
+
+    free(victim->line);
+    victim->line = NULL;
+    victim->root = NULL;
+    victim->arena.block_size = PARSE_CACHE_BLOCK_SIZE;
+    arena_reset(&victim->arena);
+    const char *text = expand_aliases(line, &victim->arena);
+    if (text == NULL) return NULL;
+    // an alias brought in wildcards
+    if (has_wildcards(text)) return parse_line(line, &command_arena);
+    struct ast_node *root = parse_text(text, &victim->arena);
+    if (root == NULL) return NULL; // syntax errors are reported again every time
+
+    // without a copy of the line the ast still runs, it just cannot be found again
+    victim->line = strdup(line);
+    victim->hash = hash;
+    victim->alias_generation = alias_generation;
+    victim->root = root;
+    victim->last_used = ++use_counter;
+    victim->running = 1;
+    return root;
+}
+
+void release_command_line(struct ast_node *root) {
+    for (int i = 0; i < PARSE_CACHE_SIZE; i++) {
+        if (cache[i].root == root && cache[i].running > 0) {
+            cache[i].running--;
+            return;
+        }
+    }
+}
+
+void free_parse_cache() {
+    for (int i = 0; i < PARSE_CACHE_SIZE; i++) {
+        free(cache[i].line);
+        arena_free(&cache[i].arena);
+        memset(&cache[i], 0, sizeof(cache[i]));
+    }
+}
@@ -0,0 +1,251 @@
+// pathcache.c
+// in-memory cache of PATH lookups ("hash" table)
+// commands are resolved in the shell before anything is spawned, so a typo is
+// reported without paying for a fork, and a known command is exec'd directly
+// instead of retrying execve() in every PATH directory.
+// the table is flushed when PATH changes or when the modification time of a
+// PATH directory changes (a program was added, removed or renamed there).
+
+#include "shell.h"
+#include <sys/stat.h> // for stat and st_mtim
+
+#define PATH_CACHE_INITIAL_SIZE 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+struct path_dir {
+    char *path;
+    struct timespec mtime; // zero if the directory could not be stat'ed
+};
+
+struct path_entry {
+    char *name;         // NULL for an unused slot
+    char *path;         // resolved executable, NULL if the command was not found
+    int dir_index;      // index in path_dirs of the directory it was found in
+    unsigned long hits; // number of times the entry was used
+};
+
+static char *cached_path_env = NULL;
+static struct path_dir *path_dirs = NULL;
+static int num_path_dirs = 0;
+static struct path_entry *entries = NULL;
+static size_t table_size = 0;
+static size_t num_entries = 0;
+
+// fnv-1a hash of a command name
+static size_t hash_name(const char *name) {
+    size_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void stat_dir_mtime(struct path_dir *dir, struct timespec *mtime) {
+    struct stat st;
+    if (stat(dir->path, &st) == 0) {
+        *mtime = st.st_mtim;
+    } else {
+        mtime->tv_sec = 0;
+        mtime->tv_nsec = 0;
+    }
+}
+
+// drops every cached entry but keeps the parsed PATH directories
+static void clear_entries() {
+    for (size_t i = 0; i < table_size; i++) {
+        free(entries[i].name);
+        free(entries[i].path);
+        entries[i].name = NULL;
+        entries[i].path = NULL;
+    }
+    num_entries = 0;
+}
+
+static void free_path_dirs() {
+    for (int i = 0; i < num_path_dirs; i++) {
+        free(path_dirs[i].path);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    num_path_dirs = 0;
+    free(cached_path_env);
+    cached_path_env = NULL;
+}
+
+// splits PATH into directories and records their modification times
+static void load_path_dirs(const char *path_env) {
+    free_path_dirs();
+    cached_path_env = strdup(path_env);
+    if (cached_path_env == NULL) {
+        perror("bropesh: strdup failed for PATH cache");
+        return;
+    }
+
+    int count = 1;
+    for (const char *p = path_env; *p; p++) {
+        if (*p == ':') count++;
+    }
+    path_dirs = calloc(count, sizeof(struct path_dir));
+    if (path_dirs == NULL) {
+        perror("bropesh: calloc failed for PATH cache");
+        return;
+    }
+
+    const char *start = path_env;
+    for (;;) {
+        const char *end = strchr(start, ':');
+        size_t len = (end != NULL) ? (size_t)(end - start) : strlen(start);
+        // an empty PATH element means the current directory
+        char *dir = (len == 0) ? strdup(".") : strndup(start, len);
+        if (dir != NULL) {
+            path_dirs[num_path_dirs].path = dir;
+            stat_dir_mtime(&path_dirs[num_path_dirs], &path_dirs[num_path_dirs].mtime);
+            num_path_dirs++;
+        }
+        if (end == NULL) break;
+        start = end + 1;
+    }
+}
+
+// flushes the cache if PATH itself changed since it was parsed
+static void check_path_env() {
+    // PATH has not been set since the last check, no need to compare it
+    static unsigned long checked_generation = (unsigned long)-1;
+    if (cached_path_env != NULL && checked_generation == path_generation) return;
+    checked_generation = path_generation;
+
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) path_env = DEFAULT_PATH;
+
+    if (cached_path_env == NULL || strcmp(cached_path_env, path_env) != 0) {
+        clear_entries();
+        load_path_dirs(path_env);
+    }
+}
+
+// flushes the cache if one of the directories up to last_dir was modified
+// returns 1 if the cache was flushed
+static int check_dir_mtimes(int last_dir) {
+    for (int i = 0; i <= last_dir && i < num_path_dirs; i++) {
+        struct timespec mtime;
+        stat_dir_mtime(&path_dirs[i], &mtime);
+        if (mtime.tv_sec != path_dirs[i].mtime.tv_sec || mtime.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            clear_entries();
+            for (int j = 0; j < num_path_dirs; j++) {
+                stat_dir_mtime(&path_dirs[j], &path_dirs[j].mtime);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// returns the slot holding name, or the empty slot where it belongs
+static struct path_entry *find_slot(const char *name) {
+    size_t mask = table_size - 1;
+    size_t i = hash_name(name) & mask;
+    while (entries[i].name != NULL && strcmp(entries[i].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &entries[i];
+}
+
+// doubles the table once it is 70% full
+static int grow_table() {
+    size_t new_size = (table_size == 0) ? PATH_CACHE_INITIAL_SIZE : table_size * 2;
+    struct path_entry *new_entries = calloc(new_size, sizeof(struct path_entry));
+    if (new_entries == NULL) {
+        perror("bropesh: calloc failed for PATH cache");
+        return -1;
+    }
+
+    struct path_entry *old_entries = entries;
+    size_t old_size = table_size;
+    entries = new_entries;
+    table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_entries[i].name != NULL) {
+            *find_slot(old_entries[i].name) = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return 0;
+}
+
+// walks the PATH directories, returns a malloc'd path or NULL if not found
+static char *search_path(const char *name, int *dir_index) {
+    char candidate[PATH_MAX];
+    struct stat st;
+
+    for (int i = 0; i < num_path_dirs; i++) {
+        int len = snprintf(candidate, sizeof(candidate), "%s/%s", path_dirs[i].path, name);
+        if (len < 0 || len >= (int)sizeof(candidate)) continue;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            *dir_index = i;
+            return strdup(candidate);
+        }
+    }
+    return NULL;
+}
+
+// resolves a command name to an executable path
+// names containing '/' are returned unchanged, NULL means "command not found"
+const char *resolve_command_path(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    if (table_size == 0 && grow_table() == -1) {
+        return NULL;
+    }
+    check_path_env();
+
+    // a hit only depends on the directories up to where it was found: a new
+    // program earlier in PATH would shadow it. a miss depends on all of them.
+    struct path_entry *entry = find_slot(name);
+    int last_dir = (entry->name != NULL && entry->path != NULL) ? entry->dir_index : num_path_dirs - 1;
+    if (check_dir_mtimes(last_dir)) {
+        entry = find_slot(name);
+    }
+    if (entry->name != NULL) {
+        entry->hits++;
+        return entry->path;
+    }
+
+    if ((num_entries + 1) * 10 > table_size * 7) {
+        if (grow_table() == -1) return NULL;
+        entry = find_slot(name);
+    }
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        perror("bropesh: strdup failed for PATH cache");
+        return NULL;
+    }
+    entry->dir_index = -1;
+    entry->path = search_path(name, &entry->dir_index);
+    entry->hits = 1;
+    num_entries++;
+    return entry->path;
+}
+
+// forgets every cached lookup (hash -r)
+void reset_path_cache() {
+    clear_entries();
+    free_path_dirs();
+}
+
+// prints the cached lookups in the format of bash's "hash"
+void print_path_cache() {
+    int printed = 0;
+    for (size_t i = 0; i < table_size; i++) {
+        if (entries[i].name != NULL && entries[i].path != NULL) {
+            if (!printed) printf("hits\tcommand\n");
+            printf("%4lu\t%s\n", entries[i].hits, entries[i].path);
+            printed = 1;
+        }
+    }
+    if (!printed) {
+        printf("hash: hash table empty\n");
+    }
+}
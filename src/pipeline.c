@@ -0,0 +1,234 @@
+// pipeline.c
+// functions for running multi-stage pipelines (cmd1 | cmd2 | ...)
+// stages are wired together with kernel pipes, so data flows between the
+// children without ever passing through the shell. two kinds of stages are
+// handled by small helper processes instead of exec'ing a program:
+//   "< file | cmd ..."     the file (or a here-document's memfd) is splice()d straight into the first pipe
+//   "... | tee file | ..." pages are duplicated with tee() and splice()d to the file
+//   "... | builtin ..."    a forked copy of the shell runs the builtin (e.g. parallel)
+
+#include "shell.h"
+
+// raises the capacity of a pipe so that high-volume stages block less often
+static void tune_pipe(int fd) {
+    // failure is harmless (e.g. above /proc/sys/fs/pipe-max-size), the default size is kept
+    fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+}
+
+// plain read/write copy, used when the file system does not support splice
+static int copy_fd(int in_fd, int out_fd) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(in_fd, buffer, sizeof(buffer))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out_fd, buffer + off, n - off);
+            if (w == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += w;
+        }
+    }
+    return 0;
+}
+
+// helper stage for "< file | ...": moves the file into the pipe inside the kernel
+static void splice_file_to_pipe(struct pipeline_stage *stage, int out_fd) {
+    int fds[3];
+    if (open_stage_redirections(stage, fds) == -1) _exit(EXIT_FAILURE);
+    int fd = fds[0];
+
+    for (;;) {
+        ssize_t n = splice(fd, NULL, out_fd, NULL, PIPE_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) break;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE) break; // the reader exited early (e.g. head)
+            if (errno == EINVAL && copy_fd(fd, out_fd) == 0) break;
+            perror("bropesh: splice failed");
+            _exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+// helper stage for "| tee file |": duplicates the input pipe into the output pipe
+// with tee(), then drains the same bytes from the input pipe into the file with splice()
+static void tee_pipe_to_file(const char *path, int in_fd, int out_fd) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("bropesh: tee: failed to open output file");
+        _exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        ssize_t n = tee(in_fd, out_fd, PIPE_BUFFER_SIZE, 0);
+        if (n == 0) break; // writer closed its end
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE) break;
+            perror("bropesh: tee failed");
+            _exit(EXIT_FAILURE);
+        }
+        while (n > 0) {
+            ssize_t m = splice(in_fd, NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (m == -1 && errno == EINTR) continue;
+            if (m <= 0) {
+                perror("bropesh: splice to tee file failed");
+                _exit(EXIT_FAILURE);
+            }
+            n -= m;
+        }
+    }
+    close(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+// a middle stage of exactly "tee file" can be run without exec'ing tee(1)
+static int is_tee_stage(struct pipeline_stage *stage) {
+    char **args = stage->args;
+    return args[0] != NULL && strcmp(args[0], "tee") == 0 &&
+           args[1] != NULL && args[1][0] != '-' && args[2] == NULL &&
+           stage->input_file == NULL && stage->input_data == NULL && stage->output_file == NULL && stage->error_file == NULL;
+}
+
+// helper stage for builtins: runs the builtin on the stage's pipe ends and redirections
+static void run_builtin_stage(struct pipeline_stage *stage, int in_fd, int out_fd) {
+    int fds[3];
+    if (open_stage_redirections(stage, fds) == -1) _exit(EXIT_FAILURE);
+    // the stage's own redirections win over the pipe ends
+    if (fds[0] == -1) fds[0] = in_fd;
+    if (fds[1] == -1) fds[1] = out_fd;
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1 && dup2(fds[i], i) == -1) {
+            perror("bropesh: dup2 failed");
+            _exit(EXIT_FAILURE);
+        }
+    }
+    // functions run whole command lines in this copy, without job control of their own
+    shell_interactive = 0;
+    job_control = 0;
+    disown_history(); // exit must not flush the history again from this copy
+    last_exit_status = 0;
+    if (!execute_builtin_command(stage->args)) {
+        // keywords like time only mean something at the start of a line
+        struct pipeline_stage plain = *stage;
+        plain.input_file = plain.output_file = plain.error_file = plain.input_data = NULL; // already applied
+        exec_external_command(&plain);
+        _exit(127);
+    }
+    fflush(stdout);
+    _exit(last_exit_status);
+}
+
+// helper stages run shell code rather than a program, so they need a real fork()
+static int is_helper_stage(struct pipeline_stage *stage, int in_fd, int out_fd) {
+    return stage->args[0] == NULL || (in_fd != -1 && out_fd != -1 && is_tee_stage(stage)) ||
+           is_builtin_command(stage->args[0]);
+}
+
+// forks a helper stage, the child never returns
+static pid_t fork_helper_stage(struct pipeline_stage *stage, int in_fd, int out_fd, int unused_fd, pid_t pgid) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("bropesh: fork failed");
+    } else if (pid == 0) {
+        sigset_t empty_mask;
+        if (pgid != -1) setpgid(0, pgid);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+        // the read end of our own output pipe would keep downstream from seeing EOF
+        if (unused_fd != -1) close(unused_fd);
+        if (stage->args[0] == NULL) {
+            splice_file_to_pipe(stage, out_fd);
+        }
+        if (is_builtin_command(stage->args[0])) {
+            run_builtin_stage(stage, in_fd, out_fd);
+        }
+        tee_pipe_to_file(stage->args[1], in_fd, out_fd);
+    }
+    return pid;
+}
+
+// starts a regular stage through the spawn backend with its pipe ends and redirections
+// returns -1 with the stage's exit status in *failure_status if it could not be started
+static pid_t spawn_stage(struct pipeline_stage *stage, int in_fd, int out_fd, pid_t pgid, int *failure_status) {
+    struct spawn_request req;
+    int fds[3];
+
+    *failure_status = EXIT_FAILURE;
+    if (open_stage_redirections(stage, fds) == -1) return -1;
+    req.args = stage->args;
+    req.pgid = pgid;
+    req.stdin_fd = (fds[0] != -1) ? fds[0] : in_fd;
+    req.stdout_fd = (fds[1] != -1) ? fds[1] : out_fd;
+    req.stderr_fd = fds[2];
+    pid_t pid = spawn_process(&req);
+    if (pid == -1 && req.path == NULL) *failure_status = 127; // command not found
+    close_stage_redirections(fds);
+    return pid;
+}
+
+// connects the stages with pipes and runs them; a stage that cannot be started
+// leaves the next one reading an empty pipe, like in sh, and the rest still run
+// returns the exit status of the last stage (0 for background pipelines)
+int execute_pipeline(struct pipeline_stage *stages, int num_stages, int is_background) {
+    pid_t pids[MAX_PIPELINE_STAGES];
+    int num_pids = 0;
+    int prev_read = -1;
+    // whether the last stage (or a pipe for it) could not be started, and its status
+    int last_failed = 0, failure_status = EXIT_FAILURE;
+
+    for (int i = 0; i < num_stages; i++) {
+        // pipe fds are close-on-exec, so exec'd stages only keep what was dup2'd onto 0 and 1
+        int pipe_fds[2] = {-1, -1};
+        if (i < num_stages - 1) {
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                perror("bropesh: pipe failed");
+                last_failed = 1;
+                failure_status = EXIT_FAILURE;
+                break;
+            }
+            tune_pipe(pipe_fds[1]);
+        }
+
+        // all stages share the process group of the first one
+        pid_t pid;
+        pid_t pgid = job_process_group((num_pids > 0) ? pids[0] : 0);
+        if (is_helper_stage(&stages[i], prev_read, pipe_fds[1])) {
+            pid = fork_helper_stage(&stages[i], prev_read, pipe_fds[1], pipe_fds[0], pgid);
+            failure_status = EXIT_FAILURE;
+        } else {
+            pid = spawn_stage(&stages[i], prev_read, pipe_fds[1], pgid, &failure_status);
+        }
+
+        // only the read end of the newest pipe is kept open in the shell; closing
+        // the write end of a failed stage gives the next one end of file
+        if (prev_read != -1) close(prev_read);
+        if (pipe_fds[1] != -1) close(pipe_fds[1]);
+        prev_read = pipe_fds[0];
+        last_failed = (pid == -1);
+        if (pid != -1) pids[num_pids++] = pid;
+    }
+    if (prev_read != -1) close(prev_read);
+
+    int exit_status = failure_status;
+    if (num_pids > 0) {
+        // the job table waits for the stages (or tracks them in the background)
+        exit_status = launch_job(pids, num_pids, stages, num_stages, is_background);
+        if (last_failed && !is_background) {
+            exit_status = failure_status;
+        }
+    }
+    return exit_status;
+}
@@ -3,74 +3,60 @@
 
 #include "shell.h"
 
-// executes an external command
-void execute_external_command(char **args, int is_background, char *input_file, char *output_file) {
-    pid_t pid = fork();
+// converts a status from waitpid into a shell exit status
+int exit_status_from_wait(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return EXIT_FAILURE;
+}
 
-    if (pid == -1) {
-        perror("bropesh: fork failed");
-    } else if (pid == 0) {
-        // child process
-        // reset signal handlers to default for child process
-        signal(SIGINT, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
+// executes the external command of a single-stage command line
+// returns its exit status, 127 if it could not be started, 0 for background commands
+int execute_external_command(struct pipeline_stage *stage, int is_background) {
+    struct spawn_request req;
+    int fds[3];
+    int exit_status = 127;
 
-        // handle i/o redirection for input
-        if (input_file != NULL) {
-            int fd_in = open(input_file, O_RDONLY);
-            if (fd_in == -1) {
-                perror("bropesh: failed to open input file");
-                exit(EXIT_FAILURE);
-            }
-            if (dup2(fd_in, STDIN_FILENO) == -1) {
-                perror("bropesh: failed to redirect stdin");
-                exit(EXIT_FAILURE);
-            }
-            close(fd_in);
-        }
-        // handle i/o redirection for output
-        if (output_file != NULL) {
-            // create file if not exists, write-only, truncate if exists, permissions 0644
-            int fd_out = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd_out == -1) {
-                perror("bropesh: failed to open output file");
-                exit(EXIT_FAILURE);
-            }
-            if (dup2(fd_out, STDOUT_FILENO) == -1) {
-                perror("bropesh: failed to redirect stdout");
-                exit(EXIT_FAILURE);
-            }
-            close(fd_out);
-        }
+    // redirection targets are opened here so errors are reported before spawning
+    if (open_stage_redirections(stage, fds) == -1) {
+        return exit_status;
+    }
+    req.args = stage->args;
+    req.stdin_fd = fds[0];
+    req.stdout_fd = fds[1];
+    req.stderr_fd = fds[2];
+    req.pgid = job_process_group(0);
+    pid_t pid = spawn_process(&req);
+    if (pid != -1) {
+        // the job table waits for it (or tracks it in the background)
+        exit_status = launch_job(&pid, 1, stage, 1, is_background);
+    }
 
-        // execute the command
-        execvp(args[0], args);
+    close_stage_redirections(fds);
+    return exit_status;
+}
 
-        fprintf(stderr, "bropesh: error running command \"%s\": %s\n", args[0], strerror(errno));
+// replaces the shell process with the command, so bropesh -c does not linger
+// as an extra process while its last command runs; returns only on error
+void exec_external_command(struct pipeline_stage *stage) {
+    char **args = stage->args;
+    const char *path = resolve_command_path(args[0]);
+    int fds[3];
+    if (path == NULL) {
+        fprintf(stderr, "bropesh: %s: command not found\n", args[0]);
+        return;
+    }
 
-        exit(EXIT_FAILURE);
-    } else {
-        // parent process
-        if (is_background) {
-            printf("[%d] %d\n", pid, pid);
-        } else {
-            foreground_child_pid = pid; // track the fg child
-            int status;
-            // wait for the fg child to finish
-            if (waitpid(pid, &status, 0) == -1) {
-                if (errno != EINTR) {
-                    perror("bropesh: waitpid failed for foreground process");
-                }
-            }
-            foreground_child_pid = -1;
+    if (open_stage_redirections(stage, fds) == -1) return;
+    fflush(stdout);
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1 && dup2(fds[i], i) == -1) {
+            perror("bropesh: dup2 failed");
+            return;
         }
     }
+    close_stage_redirections(fds);
 
-    // not doing a NULL check can cost lives :)
-    if (input_file != NULL) {
-        free(input_file);
-    }
-    if (output_file != NULL) {
-        free(output_file);
-    }
+    execve(path, args, shell_environment());
+    fprintf(stderr, "bropesh: error running command \"%s\": %s\n", args[0], strerror(errno));
 }
@@ -1,49 +1,111 @@
 // prompt.c
 // functions for displaying the shell prompt
+// the prompt is rendered once into a cached byte string and only rebuilt when
+// it is invalidated (builtin_cd changed directory) or the user/host changed,
+// so showing it costs a single write(). two buffers are used so a signal
+// handler always sees a complete prompt, even while a new one is being built.
 
 #include "shell.h"
+#include <sys/utsname.h> // for uname
 
-// displays the shell prompt
-void display_prompt() {
-    char hostname[HOST_NAME_MAX + 1];
-    char current_dir[PATH_MAX];
-    char *username_str = NULL;
-    struct passwd *pw = getpwuid(getuid());
+// enough for the colour codes plus user, host and directory
+#define PROMPT_BUFFER_SIZE (PATH_MAX + HOST_NAME_MAX + LOGIN_NAME_MAX + 64)
 
-    if (pw != NULL) {
-        username_str = pw->pw_name;
-    } else {
-        username_str = "unknown";
-    }
+static char prompt_buffers[2][PROMPT_BUFFER_SIZE];
+static size_t prompt_lengths[2];
+// index of the buffer holding the current prompt, -1 until the first build
+static volatile sig_atomic_t active_prompt = -1;
+static volatile sig_atomic_t prompt_valid = 0;
+// "> " is shown instead while here-document lines are read
+static volatile sig_atomic_t continuation_prompt = 0;
+// user and host the cached prompt was built for
+static uid_t prompt_uid;
+static char prompt_hostname[HOST_NAME_MAX + 1];
+// the user name looked up for prompt_uid, getpwuid() is slow enough to notice on every cd
+static char prompt_username[LOGIN_NAME_MAX + 1];
+
+// marks the cached prompt as stale, it is rebuilt the next time it is displayed
+void invalidate_prompt() {
+    prompt_valid = 0;
+}
 
-    if (gethostname(hostname, sizeof(hostname)) == -1) {
-        perror("bropesh: gethostname failed");
-        strcpy(hostname, "unknown_host");
+// renders the prompt into the inactive buffer and publishes it
+static void build_prompt(const char *hostname) {
+    char current_dir[PATH_MAX];
+    if (prompt_username[0] == '\0' || getuid() != prompt_uid) {
+        struct passwd *pw = getpwuid(getuid());
+        snprintf(prompt_username, sizeof(prompt_username), "%s", (pw != NULL) ? pw->pw_name : "unknown");
     }
-    hostname[HOST_NAME_MAX] = '\0';
 
     if (getcwd(current_dir, sizeof(current_dir)) == NULL) {
         perror("bropesh: getcwd failed");
         strcpy(current_dir, "error_dir");
     }
 
-    char display_dir[PATH_MAX];
     // support ~
-    if (home_dir != NULL && strncmp(current_dir, home_dir, strlen(home_dir)) == 0) {
-        if (strlen(current_dir) == strlen(home_dir)) {
-            strcpy(display_dir, "~");
-        } else {
-            snprintf(display_dir, sizeof(display_dir), "~%s", current_dir + strlen(home_dir));
-        }
+    const char *dir_prefix = "";
+    const char *dir_rest = current_dir;
+    size_t home_len = (home_dir != NULL) ? strlen(home_dir) : 0;
+    if (home_dir != NULL && strncmp(current_dir, home_dir, home_len) == 0 &&
+        (current_dir[home_len] == '\0' || current_dir[home_len] == '/')) {
+        dir_prefix = "~";
+        dir_rest = current_dir + home_len;
+    }
+
+    int next = (active_prompt == 0) ? 1 : 0;
+    int len = snprintf(prompt_buffers[next], PROMPT_BUFFER_SIZE,
+                       "\033[1;36m<\033[1;32m%s@%s:\033[1;35m\033[1;33m %s%s\033[1;36m>\033[0m ",
+                       prompt_username, hostname, dir_prefix, dir_rest);
+    if (len < 0) len = 0;
+    if (len >= PROMPT_BUFFER_SIZE) len = PROMPT_BUFFER_SIZE - 1;
+    prompt_lengths[next] = len;
+
+    active_prompt = next;
+    prompt_uid = getuid();
+    strcpy(prompt_hostname, hostname);
+    prompt_valid = 1;
+}
+
+// displays the shell prompt
+void display_prompt() {
+    struct utsname uts;
+    const char *hostname = "unknown_host";
+
+    if (uname(&uts) == 0) {
+        hostname = uts.nodename;
     } else {
-        strcpy(display_dir, current_dir);
+        perror("bropesh: uname failed");
+    }
+
+    if (!prompt_valid || getuid() != prompt_uid || strcmp(hostname, prompt_hostname) != 0) {
+        build_prompt(hostname);
     }
 
-    printf("\033[1;36m<\033[1;32m%s@%s:\033[1;35m\033[1;33m %s\033[1;36m>\033[0m ",
-           username_str,
-           hostname,
-           display_dir);
+    continuation_prompt = 0;
+    fflush(stdout); // anything printed with stdio must come before the prompt
+    write_prompt();
+}
+
+void display_continuation_prompt() {
+    continuation_prompt = 1;
+    fflush(stdout);
+    write_prompt();
+}
 
-    // printf("<%s@%s:%s> ", username_str, hostname, display_dir);
-    fflush(stdout); // ensure prompt is displayed immediately
+// writes the cached prompt, async-signal-safe so signal handlers can use it
+void write_prompt() {
+    int index = active_prompt;
+    if (index < 0 && !continuation_prompt) return;
+
+    const char *buffer = continuation_prompt ? "> " : prompt_buffers[index];
+    size_t remaining = continuation_prompt ? 2 : prompt_lengths[index];
+    while (remaining > 0) {
+        ssize_t n = write(STDOUT_FILENO, buffer, remaining);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buffer += n;
+        remaining -= n;
+    }
 }
@@ -0,0 +1,286 @@
+// rcfile.c
+// the startup file: ~/.bropeshrc (or $BROPESH_RC) for interactive shells,
+// $BROPESH_ENV for -c, scripts and piped input
+// an rc file that only defines things (alias, export and name=value without
+// expansions or wildcards, function definitions) is compiled the first time it
+// runs into a snapshot in the cache directory: a header with the rc file's
+// fingerprint (device, inode, size, mtime, ctime) followed by NUL-separated
+// records. later startups map the snapshot with a single mmap and put the
+// records straight into the variable and command tables, without reading,
+// tokenizing or parsing the rc file. an rc file doing anything else is run
+// line by line every time, like a script, and gets no snapshot.
+
+#include "shell.h"
+#include <stdint.h>   // for uint64_t
+#include <sys/mman.h> // for mmap and munmap
+#include <sys/stat.h> // for fstat
+
+#define SNAPSHOT_MAGIC "bropesh\001"
+
+// record kinds, each followed by name '\0' value '\0'
+#define RECORD_ALIAS 'a'
+#define RECORD_VARIABLE 'v'
+#define RECORD_EXPORT 'x'        // export name=value
+#define RECORD_EXPORT_ONLY 'e'   // export name, the value is empty
+#define RECORD_FUNCTION 'f'
+
+struct snapshot_header {
+    char magic[8];
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+    uint64_t records_size;
+};
+
+// the records of the snapshot being compiled
+struct record_buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed; // something the snapshot cannot replay, or out of memory
+};
+
+static int write_all(int fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buffer, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void fill_header(struct snapshot_header *header, const struct stat *st, size_t records_size) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->dev = st->st_dev;
+    header->ino = st->st_ino;
+    header->size = st->st_size;
+    header->mtime_sec = st->st_mtim.tv_sec;
+    header->mtime_nsec = st->st_mtim.tv_nsec;
+    header->ctime_sec = st->st_ctim.tv_sec;
+    header->ctime_nsec = st->st_ctim.tv_nsec;
+    header->records_size = records_size;
+}
+
+// the snapshot's name in the cache directory: fnv-1a of the rc file's path
+static void snapshot_name(const char *path, char name[17]) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *path; path++) {
+        hash ^= (unsigned char)*path;
+        hash *= 1099511628211ull;
+    }
+    snprintf(name, 17, "%016llx", (unsigned long long)hash);
+}
+
+static void add_record(struct record_buffer *records, char kind, const char *name, size_t name_len, const char *value) {
+    size_t value_len = strlen(value);
+    size_t needed = records->len + 1 + name_len + 1 + value_len + 1;
+    if (records->failed) return;
+    if (needed > records->capacity) {
+        size_t capacity = (needed > 2 * records->capacity) ? needed : 2 * records->capacity;
+        char *grown = realloc(records->data, capacity);
+        if (grown == NULL) {
+            // no snapshot this time, the rc file still ran
+            records->failed = 1;
+            return;
+        }
+        records->data = grown;
+        records->capacity = capacity;
+    }
+    char *p = records->data + records->len;
+    *p++ = kind;
+    memcpy(p, name, name_len);
+    p[name_len] = '\0';
+    p += name_len + 1;
+    memcpy(p, value, value_len + 1);
+    records->len = needed;
+}
+
+// adds the records of a parsed rc line, or marks the snapshot as impossible
+// when the line does something other than defining aliases, variables or functions
+static void compile_line(struct ast_node *root, const char *line, struct record_buffer *records) {
+    if (root->type == AST_FUNCTION) {
+        add_record(records, RECORD_FUNCTION, root->name, strlen(root->name), root->body);
+        return;
+    }
+    struct parsed_command *cmd = root->command;
+    struct pipeline_stage *stage = (cmd != NULL) ? &cmd->stages[0] : NULL;
+    // wildcards would have been expanded against the directory at compile time
+    if (root->type != AST_PIPELINE || cmd->needs_expansion || cmd->num_stages != 1 || cmd->is_background ||
+        stage->argc == 0 || stage->input_file != NULL || stage->input_data != NULL || stage->output_file != NULL ||
+        stage->error_file != NULL || strpbrk(line, "*?[") != NULL) {
+        records->failed = 1;
+        return;
+    }
+
+    char **args = stage->args;
+    int is_alias = (strcmp(args[0], "alias") == 0), is_export = (strcmp(args[0], "export") == 0);
+    if ((is_alias || is_export) && args[1] == NULL) {
+        records->failed = 1; // prints a list
+        return;
+    }
+    if (!is_alias && !is_export && !is_assignment_list(args)) {
+        records->failed = 1;
+        return;
+    }
+    for (int i = (is_alias || is_export) ? 1 : 0; args[i] != NULL; i++) {
+        size_t name_len = strcspn(args[i], "=");
+        if (args[i][name_len] == '=') {
+            char kind = is_alias ? RECORD_ALIAS : is_export ? RECORD_EXPORT : RECORD_VARIABLE;
+            add_record(records, kind, args[i], name_len, args[i] + name_len + 1);
+        } else if (is_export) {
+            add_record(records, RECORD_EXPORT_ONLY, args[i], name_len, "");
+        } else {
+            records->failed = 1; // alias name prints it
+        }
+    }
+}
+
+// applies the records, returns 0 or -1 if they are malformed (nothing applied then)
+static int replay_records(const char *data, size_t size) {
+    // check every record first, so a damaged snapshot changes nothing
+    for (size_t pos = 0; pos < size;) {
+        const char *name_end = memchr(data + pos + 1, '\0', size - pos - 1);
+        if (name_end == NULL || name_end + 1 >= data + size) return -1;
+        const char *value_end = memchr(name_end + 1, '\0', data + size - name_end - 1);
+        if (value_end == NULL || strchr("avxef", data[pos]) == NULL) return -1;
+        pos = value_end - data + 1;
+    }
+    for (size_t pos = 0; pos < size;) {
+        char kind = data[pos];
+        const char *name = data + pos + 1;
+        size_t name_len = strlen(name);
+        const char *value = name + name_len + 1;
+        if (kind == RECORD_ALIAS) {
+            set_alias(name, name_len, value);
+        } else if (kind == RECORD_FUNCTION) {
+            define_function(name, value);
+        } else {
+            set_variable(name, name_len, (kind == RECORD_EXPORT_ONLY) ? NULL : value, kind != RECORD_VARIABLE);
+        }
+        pos = value - data + strlen(value) + 1;
+    }
+    return 0;
+}
+
+// loads the snapshot of the rc file described by st, returns 0 or -1 if there is no valid one
+static int load_snapshot(const char *name, const struct stat *st) {
+    int dir_fd = open_cache_dir("rc", 0);
+    if (dir_fd == -1) return -1;
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    close(dir_fd);
+    if (fd == -1) return -1;
+
+    struct stat snapshot_st;
+    if (fstat(fd, &snapshot_st) == -1 || (size_t)snapshot_st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = snapshot_st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    struct snapshot_header expected, header;
+    fill_header(&expected, st, size - sizeof(header));
+    memcpy(&header, data, sizeof(header));
+    int status = -1;
+    if (memcmp(&header, &expected, sizeof(header)) == 0) {
+        status = replay_records(data + sizeof(header), size - sizeof(header));
+    }
+    munmap(data, size);
+    return status;
+}
+
+static void save_snapshot(const char *name, const struct stat *st, const struct record_buffer *records) {
+    int dir_fd = open_cache_dir("rc", 1);
+    if (dir_fd == -1) return;
+    char tmp[64];
+    int fd = create_temp_file(dir_fd, tmp, sizeof(tmp));
+    if (fd != -1) {
+        // one write: the header and the records are contiguous in the file
+        size_t total = sizeof(struct snapshot_header) + records->len;
+        char *buffer = malloc(total);
+        int ok = 0;
+        if (buffer != NULL) {
+            fill_header((struct snapshot_header *)buffer, st, records->len);
+            if (records->len > 0) memcpy(buffer + sizeof(struct snapshot_header), records->data, records->len);
+            ok = (write_all(fd, buffer, total) == 0);
+            free(buffer);
+        }
+        // a failed snapshot only costs running the rc file again next time
+        install_temp_file(dir_fd, fd, tmp, name, ok);
+    }
+    close(dir_fd);
+}
+
+// reads the next line of the rc file for read_here_documents
+static char *next_rc_line(void *reader) {
+    return input_read_line(reader);
+}
+
+// runs the rc file line by line, compiling it into records as it goes
+static void run_rc_file(int fd, struct record_buffer *records) {
+    struct input_reader reader;
+    char *line;
+    if (input_open_fd(&reader, fd) == -1) {
+        records->failed = 1;
+        return;
+    }
+    while ((line = input_read_line(&reader)) != NULL) {
+        arena_reset(&command_arena); // one reset per line, like a script
+        char *joined = read_here_documents(line, next_rc_line, &reader);
+        char *trimmed = trim_whitespace((joined != NULL) ? joined : line);
+        if (trimmed[0] != '\0' && trimmed[0] != '#') {
+            // parsed outside the parse cache and the history
+            struct ast_node *root = parse_line(trimmed, &command_arena);
+            if (root == NULL) {
+                records->failed = 1;
+                last_exit_status = EXIT_FAILURE;
+            } else {
+                if (joined != NULL) records->failed = 1;
+                compile_line(root, trimmed, records);
+                // a failing line would fail differently (or not) in a replay
+                if (execute_ast(root) != 0) records->failed = 1;
+            }
+        }
+        free(joined);
+    }
+    input_close(&reader);
+    arena_reset(&command_arena);
+}
+
+int load_rc_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        // no rc file is the common case
+        if (errno != ENOENT) fprintf(stderr, "bropesh: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    char name[17];
+    snapshot_name(path, name);
+    if (load_snapshot(name, &st) == 0) {
+        close(fd);
+        return 1;
+    }
+
+    struct record_buffer records = {NULL, 0, 0, 0};
+    run_rc_file(fd, &records);
+    // an rc file edited while it ran gets its snapshot next time
+    struct stat after;
+    if (!records.failed && fstat(fd, &after) == 0 && after.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+        after.st_mtim.tv_nsec == st.st_mtim.tv_nsec && after.st_size == st.st_size) {
+        save_snapshot(name, &st, &records);
+    }
+    free(records.data);
+    close(fd);
+    return 0;
+}
@@ -10,6 +10,8 @@
 // enable posix and x/open features
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 700
+// enable linux-specific interfaces (pipe2, splice, tee, F_SETPIPE_SZ)
+#define _GNU_SOURCE
 
 #include <stdio.h>    // standard input/output functions
 #include <stdlib.h>   // for malloc, free, exit
@@ -22,6 +24,7 @@
 #include <signal.h>   // for signal handling
 #include <fcntl.h>    // for open, dup2, close
 #include <ctype.h>    // for isspace
+#include <sys/resource.h> // for struct rusage
 
 
 
@@ -29,14 +32,22 @@
 
 // SETTINGS
 // global variables for shell state
-// maximum length of a command input
-#define MAX_COMMAND_LENGTH 1024
-// maximum number of arguments for a command
-#define MAX_ARGS 64
-// maximum number of commands to store in history
-#define MAX_HISTORY_SIZE 20
+// number of recent commands kept in memory (the history file itself is unbounded)
+#define MAX_HISTORY_SIZE 1000
+// history records per group commit / fdatasync
+#define HISTORY_GROUP_SIZE 32
+// duplicates are dropped from the history file whenever it grows past this size times a power of two
+#define HISTORY_COMPACT_SIZE (64 * 1024 * 1024)
 // name of the history file, stored in the user's home directory
 #define HISTORY_FILE_NAME "/.bropesh_history"
+// startup file read by interactive shells, stored in the user's home directory
+#define RC_FILE_NAME "/.bropeshrc"
+// maximum number of commands chained with '|' in a single pipeline
+#define MAX_PIPELINE_STAGES 32
+// capacity requested for the pipes between pipeline stages (1 MiB)
+#define PIPE_BUFFER_SIZE (1024 * 1024)
+// size of the blocks the per-command arena allocates from
+#define ARENA_BLOCK_SIZE (64 * 1024)
 
 
 
@@ -45,30 +56,217 @@
 extern char *home_dir;
 // pointer to the previous working directory path, used for 'cd -'
 extern char *prev_dir;
-// process id of the currently running foreground child process
-extern pid_t foreground_child_pid;
+// process group of the job running in the foreground, 0 while the shell itself waits (wait builtin), -1 at the prompt
+extern pid_t foreground_pgid;
+// set by the sigint handler, lets interruptible waits notice ctrl+c
+extern volatile sig_atomic_t sigint_received;
+// 1 when jobs get their own process group and the terminal (interactive shells)
+extern int job_control;
+// signalfd that becomes readable when a child changed state
+extern int sigchld_fd;
 // array to store history commands
 extern char *history_commands[MAX_HISTORY_SIZE];
 // current count of commands in history (not necessarily actual stored, but total entered)
 extern int history_count;
-// file pointer for the history file
-extern FILE *history_file_ptr;
+// 1 when reading commands from a terminal, 0 for -c, script files and piped input
+extern int shell_interactive;
+// exit status of the last command that ran
+extern int last_exit_status;
+
+// line reader for non-interactive input (input.c)
+struct input_reader {
+    int fd;               // source of buffered reads, -1 for a -c string
+    char *data;           // mapped file, -c string or read buffer
+    size_t size;          // number of valid bytes in data
+    size_t pos;           // start of the next unread line
+    size_t capacity;      // size of the read buffer, 0 for mapped/string input
+    int is_mapped;        // data is an mmap of a regular file
+    int at_eof;           // read() returned end of file
+    char *line;           // line copied out of mapped/string input
+    size_t line_capacity; // allocated size of line
+};
+
+// bump allocator for per-command data (arena.c)
+struct arena_block;
+struct arena {
+    struct arena_block *first;   // kept across resets
+    struct arena_block *current; // block new allocations come from
+    size_t block_size;           // size of new blocks, 0 for ARENA_BLOCK_SIZE
+};
+// position in an arena to release back to
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+// one command of a pipeline, as produced by tokenize_input
+struct pipeline_stage {
+    char **args;       // NULL-terminated argument list (args[0] == NULL for "< file | ...")
+    int argc;          // number of entries in args
+    char *input_file;  // '<' target, only allowed on the first stage
+    char *output_file; // '>' or '>>' target, only allowed on the last stage
+    int append_output; // output_file came from '>>'
+    char *error_file;  // '2>' target, allowed on any stage
+    char *input_data;  // '<<<' word or '<<' here-document fed to stdin, like input_file only on the first stage
+    size_t input_len;
+};
+
+// a tokenized pipeline, all pointers refer to the arena it was parsed into
+struct parsed_command {
+    struct pipeline_stage *stages; // one stage per command separated by '|'
+    int num_stages;
+    int is_background;             // pipeline ended with '&'
+    const char *source;            // the pipeline's text, tokenized again by expand_pipeline
+    const char *heredocs;          // where its here-document bodies start, NULL until looked up
+    int needs_expansion;           // has $ expansions: run the result of expand_pipeline instead
+};
+
+// what ended a pipeline in the input
+enum separator { SEPARATOR_END, SEPARATOR_SEQUENCE, SEPARATOR_AND, SEPARATOR_OR };
+
+// a parsed input line: pipelines joined by ';' (or '&'), '&&' and '||'
+// '&&' and '||' bind tighter than ';' and group to the left
+enum ast_type { AST_PIPELINE, AST_SEQUENCE, AST_AND, AST_OR, AST_FUNCTION };
+struct ast_node {
+    enum ast_type type;
+    struct parsed_command *command; // AST_PIPELINE
+    struct ast_node *left;          // the other types
+    struct ast_node *right;
+    const char *name;               // AST_FUNCTION: name() { body }
+    const char *body;
+};
+
+// arena used for the command line currently being run, reset once per input line
+extern struct arena command_arena;
 
 // utility functions
 // trims leading and trailing whitespace from a string
 char *trim_whitespace(char *str);
-// tokenizes the input string into arguments, handles redirection and background flag
-char **tokenize_input(char *input, int *num_args, int *is_background, char **input_file, char **output_file);
-// frees memory allocated for tokens
-void free_tokens(char **tokens);
+// tokenizes the pipeline at *input in one pass into arena memory, handles pipes,
+// redirection and background flag, and moves *input past the separator after it
+// *heredocs is the body of the next '<<' here-document (NULL: the line after the command)
+// returns the separator (enum separator), or -1 on a syntax error
+int tokenize_pipeline(const char **input, const char **heredocs, struct arena *arena, struct parsed_command *cmd);
+// tokenizes input holding a single pipeline, returns 0 on success, -1 on a syntax error
+int tokenize_input(const char *input, struct arena *arena, struct parsed_command *cmd);
+// tokenizes a pipeline marked needs_expansion again with its substitutions run
+// returns 0, or -1 after printing an error (last_exit_status says why)
+int expand_pipeline(const struct parsed_command *cmd, struct arena *arena, struct parsed_command *expanded);
+// opens the directory name in the cache directory ($XDG_CACHE_HOME/bropesh or
+// ~/.cache/bropesh), creating it if create is set; returns its fd, or -1 with errno set
+int open_cache_dir(const char *name, int create);
+// opens a new temporary file in dir_fd, its name goes to tmp; returns its fd or -1
+int create_temp_file(int dir_fd, char *tmp, size_t size);
+// closes the temporary file and renames it to path if ok, removes it otherwise
+// returns 0, or -1 with errno set
+int install_temp_file(int dir_fd, int fd, const char *tmp, const char *path, int ok);
+// copies in_fd to out_fd up to the end of in_fd, starting at offset start of
+// in_fd (whose own offset is then left alone) or at its current offset if
+// start is -1; returns 0 or -1 with errno set
+int copy_fd_to_fd(int in_fd, int out_fd, off_t start);
+// finds the delimiters of the '<<' here-documents on line, copied into arena
+// returns their number
+int find_here_delimiters(const char *line, struct arena *arena, char ***delimiters);
+
+// expansion functions (expand.c)
+// the end of the $(...) starting at p (just past its ')'), NULL if it is not closed
+const char *substitution_end(const char *p);
+// the end of the expansion at p ($(...), $name, ${name}, $?, $$, $1..$9, $# or $@),
+// p itself if there is none, NULL if it is not closed
+const char *expansion_end(const char *p);
+// expands the $ expansions in the word between start and end, removing quotes;
+// split breaks unquoted expansion results into words at whitespace
+// returns the number of resulting words (in arena), or -1 after printing an error
+int expand_word(const char *start, const char *end, int split, struct arena *arena, char ***fields);
+
+// parser functions (parser.c)
+// parses a whole line into an ast allocated from arena, NULL after a syntax error
+struct ast_node *parse_line(const char *line, struct arena *arena);
+// returns the ast of line, from the cache of recently parsed lines when possible
+// (lines with wildcards go to command_arena and are never cached); the ast stays
+// valid until release_command_line, NULL after a syntax error
+struct ast_node *parse_command_line(const char *line);
+// marks an ast from parse_command_line as no longer running
+void release_command_line(struct ast_node *root);
+// frees the parse cache
+void free_parse_cache();
+
+// glob functions
+// expands a glob pattern (a backslash escapes the next character) into the sorted matching
+// paths, allocated from arena. returns the number of matches, 0 if there are
+// none or the pattern has no wildcards, -1 after printing an error
+int glob_expand(const char *pattern, struct arena *arena, char ***matches);
+
+// arena functions
+// returns size bytes from the arena, NULL after printing an error
+void *arena_alloc(struct arena *arena, size_t size);
+// copies len bytes of str into the arena and NUL-terminates them
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+// remembers the current end of the arena
+struct arena_mark arena_mark(struct arena *arena);
+// frees everything allocated after the mark
+void arena_release(struct arena *arena, struct arena_mark mark);
+// frees everything allocated from the arena, keeping its first block
+void arena_reset(struct arena *arena);
+// releases all memory of the arena
+void arena_free(struct arena *arena);
+
+// main loop functions
+// runs one input line (builtin, external command or pipeline), returns its exit status
+int run_command_line(char *line);
+// runs a tokenized command line, returns its exit status and stores it in last_exit_status
+int execute_parsed_command(struct parsed_command *cmd);
+// runs a parsed line, returns the exit status of the last pipeline that ran
+int execute_ast(struct ast_node *node);
+// when line has '<<' here-documents, reads their bodies with next_line and
+// returns line and bodies joined by newlines (malloc'd), NULL when there are none
+char *read_here_documents(const char *line, char *(*next_line)(void *), void *source);
+
+// rc file functions (rcfile.c)
+// runs the rc file at path, or replays its snapshot; returns 1 for a snapshot,
+// 0 if the file ran, -1 if there is none
+int load_rc_file(const char *path);
+
+// input functions
+// reads lines from a string (bropesh -c)
+void input_open_string(struct input_reader *reader, const char *str);
+// reads lines from fd, mmap'ing regular files, returns 0 on success or -1
+int input_open_fd(struct input_reader *reader, int fd);
+// returns the next line without its newline, NULL at end of input
+char *input_read_line(struct input_reader *reader);
+// returns 1 when no input is left after the current line
+int input_at_end(struct input_reader *reader);
+// offset of the next unread line of a mapped file, -1 for other input
+off_t input_offset(struct input_reader *reader);
+// continues a mapped file at offset
+void input_seek(struct input_reader *reader, off_t offset);
+// releases the reader's buffers and mapping
+void input_close(struct input_reader *reader);
 
 // prompt functions
-// displays the shell prompt
+// displays the shell prompt, rebuilding the cached copy if it is stale
 void display_prompt();
+// writes the cached prompt with a single write(), safe to call from signal handlers
+void write_prompt();
+// marks the cached prompt as stale (e.g. after the working directory changed)
+void invalidate_prompt();
+// displays "> " for a continuation line (here-document bodies) until the next display_prompt
+void display_continuation_prompt();
 
 // built-in command functions
-// checks if a command is built-in and executes it, returns 1 if handled, 0 otherwise
-int execute_builtin_command(char **args);
+// points stdin, stdout and stderr at the stage's redirection targets for a builtin
+// running in the shell, saving the originals in saved[0..2]; returns 0 or -1
+int redirect_builtin(struct pipeline_stage *stage, int saved[3]);
+// puts back the fds saved by redirect_builtin
+void restore_builtin_redirections(int saved[3]);
+// a builtin's function, returns the exit status
+typedef int (*builtin_function)(char **args);
+struct builtin {
+    const char *name;
+    builtin_function run; // NULL for keywords (time)
+};
+// all builtins, ended by a NULL name
+extern const struct builtin builtins[];
 // implements the 'echo' command
 void builtin_echo(char **args);
 // implements the 'pwd' command
@@ -79,27 +277,232 @@ int  builtin_help();
 int builtin_cd(char **args);
 // implements the 'history' command
 void builtin_history();
+// implements the 'hash' command (inspect or reset the PATH cache)
+int builtin_hash(char **args);
 // handles ctrl+d (end of file) signal, performs cleanup and exits
 void handle_ctrl_d();
 
+// spawn backends (spawn.c), selected at startup with --spawn=<backend>
+enum spawn_backend { SPAWN_POSIX_SPAWN, SPAWN_VFORK, SPAWN_CLONE, SPAWN_FORK };
+extern enum spawn_backend spawn_backend;
+
+// how open_redirection opens its file
+enum redirect_mode { REDIRECT_INPUT, REDIRECT_OUTPUT, REDIRECT_APPEND };
+
+// describes a child to start, fds must be close-on-exec (see open_redirection)
+struct spawn_request {
+    char **args;            // NULL-terminated argument list, args[0] is looked up in PATH
+    const char *path;       // executable resolved by spawn_process through the PATH cache
+    int stdin_fd;           // fd installed as the child's stdin, -1 to inherit
+    int stdout_fd;          // fd installed as the child's stdout, -1 to inherit
+    int stderr_fd;          // fd installed as the child's stderr, -1 to inherit
+    pid_t pgid;             // process group to join: 0 starts a new one, -1 stays in the shell's
+    volatile int exec_errno; // set when the child could not be started
+};
+
+// spawn functions
+// selects the spawn backend by name, returns 0 on success, -1 if unknown
+int set_spawn_backend(const char *name);
+// opens a '<', '>' or '>>' target close-on-exec, returns the fd or -1 after printing an error
+int open_redirection(const char *path, enum redirect_mode mode);
+// puts here-document text into a sealed memfd, returns it rewound or -1 after printing an error
+int open_here_data(const char *data, size_t len);
+// opens the stage's '<' (or here-data), '>'/'>>' and '2>' targets into fds[0..2] (-1 where there is none)
+// returns 0, or -1 after printing an error with nothing left open
+int open_stage_redirections(struct pipeline_stage *stage, int fds[3]);
+// closes the fds opened by open_stage_redirections
+void close_stage_redirections(int fds[3]);
+// starts a child process with the selected backend, returns its pid or -1 after printing an error
+pid_t spawn_process(struct spawn_request *req);
+
+// PATH cache functions (pathcache.c)
+// resolves a command name through the PATH cache, returns NULL if it is not found
+const char *resolve_command_path(const char *name);
+// forgets every cached PATH lookup
+void reset_path_cache();
+// prints the cached PATH lookups and their hit counts
+void print_path_cache();
+
 // process management functions
-// executes an external command in foreground or background with optional redirection
-void execute_external_command(char **args, int is_background, char *input_file, char *output_file);
+// executes the stage's command in foreground or background with its redirections
+// returns the exit status of a foreground command (0 for background commands)
+int execute_external_command(struct pipeline_stage *stage, int is_background);
+// replaces the shell with the stage's command (the last command of bropesh -c), returns only on error
+void exec_external_command(struct pipeline_stage *stage);
+// converts a status from waitpid into a shell exit status (128 + signal for killed commands)
+int exit_status_from_wait(int status);
+
+// pipeline functions
+// connects the stages with pipes and runs them, returns the exit status of the last stage
+int execute_pipeline(struct pipeline_stage *stages, int num_stages, int is_background);
 
 // history management functions
-// loads command history from the history file into memory
+// turns on the history of an interactive session, loaded by load_history on first use
+void enable_history();
+// for forked copies of the shell: never writes the log, the parent does
+void disown_history();
+// opens the history log and loads its newest entries into memory, once, if enabled
 void load_history();
-// saves current command history from memory to the history file
+// writes pending history records to the log and syncs it
 void save_history();
-// adds a new command to the in-memory history
+// adds a new command to the in-memory history and appends it to the log
 void add_to_history(char *command);
+// adds the commands other sessions appended to the log since the last read (history -r)
+void merge_history();
+// splits a history log line into its sequence number and command
+const char *history_record_command(const char *line, size_t len, size_t *command_len, unsigned long long *seq);
+// saves pending records and frees the in-memory history
+void free_history();
+
+// history index functions (histindex.c)
+// indexes the records history.c just appended at log offset offset
+void history_index_append(off_t offset, const char *records, size_t len);
+// forgets the index after the log was replaced by compaction
+void history_index_invalidate();
+// finds the newest command containing pattern among the records before `before`
+// (-1 for all), returns its record number and a malloc'd copy in *match, or -1
+long history_search(const char *pattern, long before, char **match);
+// prints every command in the history file containing pattern (history -s)
+void history_search_print(const char *pattern);
+
+// line editor (lineedit.c)
+// reads a line from the terminal with editing keys, history and ctrl+r search
+// returns NULL at ctrl+d on an empty line, the line is valid until the next call
+char *read_line_interactive();
+
+// tab completion (complete.c)
+// candidates for the word being completed
+struct completion {
+    char **matches; // sorted, malloc'd, directories end with '/'
+    int count;
+};
+// collects the completions of word: builtins and PATH executables when is_command
+// is set and word has no '/', files and directories otherwise
+// returns the number of matches, or -1 after printing an error
+int complete_word(const char *word, int is_command, struct completion *result);
+void free_completion(struct completion *result);
+
+// job control functions (jobs.c)
+// creates the sigchld signalfd and, when interactive, takes the terminal for job control
+void init_jobs();
+// process group for a job's next process: 0 for the first (new group), -1 without job control
+pid_t job_process_group(pid_t first_pid);
+// records started processes as a job, waits for it unless is_background
+// returns the exit status of its last process (0 for background jobs)
+int launch_job(pid_t *pids, int num_pids, struct pipeline_stage *stages, int num_stages, int is_background);
+// reaps children that changed state without blocking, returns 1 if a job has news to report
+int update_jobs();
+// reports finished and stopped jobs and forgets the finished ones
+void notify_jobs();
+// records a status from wait4 for a child that may belong to a job
+void mark_process_status(pid_t pid, int status, const struct rusage *usage);
+// adds the usage of a child waited for outside the job table to the foreground usage
+void add_foreground_usage(const struct rusage *usage);
+// resets the resource usage collected from foreground jobs
+void reset_job_usage();
+// resource usage summed over the foreground jobs waited for since reset_job_usage
+void get_job_usage(struct rusage *usage);
+// job builtins, each returns its exit status
+int builtin_jobs(char **args);
+int builtin_fg(char **args);
+int builtin_bg(char **args);
+int builtin_wait(char **args);
+int builtin_kill(char **args);
+
+// timing functions (timing.c)
+// time [-p | -v | -j] [-o file] command: runs the rest of cmd and reports
+// wall clock time, rusage and hardware counters, returns the command's status
+int builtin_time(struct parsed_command *cmd);
+
+// command table (commands.c): builtins, aliases and functions
+struct command_entry;
+// bumped whenever an alias changes
+extern unsigned long alias_generation;
+// loads the builtins into the table
+void init_commands();
+// returns what name runs in the shell (builtin or function), NULL for programs in PATH
+struct command_entry *find_command(const char *name);
+// runs a command found by find_command, returns its exit status
+int run_command_entry(struct command_entry *entry, char **args);
+// returns 1 if name is a builtin or function
+int is_builtin_command(const char *name);
+// runs args if it is a builtin or function, setting last_exit_status
+// returns 1 if handled, 0 otherwise
+int execute_builtin_command(char **args);
+// the name of the next entry from *position on (start at 0), NULL after the last
+const char *next_command_name(size_t *position);
+// copies line into arena with the alias in command position replaced, NULL after an error
+const char *expand_aliases(const char *line, struct arena *arena);
+// defines or replaces an alias, returns 0 or -1 after printing an error
+int set_alias(const char *name, size_t len, const char *value);
+// defines or replaces a function, returns its exit status
+int define_function(const char *name, const char *body);
+// removes a function, returns -1 if there is none
+int undefine_function(const char *name);
+// alias [name[=value]]... and unalias [-a] name...: return their exit status
+int builtin_alias(char **args);
+int builtin_unalias(char **args);
+
+// variable functions (variables.c)
+// bumped whenever PATH is set or unset
+extern unsigned long path_generation;
+// imports the environment as exported variables and points environ at their envp
+void init_variables();
+// returns 1 if the len bytes at name are a valid variable name
+int is_valid_name(const char *name, size_t len);
+// returns the value of the variable, NULL if it is not set
+const char *get_variable(const char *name, size_t len);
+// sets a variable (value NULL only exports it) and exports it if export is set
+// returns 0 or -1 after printing an error
+int set_variable(const char *name, size_t len, const char *value, int export);
+void unset_variable(const char *name, size_t len);
+// the NULL-terminated "name=value" list of exported variables passed to commands
+char **shell_environment();
+// makes args (args[0] is the function name) $0, $1... and returns the previous ones
+char **set_positional_args(char **args);
+// returns $n, NULL if it is not set
+const char *get_positional_arg(int n);
+// returns $#
+int count_positional_args();
+// returns 1 if every word in args has the form name=value
+int is_assignment_list(char **args);
+// runs a command made only of name=value words, returns its exit status
+int assign_variables(char **args);
+// export [name[=value]]... and unset name...: return their exit status
+int builtin_export(char **args);
+int builtin_unset(char **args);
+
+// parallel builtin (parallel.c)
+// parallel [-j N] command [args with {}] [::: inputs]: runs command once per input
+// (or line of stdin) on N slots, returns the number of failed jobs
+int builtin_parallel(char **args);
+
+// bench builtin (bench.c)
+// bench [-n runs] [-w warmup] [-s] "cmd" ...: runs each command repeatedly and
+// prints wall/cpu statistics and a comparison, returns 0 or a failed run's status
+int builtin_bench(char **args);
+
+// memo builtin (memo.c)
+// memo [-d file]... [-e name]... cmd [args...]: replays the stored stdout, stderr and
+// exit status of an earlier identical run, or runs cmd and stores them; memo -c
+// empties the cache. returns the command's exit status
+int builtin_memo(char **args);
+// remembers the shell's own stdin, which memoized commands do not read
+void init_memo();
+
+// in-process utilities (coreutils.c), enabled with --builtin-utils
+extern int builtin_utils_enabled;
+// returns 1 if args can run in-process: cat, wc, head, tail, true, false, test or [
+// with options the builtins implement
+int is_builtin_util(char **args);
+// runs an in-process utility on stdin and stdout (see redirect_builtin), returns its
+// exit status or -1 if the program from PATH has to run instead
+int run_builtin_util(char **args);
 
 // signal handling functions
-// sets up custom signal handlers for sigint (ctrl+c) and sigchld (child process status change)
+// sets up the sigint (ctrl+c) handler and blocks sigchld, which jobs.c reads from a signalfd
 void setup_signal_handlers();
 // signal handler for sigint (ctrl+c)
 void handle_sigint(int signum);
-// signal handler for sigchld (child process status change), reaps background processes
-void handle_sigchld(int signum);
 
 #endif // SHELL_H
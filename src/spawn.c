@@ -0,0 +1,267 @@
+// spawn.c
+// process-spawn backends used for every external command
+// fork() has to copy the page tables of the whole shell for every command,
+// which gets slower as the shell grows. the default backend is posix_spawn(),
+// and vfork() or clone(CLONE_VM | CLONE_VFORK) can be picked at startup with
+// --spawn=<backend>. these three share the shell's memory until the child
+// execs, so the child side only does dup2/sigaction/sigprocmask and exec.
+// plain fork() stays available for debugging and for helper stages that run
+// shell code instead of exec'ing a program (see pipeline.c).
+
+#include "shell.h"
+#include <spawn.h> // for posix_spawn and file actions
+#include <sched.h> // for clone and CLONE_* flags
+#include <sys/mman.h> // for memfd_create
+
+// stack used by the clone backend, the parent is suspended until the child
+// execs or exits (CLONE_VFORK), so one static stack is enough
+#define CLONE_STACK_SIZE (64 * 1024)
+static char clone_stack[CLONE_STACK_SIZE] __attribute__((aligned(16)));
+
+enum spawn_backend spawn_backend = SPAWN_POSIX_SPAWN;
+
+static const char *backend_names[] = {"posix_spawn", "vfork", "clone", "fork"};
+
+// selects the backend by name, returns 0 on success, -1 if the name is unknown
+int set_spawn_backend(const char *name) {
+    for (int i = 0; i < (int)(sizeof(backend_names) / sizeof(backend_names[0])); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            spawn_backend = (enum spawn_backend)i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "bropesh: unknown spawn backend \"%s\" (use posix_spawn, vfork, clone or fork)\n", name);
+    return -1;
+}
+
+// opens a redirection target in the parent, close-on-exec so only the child's dup2 keeps it
+// returns the fd, or -1 after printing an error
+int open_redirection(const char *path, enum redirect_mode mode) {
+    int fd;
+    if (mode == REDIRECT_OUTPUT) {
+        // create file if not exists, write-only, truncate if exists, permissions 0644
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) perror("bropesh: failed to open output file");
+    } else if (mode == REDIRECT_APPEND) {
+        // '>>' keeps what is there, O_APPEND makes every write go to the end
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) perror("bropesh: failed to open output file");
+    } else {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) perror("bropesh: failed to open input file");
+    }
+    return fd;
+}
+
+// here-strings and here-documents never touch the disk: the text goes into a
+// memfd, which the child reads like a file; the seals make it read-only, so
+// nothing that inherits it can change what later readers see
+int open_here_data(const char *data, size_t len) {
+    int fd = memfd_create("bropesh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        perror("bropesh: memfd_create failed for here-document");
+        return -1;
+    }
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            perror("bropesh: failed to write here-document");
+            close(fd);
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+int open_stage_redirections(struct pipeline_stage *stage, int fds[3]) {
+    fds[0] = fds[1] = fds[2] = -1;
+    if (stage->input_file != NULL && (fds[0] = open_redirection(stage->input_file, REDIRECT_INPUT)) == -1) {
+        return -1;
+    }
+    if (stage->input_data != NULL && (fds[0] = open_here_data(stage->input_data, stage->input_len)) == -1) {
+        return -1;
+    }
+    if (stage->output_file != NULL &&
+        (fds[1] = open_redirection(stage->output_file, stage->append_output ? REDIRECT_APPEND : REDIRECT_OUTPUT)) == -1) {
+        close_stage_redirections(fds);
+        return -1;
+    }
+    if (stage->error_file != NULL && (fds[2] = open_redirection(stage->error_file, REDIRECT_OUTPUT)) == -1) {
+        close_stage_redirections(fds);
+        return -1;
+    }
+    return 0;
+}
+
+void close_stage_redirections(int fds[3]) {
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1) close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+// runs in the child: restores default signal state, installs stdin/stdout and execs
+// only returns on failure, with the error stored in req->exec_errno
+static void exec_child(struct spawn_request *req) {
+    struct sigaction sa_default;
+    sigset_t empty_mask;
+
+    if (req->pgid != -1) setpgid(0, req->pgid);
+    sa_default.sa_handler = SIG_DFL;
+    sa_default.sa_flags = 0;
+    sigemptyset(&sa_default.sa_mask);
+    sigaction(SIGINT, &sa_default, NULL);
+    sigaction(SIGCHLD, &sa_default, NULL);
+    sigaction(SIGTSTP, &sa_default, NULL);
+    sigaction(SIGTTIN, &sa_default, NULL);
+    sigaction(SIGTTOU, &sa_default, NULL);
+    sigemptyset(&empty_mask);
+    sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+    if (req->stdin_fd != -1 && dup2(req->stdin_fd, STDIN_FILENO) == -1) {
+        req->exec_errno = errno;
+        return;
+    }
+    if (req->stdout_fd != -1 && dup2(req->stdout_fd, STDOUT_FILENO) == -1) {
+        req->exec_errno = errno;
+        return;
+    }
+    if (req->stderr_fd != -1 && dup2(req->stderr_fd, STDERR_FILENO) == -1) {
+        req->exec_errno = errno;
+        return;
+    }
+
+    execve(req->path, req->args, shell_environment());
+    req->exec_errno = errno;
+}
+
+// entry point of the clone backend child
+static int clone_child(void *arg) {
+    exec_child((struct spawn_request *)arg);
+    _exit(127);
+}
+
+static pid_t spawn_with_posix_spawn(struct spawn_request *req) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t default_signals, empty_mask;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    if (req->stdin_fd != -1) posix_spawn_file_actions_adddup2(&actions, req->stdin_fd, STDIN_FILENO);
+    if (req->stdout_fd != -1) posix_spawn_file_actions_adddup2(&actions, req->stdout_fd, STDOUT_FILENO);
+    if (req->stderr_fd != -1) posix_spawn_file_actions_adddup2(&actions, req->stderr_fd, STDERR_FILENO);
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    sigaddset(&default_signals, SIGCHLD);
+    sigaddset(&default_signals, SIGTSTP);
+    sigaddset(&default_signals, SIGTTIN);
+    sigaddset(&default_signals, SIGTTOU);
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (req->pgid != -1) {
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    int err = posix_spawn(&pid, req->path, &actions, &attr, req->args, shell_environment());
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        req->exec_errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+// vfork and clone share the shell's memory with the child until exec, so all
+// signals are blocked around the call: a handler must never run in the child
+static pid_t spawn_shared_memory(struct spawn_request *req) {
+    sigset_t all_signals, orig_mask;
+    pid_t pid;
+
+    sigfillset(&all_signals);
+    sigprocmask(SIG_BLOCK, &all_signals, &orig_mask);
+
+    if (spawn_backend == SPAWN_VFORK) {
+        pid = vfork();
+        if (pid == 0) {
+            exec_child(req);
+            _exit(127);
+        }
+    } else {
+        pid = clone(clone_child, clone_stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, req);
+    }
+    int saved_errno = errno;
+
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+    if (pid == -1) {
+        req->exec_errno = saved_errno;
+        return -1;
+    }
+    // the child wrote exec_errno through the shared memory before exiting
+    if (req->exec_errno != 0) {
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t spawn_with_fork(struct spawn_request *req) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        exec_child(req);
+        fprintf(stderr, "bropesh: error running command \"%s\": %s\n", req->args[0], strerror(req->exec_errno));
+        _exit(127);
+    }
+    if (pid == -1) {
+        req->exec_errno = errno;
+    }
+    return pid;
+}
+
+// starts req->args as a child process using the selected backend
+// returns the child's pid, or -1 after printing an error
+pid_t spawn_process(struct spawn_request *req) {
+    pid_t pid;
+
+    // resolve the command in the parent so an unknown command never costs a spawn
+    req->path = resolve_command_path(req->args[0]);
+    if (req->path == NULL) {
+        fprintf(stderr, "bropesh: %s: command not found\n", req->args[0]);
+        return -1;
+    }
+
+    // output buffered by builtins must not end up after the child's output
+    fflush(stdout);
+
+    req->exec_errno = 0;
+    switch (spawn_backend) {
+    case SPAWN_POSIX_SPAWN:
+        pid = spawn_with_posix_spawn(req);
+        break;
+    case SPAWN_VFORK:
+    case SPAWN_CLONE:
+        pid = spawn_shared_memory(req);
+        break;
+    default:
+        pid = spawn_with_fork(req);
+        break;
+    }
+
+    if (pid == -1) {
+        fprintf(stderr, "bropesh: error running command \"%s\": %s\n", req->args[0], strerror(req->exec_errno));
+    }
+    return pid;
+}
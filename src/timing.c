@@ -0,0 +1,226 @@
+// timing.c
+// the time keyword: measures a command line without an extra /usr/bin/time exec
+// children are collected with wait4() (see jobs.c), so their cpu time, max rss,
+// page faults and context switches come for free. hardware counters (cycles,
+// instructions, cache misses) come from perf_event_open() when the kernel
+// allows it: the counters are opened on the shell with inherit set, so every
+// process the command line starts is counted. they are enabled just before the
+// command runs and only count user space, so the shell's own share is a few
+// thousand instructions of spawn and wait.
+//
+// output goes to stderr, like bash:
+//   time cmd       real/user/sys
+//   time -p cmd    posix format
+//   time -v cmd    also memory, faults, context switches and counters
+//   time -j cmd    one json object per command, for scripts
+//   -o file        appends the report to file instead
+
+#include "shell.h"
+#include <linux/perf_event.h> // for perf_event_attr
+#include <sys/ioctl.h>        // for the perf enable/disable ioctls
+#include <sys/syscall.h>      // for SYS_perf_event_open
+#include <sys/time.h>         // for timersub
+#include <time.h>             // for clock_gettime
+
+enum time_format { TIME_DEFAULT, TIME_POSIX, TIME_VERBOSE, TIME_JSON };
+
+enum { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, NUM_COUNTERS };
+
+static const struct {
+    const char *name;
+    unsigned int type;
+    unsigned long long config;
+} counters[NUM_COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+// set after the first perf_event_open failure, so unsupported systems only pay once
+static int perf_unavailable = 0;
+
+// opens a disabled, inherited user-space counter on the shell, -1 if unavailable
+static int open_counter(int index) {
+    struct perf_event_attr attr;
+    if (perf_unavailable) return -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counters[index].type;
+    attr.config = counters[index].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1 && (errno == ENOSYS || errno == EACCES || errno == EPERM || errno == ENOENT)) {
+        perf_unavailable = 1;
+    }
+    return fd;
+}
+
+static double seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// prints s as a json string
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// the command text for reports, rebuilt from the stages
+static void print_command(FILE *out, struct parsed_command *cmd) {
+    char text[4096];
+    size_t len = 0;
+    text[0] = '\0';
+    for (int i = 0; i < cmd->num_stages && len < sizeof(text) - 1; i++) {
+        if (i > 0) len += snprintf(text + len, sizeof(text) - len, " | ");
+        for (int j = 0; j < cmd->stages[i].argc && len < sizeof(text) - 1; j++) {
+            len += snprintf(text + len, sizeof(text) - len, (j > 0) ? " %s" : "%s", cmd->stages[i].args[j]);
+        }
+    }
+    print_json_string(out, text);
+}
+
+static void print_minutes(FILE *out, const char *label, double value) {
+    fprintf(out, "%s\t%dm%.3fs\n", label, (int)(value / 60), value - 60 * (int)(value / 60));
+}
+
+int builtin_time(struct parsed_command *parsed) {
+    // the command is run from a copy without the "time" words, parsed stays intact
+    struct pipeline_stage stages[MAX_PIPELINE_STAGES];
+    struct parsed_command timed = *parsed;
+    struct parsed_command *cmd = &timed;
+    memcpy(stages, parsed->stages, parsed->num_stages * sizeof(stages[0]));
+    timed.stages = stages;
+    struct pipeline_stage *stage = &stages[0];
+    enum time_format format = TIME_DEFAULT;
+    const char *output_path = NULL;
+
+    // options come before the command
+    int skip = 1;
+    while (skip < stage->argc && stage->args[skip][0] == '-') {
+        const char *option = stage->args[skip];
+        if (strcmp(option, "-p") == 0) {
+            format = TIME_POSIX;
+        } else if (strcmp(option, "-v") == 0) {
+            format = TIME_VERBOSE;
+        } else if (strcmp(option, "-j") == 0) {
+            format = TIME_JSON;
+        } else if (strcmp(option, "-o") == 0 && skip + 1 < stage->argc) {
+            output_path = stage->args[++skip];
+        } else if (strcmp(option, "--") == 0) {
+            skip++;
+            break;
+        } else {
+            fprintf(stderr, "bropesh: time: %s: invalid option\n", option);
+            fprintf(stderr, "bropesh: time: usage: time [-p | -v | -j] [-o file] command\n");
+            return 2;
+        }
+        skip++;
+    }
+    stage->args += skip;
+    stage->argc -= skip;
+
+    if (cmd->is_background) {
+        // nothing to wait for, so nothing to measure
+        return execute_parsed_command(cmd);
+    }
+
+    int counter_fds[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counter_fds[i] = (format == TIME_VERBOSE || format == TIME_JSON) ? open_counter(i) : -1;
+    }
+
+    struct rusage self_before, self_after, children;
+    struct timespec start, end;
+    reset_job_usage();
+    getrusage(RUSAGE_SELF, &self_before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (counter_fds[i] != -1) ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // "time" alone measures nothing, like bash
+    int exit_status = (stage->argc > 0 || cmd->num_stages > 1) ? execute_parsed_command(cmd) : 0;
+    fflush(stdout); // output of builtins comes before the report
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (counter_fds[i] != -1) ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self_after);
+    get_job_usage(&children);
+
+    long long counter_values[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counter_values[i] = -1;
+        if (counter_fds[i] != -1) {
+            unsigned long long value;
+            if (read(counter_fds[i], &value, sizeof(value)) == sizeof(value)) counter_values[i] = value;
+            close(counter_fds[i]);
+        }
+    }
+
+    // the shell's own share covers builtins, the children's covers everything else
+    struct timeval self_user, self_sys;
+    timersub(&self_after.ru_utime, &self_before.ru_utime, &self_user);
+    timersub(&self_after.ru_stime, &self_before.ru_stime, &self_sys);
+    double real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double user = seconds(children.ru_utime) + seconds(self_user);
+    double sys = seconds(children.ru_stime) + seconds(self_sys);
+    long max_rss = (children.ru_maxrss > 0) ? children.ru_maxrss : self_after.ru_maxrss;
+    long minor_faults = children.ru_minflt + (self_after.ru_minflt - self_before.ru_minflt);
+    long major_faults = children.ru_majflt + (self_after.ru_majflt - self_before.ru_majflt);
+    long voluntary = children.ru_nvcsw + (self_after.ru_nvcsw - self_before.ru_nvcsw);
+    long involuntary = children.ru_nivcsw + (self_after.ru_nivcsw - self_before.ru_nivcsw);
+
+    FILE *out = stderr;
+    if (output_path != NULL) {
+        out = fopen(output_path, "ae");
+        if (out == NULL) {
+            fprintf(stderr, "bropesh: time: %s: %s\n", output_path, strerror(errno));
+            return exit_status;
+        }
+    }
+
+    if (format == TIME_POSIX) {
+        fprintf(out, "real %.2f\nuser %.2f\nsys %.2f\n", real, user, sys);
+    } else if (format == TIME_JSON) {
+        fprintf(out, "{\"command\":");
+        print_command(out, cmd);
+        fprintf(out, ",\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"max_rss_kb\":%ld,"
+                     "\"minor_faults\":%ld,\"major_faults\":%ld,\"voluntary_switches\":%ld,\"involuntary_switches\":%ld",
+                exit_status, real, user, sys, max_rss, minor_faults, major_faults, voluntary, involuntary);
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counter_values[i] >= 0) fprintf(out, ",\"%s\":%lld", counters[i].name, counter_values[i]);
+        }
+        fprintf(out, "}\n");
+    } else {
+        fprintf(out, "\n");
+        print_minutes(out, "real", real);
+        print_minutes(out, "user", user);
+        print_minutes(out, "sys", sys);
+        if (format == TIME_VERBOSE) {
+            fprintf(out, "max rss\t%ld KiB\n", max_rss);
+            fprintf(out, "faults\t%ld minor, %ld major\n", minor_faults, major_faults);
+            fprintf(out, "switches\t%ld voluntary, %ld involuntary\n", voluntary, involuntary);
+            for (int i = 0; i < NUM_COUNTERS; i++) {
+                if (counter_values[i] >= 0) fprintf(out, "%s\t%lld\n", counters[i].name, counter_values[i]);
+            }
+            if (counter_values[COUNTER_CYCLES] > 0 && counter_values[COUNTER_INSTRUCTIONS] >= 0) {
+                fprintf(out, "ipc\t%.2f\n", (double)counter_values[COUNTER_INSTRUCTIONS] / counter_values[COUNTER_CYCLES]);
+            }
+        }
+    }
+
+    if (out != stderr) fclose(out);
+    return exit_status;
+}
@@ -2,6 +2,11 @@
 // utility functions for string manipulation and parsing
 
 #include "shell.h"
+#include <sys/sendfile.h> // for sendfile
+#include <sys/stat.h>     // for mkdir
+
+// read/write buffer of copy_fd_to_fd when no kernel-side copy works
+#define COPY_BUFFER_SIZE (128 * 1024)
 
 // trims leading and trailing whitespace from a string
 char *trim_whitespace(char *str) {
@@ -25,155 +30,494 @@ char *trim_whitespace(char *str) {
     return str;
 }
 
-// helper function to add a token to the args array
-// returns 0 on success, -1 on error
-int add_token(char **args, int *num_args, char *token) {
-    if (*num_args >= MAX_ARGS - 1) {
-        fprintf(stderr, "myshell: too many arguments.\n");
-        return -1;
+// characters that end a word when they are not inside quotes
+static int is_operator_char(char c) {
+    return c == '|' || c == '<' || c == '>' || c == '&' || c == ';';
+}
+
+// the end of the pipeline starting at p: the first unquoted ';', '&' or "||"
+// outside $(...), or the newline that separates the command from here-documents
+static const char *pipeline_end(const char *p) {
+    int in_quote = 0;
+    for (; *p != '\0' && *p != '\n'; p++) {
+        if (p[0] == '$' && p[1] == '(') {
+            const char *close = substitution_end(p);
+            // not closed: the word loop reports it
+            if (close == NULL) return p + strcspn(p, "\n");
+            p = close - 1;
+        } else if (*p == '"') {
+            in_quote = !in_quote;
+        } else if (!in_quote && (*p == ';' || *p == '&' || (p[0] == '|' && p[1] == '|'))) {
+            break;
+        }
     }
-    args[*num_args] = strdup(token);
-    if (args[*num_args] == NULL) {
-        perror("myshell: strdup failed");
-        return -1;
+    return p;
+}
+
+// what a pending redirection is missing, for the syntax error
+static const char *redirect_target(char redirect) {
+    if (redirect == '<') return "input file";
+    if (redirect == '2') return "error file";
+    if (redirect == 'h') return "here-string";
+    if (redirect == 'd') return "here-document delimiter";
+    return "output file";
+}
+
+// whether the text between p and end has a $ expansion
+static int has_expansions(const char *p, const char *end) {
+    for (; p + 1 < end; p++) {
+        if (p[0] == '$' && expansion_end(p) != p) return 1;
     }
-    (*num_args)++;
-    args[*num_args] = NULL;
     return 0;
 }
 
-// tokenizes the input string into arguments
-// handles quotes "", background '&', input '<', and output '>' redirection
-char **tokenize_input(char *input, int *num_args, int *is_background, char **input_file, char **output_file) {
-    char **args = (char **)malloc(MAX_ARGS * sizeof(char *));
-    if (args == NULL) {
-        perror("myshell: malloc failed for args");
-        *num_args = 0;
-        return NULL;
+// copies the body of the here-document ended by delimiter into the arena and
+// moves *heredocs past its delimiter line; on first use the bodies start on the
+// line after the command at p. returns the body or NULL
+static char *read_here_document(const char **heredocs, const char *p, const char *delimiter, int warn,
+                                struct arena *arena, size_t *len) {
+    if (*heredocs == NULL) {
+        const char *newline = strchr(p, '\n');
+        *heredocs = (newline != NULL) ? newline + 1 : p + strlen(p);
     }
+    const char *start = *heredocs, *line = start;
+    size_t delimiter_len = strlen(delimiter);
+    while (*line != '\0') {
+        size_t line_len = strcspn(line, "\n");
+        if (line_len == delimiter_len && strncmp(line, delimiter, delimiter_len) == 0) {
+            *heredocs = line + line_len + (line[line_len] == '\n');
+            *len = line - start;
+            return arena_strndup(arena, start, *len);
+        }
+        line += line_len + (line[line_len] == '\n');
+    }
+    // like bash, what there is counts as the body, its last line ended by a newline
+    if (warn) fprintf(stderr, "bropesh: warning: here-document delimited by end of input (wanted '%s').\n", delimiter);
+    *heredocs = line;
+    *len = line - start;
+    int add_newline = (*len > 0 && line[-1] != '\n');
+    char *body = arena_alloc(arena, *len + add_newline + 1);
+    if (body == NULL) return NULL;
+    memcpy(body, start, *len);
+    if (add_newline) body[(*len)++] = '\n';
+    body[*len] = '\0';
+    return body;
+}
 
-    *num_args = 0;
-    *is_background = 0;
-    *input_file = NULL;
-    *output_file = NULL;
-
-    // temporary list to hold raw tokens before processing redirection
-    char *raw_tokens[MAX_ARGS];
-    int raw_count = 0;
+// characters that stay literal in a glob pattern only when escaped
+static int is_glob_special(char c) {
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
 
-    char *p = input;
-    char buffer[MAX_COMMAND_LENGTH];
-    int buf_idx = 0;
+// the glob pattern of the word between start and end: quotes are dropped and
+// the characters they protected (and every backslash) get a backslash in front
+static char *escape_glob_word(const char *start, const char *end, struct arena *arena) {
+    char *pattern = arena_alloc(arena, 2 * (end - start) + 1);
+    if (pattern == NULL) return NULL;
+    char *out = pattern;
     int in_quote = 0;
+    for (const char *p = start; p < end; p++) {
+        if (*p == '"') {
+            in_quote = !in_quote;
+            continue;
+        }
+        if ((in_quote && is_glob_special(*p)) || *p == '\\') *out++ = '\\';
+        *out++ = *p;
+    }
+    *out = '\0';
+    return pattern;
+}
+
+// tokenizes one pipeline of the input in a single pass and moves *input past
+// the separator that ended it ('&' also marks the pipeline as background).
+// handles quotes "", pipes '|', input '<', output '>', append '>>', stderr
+// '2>', here-strings '<<<' and here-documents '<<'. arguments with unquoted *, ?
+// or [ are expanded to the matching paths (glob.c) as they are read.
+// a pipeline with $ expansions is only checked and marked needs_expansion,
+// unless expand is set: then they are expanded and their results become words.
+// token text, argv arrays and stages are all allocated from the arena; the
+// input itself is left untouched. returns the separator, or -1 on a syntax error.
+static int tokenize(const char **input, const char **heredocs, int expand, struct arena *arena,
+                    struct parsed_command *cmd) {
+    const char *end = pipeline_end(*input);
+    size_t len = end - *input;
+    // every token needs at least one input character plus a separator, so these are upper bounds
+    // (max_slots grows by the extra arguments each glob expands to)
+    size_t max_slots = (len + 1) / 2 + MAX_PIPELINE_STAGES + 1;
+    size_t slot_capacity = max_slots;
+    char **argv_slots = arena_alloc(arena, slot_capacity * sizeof(char *));
+    char *text = arena_alloc(arena, len + 1);
+    cmd->stages = arena_alloc(arena, MAX_PIPELINE_STAGES * sizeof(struct pipeline_stage));
+    cmd->num_stages = 0;
+    cmd->is_background = 0;
+    cmd->source = *input;
+    cmd->heredocs = *heredocs;
+    cmd->needs_expansion = !expand && has_expansions(*input, end);
+    if (argv_slots == NULL || text == NULL || cmd->stages == NULL) {
+        return -1;
+    }
 
-    while (*p) {
-        // skip leading whitespace if not in quote
-        while (!in_quote && isspace((unsigned char)*p)) p++;
+    int num_slots = 0;
+    char pending_redirect = 0; // '<', '>', 'a' (>>) or '2' (2>) waiting for its file name
+    const char *p = *input;
 
-        if (*p == '\0') break;
+    struct pipeline_stage *stage = &cmd->stages[cmd->num_stages++];
+    memset(stage, 0, sizeof(*stage));
+    stage->args = &argv_slots[num_slots];
 
-        buf_idx = 0;
-        // parse a single token
-        while (*p) {
-            if (*p == '"') {
-                in_quote = !in_quote; // toggle quote mode
+    while (1) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+
+        // "2>" only redirects stderr at the start of a word, "a2>b" stays one argument
+        int is_error_redirect = (p[0] == '2' && p[1] == '>');
+        if (is_operator_char(*p) || is_error_redirect) {
+            if (pending_redirect) {
+                fprintf(stderr, "bropesh: syntax error: no %s specified.\n", redirect_target(pending_redirect));
+                return -1;
+            }
+            if (*p == '|') {
+                argv_slots[num_slots++] = NULL; // terminate the previous stage's argv
+                if (cmd->num_stages >= MAX_PIPELINE_STAGES) {
+                    fprintf(stderr, "bropesh: too many commands in pipeline (max %d).\n", MAX_PIPELINE_STAGES);
+                    return -1;
+                }
+                stage = &cmd->stages[cmd->num_stages++];
+                memset(stage, 0, sizeof(*stage));
+                stage->args = &argv_slots[num_slots];
+            } else if (is_error_redirect) {
+                pending_redirect = '2';
+                p++;
+            } else if (p[0] == '<' && p[1] == '<' && p[2] == '<') {
+                pending_redirect = 'h';
+                p += 2;
+            } else if (p[0] == '<' && p[1] == '<') {
+                pending_redirect = 'd';
                 p++;
-                continue; // do not add the quote char itself to the buffer
+            } else if (p[0] == '>' && p[1] == '>') {
+                pending_redirect = 'a';
+                p++;
+            } else {
+                pending_redirect = *p;
             }
+            p++;
+            continue;
+        }
 
-            if (!in_quote && isspace((unsigned char)*p)) {
-                break; // end of token found
+        // copy one word, dropping the quote characters themselves
+        const char *word_start = p;
+        char *word = text;
+        int in_quote = 0;
+        int is_pattern = 0;     // an unquoted *, ? or [
+        int needs_escape = 0;   // quoted glob characters or backslashes that must stay literal
+        int has_expansion = 0;  // has $(...), $name, ${name}, $? or $$
+        while (*p && *p != '\n' && (in_quote || (!isspace((unsigned char)*p) && !is_operator_char(*p)))) {
+            const char *close = expansion_end(p);
+            if (close != p) {
+                // kept as typed here, expand_word expands it
+                if (close == NULL) {
+                    fprintf(stderr, "bropesh: syntax error: unterminated %.2s.\n", p);
+                    return -1;
+                }
+                memcpy(text, p, close - p);
+                text += close - p;
+                p = close;
+                has_expansion = 1;
+                continue;
+            } else if (*p == '"') {
+                in_quote = !in_quote; // toggle quote mode
+            } else {
+                if (!in_quote && (*p == '*' || *p == '?' || *p == '[')) is_pattern = 1;
+                if ((in_quote && is_glob_special(*p)) || *p == '\\') needs_escape = 1;
+                *text++ = *p;
             }
-
-            buffer[buf_idx++] = *p++;
+            p++;
         }
-        buffer[buf_idx] = '\0';
+        *text++ = '\0';
 
-        if (raw_count < MAX_ARGS) {
-            raw_tokens[raw_count++] = strdup(buffer);
+        char **matches = NULL;
+        int num_matches = 0;
+        int is_expanded = 0; // matches holds the words the expansions produced, maybe none
+        if (has_expansion && expand) {
+            // redirection targets and here-strings stay one word
+            if ((num_matches = expand_word(word_start, p, !pending_redirect, arena, &matches)) == -1) return -1;
+            if (pending_redirect) word = matches[0];
+            is_expanded = 1;
+        } else if (is_pattern && !pending_redirect && !cmd->needs_expansion) {
+            char *pattern = needs_escape ? escape_glob_word(word_start, p, arena) : word;
+            if (pattern == NULL || (num_matches = glob_expand(pattern, arena, &matches)) == -1) return -1;
+        }
+        if (num_matches > 1) {
+            max_slots += num_matches - 1;
+            if (max_slots > slot_capacity) {
+                // the argv arrays move, the stages' pointers into them move along
+                slot_capacity = (max_slots > 2 * slot_capacity) ? max_slots : 2 * slot_capacity;
+                char **grown = arena_alloc(arena, slot_capacity * sizeof(char *));
+                if (grown == NULL) return -1;
+                memcpy(grown, argv_slots, num_slots * sizeof(char *));
+                for (int i = 0; i < cmd->num_stages; i++) {
+                    cmd->stages[i].args = grown + (cmd->stages[i].args - argv_slots);
+                }
+                argv_slots = grown;
+            }
         }
-    }
 
-    // process raw tokens to handle redirection and background
-    for (int i = 0; i < raw_count; i++) {
-        if (strcmp(raw_tokens[i], "&") == 0) {
-            // check if it is the last token
-            if (i == raw_count - 1) {
-                *is_background = 1;
-            } else {
-                // if & is strictly treated as a separator in standard shells,
-                // this might need different logic, but for this assignment
-                // we usually assume it's at the end.
-                // treating it as a syntax error if not at end based on previous logic.
-                fprintf(stderr, "myshell: syntax error: '&' must be the last argument.\n");
-
-                // cleanup
-                for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                free_tokens(args);
-                *num_args = 0;
-                return NULL;
+        if (pending_redirect == '<' || pending_redirect == 'h' || pending_redirect == 'd') {
+            if (stage->input_file != NULL || stage->input_data != NULL) {
+                fprintf(stderr, "bropesh: multiple input files specified.\n");
+                return -1;
             }
-        } else if (strcmp(raw_tokens[i], "<") == 0) {
-            if (i + 1 < raw_count) {
-                if (*input_file != NULL) {
-                    fprintf(stderr, "myshell: multiple input files specified.\n");
-                    // cleanup
-                    for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                    free_tokens(args);
-                    *num_args = 0;
-                    return NULL;
-                }
-                *input_file = strdup(raw_tokens[i + 1]);
-                i++; // skip the filename token
+            if (pending_redirect == '<') {
+                stage->input_file = word;
+            } else if (pending_redirect == 'd') {
+                stage->input_data = read_here_document(heredocs, p, word, !expand, arena, &stage->input_len);
+                if (stage->input_data == NULL) return -1;
             } else {
-                fprintf(stderr, "myshell: syntax error: no input file specified.\n");
-                for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                free_tokens(args);
-                *num_args = 0;
-                return NULL;
+                // a here-string is the word and a newline
+                stage->input_len = strlen(word) + 1;
+                if ((stage->input_data = arena_alloc(arena, stage->input_len)) == NULL) return -1;
+                memcpy(stage->input_data, word, stage->input_len - 1);
+                stage->input_data[stage->input_len - 1] = '\n';
             }
-        } else if (strcmp(raw_tokens[i], ">") == 0) {
-            if (i + 1 < raw_count) {
-                if (*output_file != NULL) {
-                    fprintf(stderr, "myshell: multiple output files specified.\n");
-                    for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                    free_tokens(args);
-                    *num_args = 0;
-                    return NULL;
-                }
-                *output_file = strdup(raw_tokens[i + 1]);
-                i++; // skip the filename token
-            } else {
-                fprintf(stderr, "myshell: syntax error: no output file specified.\n");
-                for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                free_tokens(args);
-                *num_args = 0;
-                return NULL;
+        } else if (pending_redirect == '>' || pending_redirect == 'a') {
+            if (stage->output_file != NULL) {
+                fprintf(stderr, "bropesh: multiple output files specified.\n");
+                return -1;
             }
-        } else {
-            // normal argument
-            if (add_token(args, num_args, raw_tokens[i]) == -1) {
-                for(int k=0; k<raw_count; k++) free(raw_tokens[k]);
-                free_tokens(args);
-                *num_args = 0;
-                return NULL;
+            stage->output_file = word;
+            stage->append_output = (pending_redirect == 'a');
+        } else if (pending_redirect == '2') {
+            if (stage->error_file != NULL) {
+                fprintf(stderr, "bropesh: multiple error files specified.\n");
+                return -1;
             }
+            stage->error_file = word;
+        } else if (num_matches > 0 || is_expanded) {
+            if (num_matches > 0) memcpy(&argv_slots[num_slots], matches, num_matches * sizeof(char *));
+            num_slots += num_matches;
+            stage->argc += num_matches;
+        } else {
+            // no pattern, or one without matches, which is kept as it was typed
+            argv_slots[num_slots++] = word;
+            stage->argc++;
         }
+        pending_redirect = 0;
     }
 
-    // free the raw intermediate tokens
-    for (int i = 0; i < raw_count; i++) {
-        free(raw_tokens[i]);
+    if (pending_redirect) {
+        fprintf(stderr, "bropesh: syntax error: no %s specified.\n", redirect_target(pending_redirect));
+        return -1;
     }
+    argv_slots[num_slots] = NULL;
 
-    return args;
+    // stdin and stdout redirections in a pipeline only make sense at its ends,
+    // stderr can be redirected on any stage
+    for (int i = 0; i < cmd->num_stages; i++) {
+        stage = &cmd->stages[i];
+        if ((stage->input_file != NULL || stage->input_data != NULL) && i != 0) {
+            fprintf(stderr, "bropesh: syntax error: input redirection only allowed on the first command of a pipeline.\n");
+            return -1;
+        }
+        if (stage->output_file != NULL && i != cmd->num_stages - 1) {
+            fprintf(stderr, "bropesh: syntax error: output redirection only allowed on the last command of a pipeline.\n");
+            return -1;
+        }
+        if (stage->argc == 0 && cmd->num_stages > 1 && (i != 0 || (stage->input_file == NULL && stage->input_data == NULL))) {
+            fprintf(stderr, "bropesh: syntax error: empty command in pipeline.\n");
+            return -1;
+        }
+    }
+
+    enum separator separator = SEPARATOR_END;
+    if (end[0] == '&' && end[1] == '&') {
+        separator = SEPARATOR_AND;
+        end += 2;
+    } else if (end[0] == '|') {
+        separator = SEPARATOR_OR;
+        end += 2;
+    } else if (*end == '&' || *end == ';') {
+        cmd->is_background = (*end == '&');
+        separator = SEPARATOR_SEQUENCE;
+        end++;
+    } else if (*end == '\n') {
+        // only here-document bodies follow, they belong to the pipelines before
+        end += strlen(end);
+    }
+    *input = end;
+    return separator;
+}
+
+int tokenize_pipeline(const char **input, const char **heredocs, struct arena *arena, struct parsed_command *cmd) {
+    return tokenize(input, heredocs, 0, arena, cmd);
+}
+
+int expand_pipeline(const struct parsed_command *cmd, struct arena *arena, struct parsed_command *expanded) {
+    const char *input = cmd->source;
+    const char *heredocs = cmd->heredocs;
+    // $? has to see the status from before, so it is only set on failure
+    if (tokenize(&input, &heredocs, 1, arena, expanded) != -1) return 0;
+    // a substitution stopped by ctrl+c already set 130
+    if (last_exit_status != 128 + SIGINT) last_exit_status = EXIT_FAILURE;
+    return -1;
+}
+
+// tokenizes input that must hold exactly one pipeline (optionally ending in '&')
+// returns 0 on success, -1 on a syntax error
+int tokenize_input(const char *input, struct arena *arena, struct parsed_command *cmd) {
+    const char *heredocs = NULL;
+    int separator = tokenize_pipeline(&input, &heredocs, arena, cmd);
+    if (separator == -1) return -1;
+    while (isspace((unsigned char)*input)) input++;
+    if (separator == SEPARATOR_AND || separator == SEPARATOR_OR || *input != '\0') {
+        fprintf(stderr, "bropesh: syntax error: a single command or pipeline is expected here.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int find_here_delimiters(const char *line, struct arena *arena, char ***delimiters) {
+    int count = 0, capacity = 0, in_quote = 0;
+    *delimiters = NULL;
+    for (const char *p = line; *p != '\0'; p++) {
+        if (p[0] == '$' && p[1] == '(') {
+            const char *close = substitution_end(p);
+            if (close == NULL) break;
+            p = close - 1;
+            continue;
+        }
+        if (*p == '"') in_quote = !in_quote;
+        if (in_quote || p[0] != '<' || p[1] != '<') continue;
+        if (p[2] == '<') {
+            p += 2; // a here-string
+            continue;
+        }
+
+        // the delimiter is the next word without its quotes
+        for (p += 2; *p == ' ' || *p == '\t'; p++) {
+        }
+        const char *start = p;
+        int word_quote = 0;
+        while (*p && (word_quote || (!isspace((unsigned char)*p) && !is_operator_char(*p)))) {
+            if (*p == '"') word_quote = !word_quote;
+            p++;
+        }
+        if (p == start) break; // the syntax error is reported when the line is tokenized
+        char *delimiter = arena_alloc(arena, p - start + 1), *out = delimiter;
+        if (delimiter == NULL) break;
+        for (const char *q = start; q < p; q++) {
+            if (*q != '"') *out++ = *q;
+        }
+        *out = '\0';
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            char **grown = arena_alloc(arena, capacity * sizeof(char *));
+            if (grown == NULL) break;
+            if (count > 0) memcpy(grown, *delimiters, count * sizeof(char *));
+            *delimiters = grown;
+        }
+        (*delimiters)[count++] = delimiter;
+        p--;
+    }
+    return count;
 }
 
-// frees memory allocated for tokens
-void free_tokens(char **tokens) {
-    if (tokens == NULL) return;
-    for (int i = 0; tokens[i] != NULL; i++) {
-        free(tokens[i]);
+int open_cache_dir(const char *name, int create) {
+    char path[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    int len;
+    if (xdg != NULL && xdg[0] == '/') {
+        len = snprintf(path, sizeof(path), "%s/bropesh/%s", xdg, name);
+    } else if (home_dir != NULL) {
+        len = snprintf(path, sizeof(path), "%s/.cache/bropesh/%s", home_dir, name);
+    } else {
+        errno = ENOENT;
+        return -1;
+    }
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    // mkdir -p
+    for (char *p = path + 1; create; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdir(path, 0700) == -1 && errno != EEXIST) return -1;
+        *p = c;
+        if (c == '\0') break;
+    }
+    return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int create_temp_file(int dir_fd, char *tmp, size_t size) {
+    static unsigned counter = 0;
+    snprintf(tmp, size, ".tmp.%ld.%u", (long)getpid(), counter++);
+    return openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+}
+
+int install_temp_file(int dir_fd, int fd, const char *tmp, const char *path, int ok) {
+    if (close(fd) == -1) ok = 0;
+    if (ok && renameat(dir_fd, tmp, dir_fd, path) == 0) return 0;
+    int saved_errno = errno;
+    unlinkat(dir_fd, tmp, 0);
+    errno = saved_errno;
+    return -1;
+}
+
+static int write_all(int fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buffer, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// the kernel-side calls are tried in turn, and whatever one of them refuses
+// (an O_APPEND output, a file system without copy_file_range, a socket...) is
+// finished with read and write from where it stopped, so no caller needs a
+// fallback of its own
+int copy_fd_to_fd(int in_fd, int out_fd, off_t start) {
+    struct stat in_st, out_st;
+    int in_regular = (fstat(in_fd, &in_st) == 0 && S_ISREG(in_st.st_mode));
+    int pipe_involved = (!in_regular && S_ISFIFO(in_st.st_mode)) ||
+                        (fstat(out_fd, &out_st) == 0 && S_ISFIFO(out_st.st_mode));
+    off_t offset = start;
+    off_t *position = (start >= 0) ? &offset : NULL;
+    ssize_t n;
+
+    if (in_regular) {
+        // file to file stays in the kernel (or the file system, for reflinks)
+        while ((n = copy_file_range(in_fd, position, out_fd, NULL, COPY_BUFFER_SIZE * 64, 0)) > 0 ||
+               (n == -1 && errno == EINTR)) {
+        }
+        if (n == 0) return 0;
+        // not file to file: sendfile works for most outputs
+        while ((n = sendfile(out_fd, in_fd, position, COPY_BUFFER_SIZE * 64)) > 0 || (n == -1 && errno == EINTR)) {
+        }
+        if (n == 0) return 0;
+    } else if (pipe_involved && position == NULL) {
+        while ((n = splice(in_fd, NULL, out_fd, NULL, COPY_BUFFER_SIZE, SPLICE_F_MOVE)) > 0 ||
+               (n == -1 && errno == EINTR)) {
+        }
+        if (n == 0) return 0;
+    }
+
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL) return -1;
+    for (;;) {
+        n = (position != NULL) ? pread(in_fd, buffer, COPY_BUFFER_SIZE, offset) : read(in_fd, buffer, COPY_BUFFER_SIZE);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0 || write_all(out_fd, buffer, n) == -1) break;
+        offset += n;
     }
-    free(tokens);
+    int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return (n == 0) ? 0 : -1;
 }
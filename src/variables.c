@@ -0,0 +1,293 @@
+// variables.c
+// shell variables and the environment passed to every command
+// variables live in an open-addressing hash table (linear probing, fnv-1a),
+// so a $NAME reference costs one hash and usually one string compare. each
+// variable is stored as a single "NAME=value" string, which is exactly what
+// an envp entry looks like: exported variables are listed in an envp array
+// that points at those strings, and setting, exporting or unsetting one only
+// swaps, appends or removes a single pointer. spawns pass the array as it is,
+// so no command ever re-serializes the environment. environ points at the same
+// array, which keeps getenv() in the rest of the shell in sync.
+
+#include "shell.h"
+
+#define VARIABLES_INITIAL_SIZE 128
+
+struct variable {
+    char *entry;     // "name=value", NULL for an unused slot
+    size_t name_len;
+    size_t hash;
+    int envp_index;  // position in envp, -1 if the variable is not exported
+};
+
+static struct variable *table = NULL;
+static size_t table_size = 0;
+static size_t num_variables = 0;
+// exported entries, NULL-terminated
+static char **envp = NULL;
+static int envp_count = 0;
+static int envp_capacity = 0;
+
+// arguments of the running function, NULL outside functions
+static char **positional_args = NULL;
+
+// bumped whenever PATH changes, so the PATH cache does not have to compare strings
+unsigned long path_generation = 0;
+
+// fnv-1a hash of a variable name
+static size_t hash_name(const char *name, size_t len) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// returns the slot holding name, or the empty slot where it belongs
+static struct variable *find_slot(const char *name, size_t len, size_t hash) {
+    size_t mask = table_size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct variable *var = &table[i];
+        if (var->entry == NULL) return var;
+        if (var->hash == hash && var->name_len == len && memcmp(var->entry, name, len) == 0) return var;
+    }
+}
+
+static struct variable *lookup(const char *name, size_t len) {
+    if (table == NULL) return NULL;
+    struct variable *var = find_slot(name, len, hash_name(name, len));
+    return (var->entry != NULL) ? var : NULL;
+}
+
+// doubles the table, returns 0 or -1 after printing an error
+static int grow_table() {
+    size_t new_size = table_size ? table_size * 2 : VARIABLES_INITIAL_SIZE;
+    struct variable *new_table = calloc(new_size, sizeof(struct variable));
+    if (new_table == NULL) {
+        perror("bropesh: malloc failed for variables");
+        return -1;
+    }
+    struct variable *old_table = table;
+    size_t old_size = table_size;
+    table = new_table;
+    table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_table[i].entry != NULL) *find_slot(old_table[i].entry, old_table[i].name_len, old_table[i].hash) = old_table[i];
+    }
+    free(old_table);
+    return 0;
+}
+
+// adds the variable's entry to envp, returns 0 or -1 after printing an error
+static int add_to_envp(struct variable *var) {
+    if (envp_count + 1 >= envp_capacity) {
+        int capacity = envp_capacity ? envp_capacity * 2 : 64;
+        char **grown = realloc(envp, capacity * sizeof(char *));
+        if (grown == NULL) {
+            perror("bropesh: malloc failed for the environment");
+            return -1;
+        }
+        envp = grown;
+        envp_capacity = capacity;
+        environ = envp;
+    }
+    var->envp_index = envp_count;
+    envp[envp_count++] = var->entry;
+    envp[envp_count] = NULL;
+    return 0;
+}
+
+// removes the variable's entry from envp, the last entry takes its place
+static void remove_from_envp(struct variable *var) {
+    int index = var->envp_index;
+    char *last = envp[--envp_count];
+    envp[index] = last;
+    envp[envp_count] = NULL;
+    var->envp_index = -1;
+    if (index != envp_count) {
+        struct variable *moved = lookup(last, strcspn(last, "="));
+        if (moved != NULL) moved->envp_index = index;
+    }
+}
+
+int is_valid_name(const char *name, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_')) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') return 0;
+    }
+    return 1;
+}
+
+const char *get_variable(const char *name, size_t len) {
+    struct variable *var = lookup(name, len);
+    return (var != NULL) ? var->entry + var->name_len + 1 : NULL;
+}
+
+int set_variable(const char *name, size_t len, const char *value, int export) {
+    if (table == NULL || 10 * (num_variables + 1) > 7 * table_size) {
+        if (grow_table() == -1) return -1;
+    }
+    size_t hash = hash_name(name, len);
+    struct variable *var = find_slot(name, len, hash);
+
+    char *entry = NULL;
+    if (value != NULL || var->entry == NULL) {
+        // keep "export NAME" of an unset variable as an empty one
+        size_t value_len = (value != NULL) ? strlen(value) : 0;
+        entry = malloc(len + value_len + 2);
+        if (entry == NULL) {
+            perror("bropesh: malloc failed for variable");
+            return -1;
+        }
+        memcpy(entry, name, len);
+        entry[len] = '=';
+        memcpy(entry + len + 1, (value != NULL) ? value : "", value_len + 1);
+    }
+
+    if (var->entry == NULL) {
+        var->entry = entry;
+        var->name_len = len;
+        var->hash = hash;
+        var->envp_index = -1;
+        num_variables++;
+    } else if (entry != NULL) {
+        // the envp slot points at the new string from now on
+        free(var->entry);
+        var->entry = entry;
+        if (var->envp_index != -1) envp[var->envp_index] = entry;
+    }
+    if (export && var->envp_index == -1 && add_to_envp(var) == -1) return -1;
+    if (len == 4 && memcmp(name, "PATH", 4) == 0) path_generation++;
+    return 0;
+}
+
+void unset_variable(const char *name, size_t len) {
+    struct variable *var = lookup(name, len);
+    if (var == NULL) return;
+    if (var->envp_index != -1) remove_from_envp(var);
+    free(var->entry);
+    var->entry = NULL;
+    num_variables--;
+    if (len == 4 && memcmp(name, "PATH", 4) == 0) path_generation++;
+
+    // backward shift deletion: entries after the hole move up unless they
+    // already sit at or after their home slot
+    size_t mask = table_size - 1;
+    size_t hole = var - table;
+    for (size_t i = (hole + 1) & mask; table[i].entry != NULL; i = (i + 1) & mask) {
+        size_t home = table[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table[hole] = table[i];
+            table[i].entry = NULL;
+            hole = i;
+        }
+    }
+}
+
+char **shell_environment() {
+    return (envp != NULL) ? envp : environ;
+}
+
+char **set_positional_args(char **args) {
+    char **previous = positional_args;
+    positional_args = args;
+    return previous;
+}
+
+const char *get_positional_arg(int n) {
+    if (positional_args == NULL) return (n == 0) ? "bropesh" : NULL;
+    for (int i = 0; i < n; i++) {
+        if (positional_args[i] == NULL) return NULL;
+    }
+    return positional_args[n];
+}
+
+int count_positional_args() {
+    int count = 0;
+    while (positional_args != NULL && positional_args[count + 1] != NULL) count++;
+    return count;
+}
+
+void init_variables() {
+    for (char **env = environ; env != NULL && *env != NULL; env++) {
+        const char *equals = strchr(*env, '=');
+        if (equals != NULL && set_variable(*env, equals - *env, equals + 1, 1) == -1) break;
+    }
+    // an empty environment still needs its terminating NULL
+    if (envp == NULL && (envp = calloc(1, sizeof(char *))) != NULL) envp_capacity = 1;
+    if (envp != NULL) environ = envp;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int builtin_export(char **args) {
+    int status = 0;
+    if (args[1] == NULL) {
+        // sorted, like bash, so the list is easy to scan
+        char **sorted = malloc((envp_count + 1) * sizeof(char *));
+        if (sorted == NULL) {
+            perror("bropesh: export: malloc failed");
+            return 1;
+        }
+        if (envp_count > 0) memcpy(sorted, envp, envp_count * sizeof(char *));
+        qsort(sorted, envp_count, sizeof(char *), compare_entries);
+        for (int i = 0; i < envp_count; i++) {
+            size_t name_len = strcspn(sorted[i], "=");
+            printf("export %.*s=\"%s\"\n", (int)name_len, sorted[i], sorted[i] + name_len + 1);
+        }
+        free(sorted);
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        size_t name_len = strcspn(args[i], "=");
+        if (!is_valid_name(args[i], name_len)) {
+            fprintf(stderr, "bropesh: export: '%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        const char *value = (args[i][name_len] == '=') ? args[i] + name_len + 1 : NULL;
+        if (set_variable(args[i], name_len, value, 1) == -1) status = 1;
+    }
+    return status;
+}
+
+int builtin_unset(char **args) {
+    int status = 0;
+    if (args[1] != NULL && strcmp(args[1], "-f") == 0) {
+        for (int i = 2; args[i] != NULL; i++) {
+            if (undefine_function(args[i]) == -1) {
+                fprintf(stderr, "bropesh: unset: %s: not a function\n", args[i]);
+                status = 1;
+            }
+        }
+        return status;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        if (!is_valid_name(args[i], strlen(args[i]))) {
+            fprintf(stderr, "bropesh: unset: '%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        unset_variable(args[i], strlen(args[i]));
+    }
+    return status;
+}
+
+int is_assignment_list(char **args) {
+    for (int i = 0; args[i] != NULL; i++) {
+        size_t name_len = strcspn(args[i], "=");
+        if (args[i][name_len] != '=' || !is_valid_name(args[i], name_len)) return 0;
+    }
+    return 1;
+}
+
+int assign_variables(char **args) {
+    for (int i = 0; args[i] != NULL; i++) {
+        size_t name_len = strcspn(args[i], "=");
+        if (set_variable(args[i], name_len, args[i] + name_len + 1, 0) == -1) return 1;
+    }
+    return 0;
+}